@@ -0,0 +1,125 @@
+#define ARENA_C
+
+#ifndef COMMON_H
+#include "common.h"
+#endif
+
+#include <stdalign.h> // alignof
+#include <stddef.h>   // max_align_t
+
+#define ARENA_MIN_CHUNK_SIZE (16 << 10)
+#define ARENA_ALIGN alignof(max_align_t)
+
+//
+// Bump allocator for objects that are all freed together, e.g. the chars of
+// the interned strings (see intern.c).
+//
+// Memory comes from a chain of chunks, each at least twice the size of the
+// one before it, so there is no limit on the number of objects and small
+// inputs only ever touch one small chunk. `arena_reset` rewinds to the first
+// chunk in O(1) and keeps the chunks for reuse; `arena_free` returns them.
+//
+typedef struct ArenaChunk ArenaChunk;
+struct ArenaChunk {
+    ArenaChunk *next;
+    size_t size;        // bytes in `data`
+    max_align_t data[];
+};
+
+typedef struct {
+    ArenaChunk *first;
+    ArenaChunk *current;
+    char *cursor;       // next free byte in `current`
+    char *end;          // end of `current`
+    size_t used;        // bytes allocated since the last reset
+    size_t high_water;  // most bytes allocated between two resets
+    size_t capacity;    // bytes in all chunks
+    int num_chunks;
+} Arena;
+
+// Make `current` a chunk with room for `size` bytes: the next one if it is
+// big enough, else a new one inserted after it
+static void arena_grow(Arena *a, const size_t size)
+{
+    ArenaChunk *next = a->current ? a->current->next : a->first;
+    if (!next || next->size < size) {
+        size_t chunk_size = a->current ? 2 * a->current->size : ARENA_MIN_CHUNK_SIZE;
+        while (chunk_size < size) chunk_size *= 2;
+
+        ArenaChunk *chunk = malloc(sizeof(ArenaChunk) + chunk_size);
+        if (!chunk) {
+            fprintf(stderr, "Out of memory (arena chunk of %zu bytes).\n", chunk_size);
+            exit(EXIT_FAILURE);
+        }
+        chunk->size = chunk_size;
+        chunk->next = next;
+        if (a->current) {
+            a->current->next = chunk;
+        } else {
+            a->first = chunk;
+        }
+        a->capacity += chunk_size;
+        a->num_chunks++;
+        next = chunk;
+    }
+    a->current = next;
+    a->cursor = (char *) next->data;
+    a->end = a->cursor + next->size;
+}
+
+// Returns `size` uninitialized bytes, with no alignment (e.g. for chars)
+static inline void *arena_alloc_bytes(Arena *a, const size_t size)
+{
+    if ((size_t) (a->end - a->cursor) < size) {
+        arena_grow(a, size);
+    }
+    void *p = a->cursor;
+    a->cursor += size;
+    a->used += size;
+    return p;
+}
+
+// Returns `size` uninitialized bytes aligned for any type
+static inline void *arena_alloc(Arena *a, const size_t size)
+{
+    const size_t padding = -(uintptr_t) a->cursor & (ARENA_ALIGN - 1);
+    if ((size_t) (a->end - a->cursor) < size + padding) {
+        arena_grow(a, size); // chunks start aligned
+    } else {
+        a->cursor += padding;
+    }
+    void *p = a->cursor;
+    a->cursor += size;
+    a->used += size;
+    return p;
+}
+
+// Free everything allocated so far at once; the chunks are kept for reuse
+void arena_reset(Arena *a)
+{
+    a->high_water = max(a->high_water, a->used);
+    a->used = 0;
+    a->current = a->first;
+    a->cursor = a->first ? (char *) a->first->data : NULL;
+    a->end = a->first ? a->cursor + a->first->size : NULL;
+}
+
+void arena_free(Arena *a)
+{
+    for (ArenaChunk *c = a->first, *next; c; c = next) {
+        next = c->next;
+        free(c);
+    }
+    memset(a, 0, sizeof(*a));
+}
+
+size_t arena_high_water(const Arena *a)
+{
+    return max(a->high_water, a->used);
+}
+
+void arena_pp(const Arena *a)
+{
+    printf("[Arena * %p] used %zu, high water %zu, capacity %zu in %d chunks\n",
+            (void *) a, a->used, arena_high_water(a), a->capacity, a->num_chunks);
+}
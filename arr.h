@@ -35,8 +35,8 @@
 // a[n]                          access the nth (counting from 0) element of the array
 //
 #define arr_add(a, n)       (_arr_maybe_grow(a,n), _arr_cnt(a)+=(n), &(a)[_arr_cnt(a)-(n)])
-#define arr_concat(a, b, n) (_arr_maybe_grow(a,n), _arr_cnt(a)+=(n), memcpy(&(a)[_arr_cnt(a)-(n)], (b), (n)))
-#define arr_copy(a, b, n)   (_arr_maybe_grow(a,n), _arr_cnt(a)=(n), memcpy(&(a)[0], (b), (n)))
+#define arr_concat(a, b, n) (_arr_maybe_grow(a,n), _arr_cnt(a)+=(n), memcpy(&(a)[_arr_cnt(a)-(n)], (b), (n)*sizeof(*(a))))
+#define arr_copy(a, b, n)   (_arr_maybe_grow(a,n), _arr_cnt(a)=(n), memcpy(&(a)[0], (b), (n)*sizeof(*(a))))
 #define arr_count(a)        ((a) ? _arr_cnt(a) : 0)
 #define arr_empty(a)        (!(a) || (_arr_cnt(a) == 0))
 // #define arr_end(a, i)       ((i) >= &(a)[_arr_cnt(a)])
@@ -62,7 +62,7 @@ static void *_arr_growf(void *arr, int increment, int item_size)
     int dbl_lim = arr ? 2 * _arr_lim(arr) : 0;
     int min_lim = arr_count(arr) + increment;
     int new_lim = dbl_lim > min_lim ? dbl_lim : min_lim;
-    int *p = (int *) realloc(arr ? _arr_raw(arr) : 0, item_size * new_lim + 2 * sizeof(int));
+    int *p = (int *) realloc(arr ? _arr_raw(arr) : 0, (size_t) item_size * new_lim + 2 * sizeof(int));
     if (p) {
         if (!arr) { p[1] = 0; }
         p[0] = new_lim;
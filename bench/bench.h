@@ -0,0 +1,63 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+//
+// Helpers shared by the benchmarks: a clock, a deterministic random number
+// generator (the same inputs on every machine) and the generator of the large
+// expressions the engine benchmarks evaluate.
+//
+#ifndef COMMON_H
+#include "../common.h"
+#endif
+
+#include <time.h> // clock_gettime
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static unsigned rng_state = 12345;
+
+static unsigned rng(void)
+{
+    rng_state = rng_state * 1103515245 + 12345;
+    return (rng_state >> 16) & 0x7FFF;
+}
+
+#define EXPRESSION_FORMS 5
+
+//
+// Append an expression of `terms` terms drawn from the first `num_forms` of
+// `forms` (each with at most 7 numbers), joined by `+` and, after a line
+// break every 8 terms, `-`, and a NUL. Returns its length.
+//
+// Without `forms`, the terms are like `(12 * 3.5 - 7) / 9` and `-(4 + 2) * 6`,
+// then with a comparison or two to exercise booleans and short-circuiting.
+//
+static int generate_expression(char **src, const int terms,
+        const char *forms[], const int num_forms)
+{
+    static const char *expression_forms[EXPRESSION_FORMS] = {
+        "(%u * %u.5 - %u) / %u", "-(%u + %u) * %u + %u", "(%u - %u) * (%u + %u)",
+        "(%u < %u and %u or %u)", "((%u == %u or %u) and (%u >= %u and %u or %u))",
+    };
+    if (!forms) {
+        forms = expression_forms;
+    }
+    for (int i = 0; i < terms; ++i) {
+        char term[128];
+        const int n = snprintf(term, sizeof(term), forms[rng() % num_forms],
+                rng() % 100 + 1, rng() % 100 + 1, rng() % 100 + 1, rng() % 100 + 1, rng() % 100 + 1,
+                rng() % 100 + 1, rng() % 100 + 1);
+        arr_concat(*src, term, n);
+        const char *join = i % 8 == 7 ? "\n - " : " + ";
+        arr_concat(*src, join, (int) strlen(join));
+    }
+    arr_concat(*src, "0\n", 3);
+    return arr_count(*src) - 1;
+}
+
+#endif
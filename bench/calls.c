@@ -0,0 +1,112 @@
+//
+// Call overhead: recursive fib (every call a full call and return),
+// mutually recursive even/odd (every call a tail call, so the recursion runs
+// in one frame however deep it goes) and a loop calling a two-argument leaf
+// function, on each engine. Reports the best time of each and the calls per
+// second.
+//
+// Usage: calls [n] [runs]   (fib of 25; even/odd of n and n loop iterations)
+//
+#define LOXY_TRACE 0
+
+#include "../scanner.c"
+#include "../parser.c"
+#include "../resolver.c"
+#include "../interp.c"
+#include "../compiler.c"
+#include "../vm.c"
+
+#include "bench.h"
+
+#define FIB_N 25
+
+static const char *variants[] = {
+    "fib",
+    "fn fib(n) { return n < 2 and n or fib(n - 1) + fib(n - 2); }\n"
+    "fib(%d)\n",
+    "mutual",
+    "fn even(n) { return n == 0 or odd(n - 1); }\n"
+    "fn odd(n) { return n != 0 and even(n - 1); }\n"
+    "even(%d)\n",
+    "leaf",
+    "fn add(a, b) { return a + b; }\n"
+    "var sum = 0;\n"
+    "{ var i = 0; while (i < %d) { sum = add(sum, i); i = i + 1; } }\n"
+    "sum\n",
+};
+
+// fib(n) makes 2 fib(n+1) - 1 calls
+static double fib_calls(const int n)
+{
+    double a = 0, b = 1;
+    for (int i = 0; i < n + 1; ++i) {
+        const double t = a + b;
+        a = b;
+        b = t;
+    }
+    return 2 * a - 1;
+}
+
+int main(int argc, const char *argv[])
+{
+    const int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    const int runs = argc > 2 ? atoi(argv[2]) : 5;
+    printf("fib(%d), n = %d, %d runs\n", FIB_N, n, runs);
+    printf("%-8s %-6s %10s %14s  %s\n", "calls", "engine", "ms", "Mcalls/s", "result");
+
+    for (int v = 0; v < 3; ++v) {
+        const int arg = v == 0 ? FIB_N : n;
+        const double calls = v == 0 ? fib_calls(FIB_N) : v == 1 ? n + 1.0 : n;
+        Buffer b = {.name = variants[2*v]};
+        b.len = snprintf(NULL, 0, variants[2*v + 1], arg);
+        b.head = malloc(b.len + 1);
+        snprintf(b.head, b.len + 1, variants[2*v + 1], arg);
+
+        Scanner s = {0};
+        Parser p = {.lines = &s.lines, .filename = b.name};
+        const TokenStream *tokens = scan(&s, &b);
+        Ast *ast = tokens && parse(&p, tokens) ? &p.ast : NULL;
+        Resolver r = {.tokens = tokens, .lines = &s.lines, .filename = b.name};
+        if (had_error || !ast || !resolve(&r, ast)) {
+            return 1;
+        }
+        Heap heap = {0};
+        for (int g = 0; g < arr_count(r.globals); ++g) {
+            arr_push(heap.globals, VALUE_UNDEFINED);
+        }
+
+        Compiler c = {.tokens = tokens, .lines = &s.lines, .filename = b.name};
+        Chunk chunk = {0};
+        if (!compile_ast(&c, ast, &chunk)) {
+            return 1;
+        }
+        Interpreter in = {.tokens = tokens, .lines = &s.lines, .filename = b.name, .heap = &heap};
+        VM vm = {.tokens = tokens, .lines = &s.lines, .filename = b.name, .heap = &heap};
+
+        Value results[2];
+        for (int engine = 0; engine < 2; ++engine) {
+            double best = 1e30;
+            for (int run = 0; run < runs; ++run) {
+                double start = now();
+                const bool ok = engine ? vm_run(&vm, &chunk, &results[engine])
+                                       : interpret(&in, ast, &results[engine]);
+                if (!ok) {
+                    return 1;
+                }
+                best = min(best, now() - start);
+            }
+            printf("%-8s %-6s %10.2f %14.1f  ", b.name, engine ? "vm" : "tree", best * 1e3,
+                    calls / best * 1e-6);
+            value_println(results[engine]);
+        }
+        if (results[0] != results[1]) {
+            printf("engines disagree\n");
+            return 1;
+        }
+        chunk_free(&chunk);
+        gc_free(&heap);
+        resolver_free(&r);
+        free(b.head);
+    }
+    return 0;
+}
@@ -0,0 +1,94 @@
+//
+// Batch check scaling: `check_run` over the same files on 1, 2, 4, ...
+// threads (up to the number of CPUs, or the given maximum). Every run is
+// checked to find the same number of files with errors.
+//
+// Usage: check [dir] [max_threads] [runs]
+//   Without a directory (or with "-"), checks 4000 generated files of
+//   1-16 KiB in a temporary directory, one in 20 with a scan error.
+//
+#define LOXY_TRACE 0
+
+#include "../check.c"
+#include "bench.h"
+
+#define GENERATED_FILES 4000
+
+static void generate(const char *dir)
+{
+    static const char *operands[] = {"1", "2.5", "\"str\"", "nil", "true", "(3 - 4)"};
+    static const char *ops[] = {" + ", " - ", " * ", " / ", " == ", " <= ", " and ", " or "};
+    char path[4096];
+    for (int i = 0; i < GENERATED_FILES; ++i) {
+        snprintf(path, sizeof(path), "%s/file%05d.lox", dir, i);
+        FILE *f = fopen(path, "w");
+        const int len = 1024 + rng() % (15 * 1024);
+        for (int n = 0; n < len; ) {
+            n += fprintf(f, "%s%s", operands[rng() % 6], ops[rng() % 8]);
+            if (rng() % 16 == 0) n += fprintf(f, "\n");
+        }
+        fprintf(f, "%s\n", i % 20 == 0 ? "@" : "0");
+        fclose(f);
+    }
+}
+
+int main(int argc, const char *argv[])
+{
+    const bool generated = argc < 2 || strcmp(argv[1], "-") == 0;
+    const int max_threads = argc > 2 ? atoi(argv[2]) : pool_num_cpus();
+    const int runs = argc > 3 ? atoi(argv[3]) : 5;
+
+    char tmp[] = "/tmp/loxy-check-XXXXXX";
+    const char *dir = argv[1];
+    if (generated) {
+        if (!mkdtemp(tmp)) {
+            fprintf(stderr, "Could not create a temporary directory.\n");
+            return ERR_FILE;
+        }
+        dir = tmp;
+        generate(dir);
+    }
+
+    Check c = {0};
+    check_add_path(&c, dir);
+    log_level = LOG_LVL_ERROR + 1; // only count the errors
+    printf("input: %d files, %d cpus, %d runs\n", arr_count(c.files), pool_num_cpus(), runs);
+    printf("%-8s %10s %8s\n", "threads", "files/s", "speedup");
+
+    double baseline = 0;
+    int num_errors = -1;
+    for (int threads = 1; threads <= max_threads; threads = threads < max_threads
+            ? min(threads * 2, max_threads) : threads + 1) {
+        ThreadPool pool;
+        pool_init(&pool, threads);
+        double best = 1e30;
+        for (int r = 0; r < runs; ++r) {
+            check_run(&c, &pool);
+            best = min(best, c.seconds);
+            if (num_errors != -1 && c.num_errors != num_errors) {
+                fprintf(stderr, "%d threads: %d files with errors, expected %d\n",
+                        threads, c.num_errors, num_errors);
+                return 1;
+            }
+            num_errors = c.num_errors;
+            for (int i = 0; i < arr_count(c.files); ++i) {
+                free(c.files[i].diagnostics);
+                c.files[i].diagnostics = NULL;
+            }
+        }
+        pool_destroy(&pool);
+        if (threads == 1) {
+            baseline = best;
+        }
+        printf("%-8d %10.0f %7.2fx\n", threads, arr_count(c.files) / best, baseline / best);
+    }
+
+    if (generated) {
+        for (int i = 0; i < arr_count(c.files); ++i) {
+            remove(c.files[i].path);
+        }
+        rmdir(dir);
+    }
+    check_free(&c);
+    return 0;
+}
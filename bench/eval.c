@@ -0,0 +1,55 @@
+//
+// Evaluator: evaluating one large arithmetic expression, unfolded, many
+// times. Reports nodes per second and the result (which must not change
+// between runs, or the value representation is broken).
+//
+// Usage: eval [terms] [runs]
+//
+#define LOXY_TRACE 0
+
+#include "../scanner.c"
+#include "../parser.c"
+#include "../interp.c"
+
+#include "bench.h"
+
+int main(int argc, const char *argv[])
+{
+    const int terms = argc > 1 ? atoi(argv[1]) : 100000;
+    const int runs = argc > 2 ? atoi(argv[2]) : 20;
+
+    Buffer b = {.name = "generated"};
+    b.len = generate_expression(&b.head, terms, NULL, 4);
+
+    Scanner s = {0};
+    const TokenStream *tokens = scan(&s, &b);
+    Parser p = {0};
+    const Ast *ast = tokens ? parse(&p, tokens) : NULL;
+    if (!ast) {
+        return 1;
+    }
+    printf("input: %d bytes, %d tokens, %d nodes, %d runs\n",
+            b.len, token_stream_count(tokens), ast->count, runs);
+
+    Interpreter in = {.tokens = tokens, .lines = &s.lines, .filename = b.name};
+    Value result = VALUE_NIL;
+    double best = 1e30;
+    for (int r = 0; r < runs; ++r) {
+        Value v;
+        double start = now();
+        if (!interpret(&in, ast, &v)) {
+            return 1;
+        }
+        best = min(best, now() - start);
+        if (r > 0 && v != result) {
+            printf("result changed between runs\n");
+            return 1;
+        }
+        result = v;
+    }
+    char *text = value_sprint(NULL, result);
+    printf("%10s %12s %12s  %s\n", "ms", "Mnodes/s", "ns/node", "result");
+    printf("%10.2f %12.1f %12.2f  %.*s\n", best * 1e3, ast->count / best * 1e-6,
+            best * 1e9 / ast->count, arr_count(text), text);
+    return 0;
+}
@@ -0,0 +1,51 @@
+//
+// Constant folding: parsing a config-style expression that is mostly constant
+// arithmetic, with and without folding. Reports the nodes, AST bytes and
+// parse time of each.
+//
+// Usage: fold [terms] [runs]
+//
+#define LOXY_TRACE 0
+
+#include "../scanner.c"
+#include "../parser.c"
+
+#include "bench.h"
+
+// Terms like `(60 * 60 * 24) * 7` and `(1024 * 1024) / 8`
+static const char *forms[] = {
+    "(%u * %u * %u) * %u", "(%u + %u) / (%u - %u)", "-(%u.%u * %u) + %u",
+    "(%u <= %u and %u or %u)",
+};
+
+int main(int argc, const char *argv[])
+{
+    const int terms = argc > 1 ? atoi(argv[1]) : 100000;
+    const int runs = argc > 2 ? atoi(argv[2]) : 10;
+
+    Buffer b = {.name = "generated"};
+    b.len = generate_expression(&b.head, terms, forms, 4);
+
+    Scanner s = {0};
+    const TokenStream *tokens = scan(&s, &b);
+    if (!tokens) {
+        return 1;
+    }
+    printf("input: %d bytes, %d tokens, %d runs\n", b.len, token_stream_count(tokens), runs);
+    printf("%-8s %10s %12s %10s\n", "fold", "nodes", "AST bytes", "ms");
+
+    for (int fold = 0; fold <= 1; ++fold) {
+        Parser p = {.fold = fold};
+        double best = 1e30;
+        for (int r = 0; r < runs; ++r) {
+            double start = now();
+            parse(&p, tokens);
+            best = min(best, now() - start);
+        }
+        const int nodes = p.ast.count;
+        const size_t bytes = nodes * (sizeof(*p.ast.types) + sizeof(*p.ast.tokens) + sizeof(*p.ast.args))
+            + p.ast.num_numbers * sizeof(*p.ast.numbers);
+        printf("%-8s %10d %12zu %10.2f\n", bool_str(fold), nodes, bytes, best * 1e3);
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+//
+// JIT: evaluating a hot expression many times with the tree-walker, with and
+// without its numeric subtrees compiled to native code. The `numeric` script
+// is all arithmetic; in the `mixed` one a quarter of the terms use `and`/`or`,
+// which the JIT leaves to the interpreter. Reports the time to compile and
+// the best evaluation time of each.
+//
+// Usage: jit [terms] [runs]
+//
+#define LOXY_TRACE 0
+
+#include "../scanner.c"
+#include "../parser.c"
+#include "../interp.c"
+
+#include "bench.h"
+
+static int bench(const char *name, const int terms, const int num_forms, const int runs)
+{
+    Buffer b = {.name = name};
+    b.len = generate_expression(&b.head, terms, NULL, num_forms);
+
+    Scanner s = {0};
+    const TokenStream *tokens = scan(&s, &b);
+    Parser p = {0};
+    const Ast *ast = tokens ? parse(&p, tokens) : NULL;
+    if (!ast) {
+        return 1;
+    }
+
+    Jit jit = {0};
+    double compile_time = 1e30;
+    for (int r = 0; r < 10; ++r) {
+        double start = now();
+        jit_compile(&jit, ast, tokens);
+        compile_time = min(compile_time, now() - start);
+    }
+    printf("%s: %d nodes; jit: %d regions, %d nodes, %zu bytes, compiled in %.3f ms%s\n",
+            name, ast->count, arr_count(jit.regions), jit.nodes, jit.code_used, compile_time * 1e3,
+            JIT_ENABLED ? "" : " (not supported here)");
+
+    Interpreter in = {.tokens = tokens, .lines = &s.lines, .filename = b.name};
+    Value results[2];
+    for (int native = 0; native <= 1; ++native) {
+        in.jit = native ? &jit : NULL;
+        double start = now();
+        for (int r = 0; r < runs; ++r) {
+            if (!interpret(&in, ast, &results[native])) {
+                return 1;
+            }
+        }
+        const double t = (now() - start) / runs;
+        char *text = value_sprint(NULL, results[native]);
+        printf("  %-6s %10.2f us %12.1f Mnodes/s  %.*s\n", native ? "jit" : "interp",
+                t * 1e6, ast->count / t * 1e-6, arr_count(text), text);
+    }
+    if (results[0] != results[1]) {
+        printf("results differ\n");
+        return 1;
+    }
+    printf("\n");
+    return 0;
+}
+
+int main(int argc, const char *argv[])
+{
+    const int terms = argc > 1 ? atoi(argv[1]) : 2000;
+    const int runs = argc > 2 ? atoi(argv[2]) : 2000;
+    return bench("numeric", terms, 3, runs) || bench("mixed", terms, 4, runs);
+}
@@ -0,0 +1,83 @@
+//
+// Keyword classification: the perfect-hash `find_keyword` against the
+// linear `str_ncmp` loop it replaced, over identifier-heavy input.
+//
+// Usage: keyword [iterations]
+//
+
+#include "../token.c"
+
+#include "bench.h"
+
+#define LINEAR_ENTRY(t, ...) {t, {KEYWORD_CHARS(__VA_ARGS__), KEYWORD_LEN(__VA_ARGS__)}},
+static const Keyword linear_keywords[] = {
+    KEYWORDS(LINEAR_ENTRY)
+};
+
+static const Keyword *find_keyword_linear(const str name)
+{
+    int len = name.len;
+    if (KEYWORD_MIN_LEN <= len && len <= KEYWORD_MAX_LEN) {
+        for (size_t i = 0; i < sizeof(linear_keywords) / sizeof(linear_keywords[0]); ++i) {
+            const Keyword *k = &linear_keywords[i];
+            if (len == k->name.len && str_ncmp(name, k->name, len) == 0) {
+                return k;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Roughly a quarter keywords; the rest are identifiers of keyword-like length
+static const char *words[] = {
+    "x", "i", "len", "this", "count", "while", "row", "value", "fn", "acc",
+    "result", "nil", "next", "prev", "index", "return", "sum", "node", "var",
+    "falsey", "format", "printer", "true", "super_", "class", "item", "or",
+    "value2", "totals", "elsewhere", "if", "idx",
+};
+
+#define NUM_WORDS (sizeof(words) / sizeof(words[0]))
+
+typedef const Keyword *(*FindKeyword)(const str name);
+
+static double run(FindKeyword find, const str *names, int n, int iterations, int *found)
+{
+    double start = now();
+    int hits = 0;
+    for (int it = 0; it < iterations; ++it) {
+        for (int i = 0; i < n; ++i) {
+            const Keyword *k = find(names[i]);
+            hits += k ? (int) k->type : 0;
+        }
+    }
+    *found = hits;
+    return now() - start;
+}
+
+int main(int argc, const char *argv[])
+{
+    const int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+    const int n = 4096;
+
+    str *names = malloc(sizeof(str) * n);
+    unsigned seed = 1;
+    for (int i = 0; i < n; ++i) {
+        seed = seed * 1103515245 + 12345;
+        names[i] = str_new(words[(seed >> 16) % NUM_WORDS]);
+    }
+
+    int linear_hits, hash_hits;
+    double linear = run(find_keyword_linear, names, n, iterations, &linear_hits);
+    double hash = run(find_keyword, names, n, iterations, &hash_hits);
+    if (linear_hits != hash_hits) {
+        fprintf(stderr, "Keyword lookups disagree: %d != %d\n", linear_hits, hash_hits);
+        return 1;
+    }
+
+    double lookups = (double) n * iterations;
+    printf("%-8s %12s %10s\n", "lookup", "Mlookups/s", "ns/lookup");
+    printf("%-8s %12.1f %10.2f\n", "linear", lookups / linear / 1e6, linear / lookups * 1e9);
+    printf("%-8s %12.1f %10.2f\n", "hash", lookups / hash / 1e6, hash / lookups * 1e9);
+    printf("speedup: %.2fx\n", linear / hash);
+    return 0;
+}
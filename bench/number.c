@@ -0,0 +1,84 @@
+//
+// Number literal parsing: `number_parse` on the source span against the copy
+// into a NUL-terminated buffer plus `atof` it replaced, over numeric-literal-
+// heavy input. Every literal is checked to parse to the same double.
+//
+// Usage: number [count] [runs]
+//
+#include "../number.c"
+
+#include "bench.h"
+
+static double parse_atof(const char *p, const int len)
+{
+    static char *buf = NULL;
+    arr_copy(buf, p, len); arr_push(buf, '\0');
+    return atof(buf);
+}
+
+typedef struct {
+    const char *name;
+    double (*parse)(const char *p, const int len);
+} NumberParser;
+
+int main(int argc, const char *argv[])
+{
+    const int count = argc > 1 ? atoi(argv[1]) : 1000000;
+    const int runs = argc > 2 ? atoi(argv[2]) : 10;
+
+    // A data table: integers, prices, coordinates and long fractions
+    char *src = NULL;
+    int *offsets = NULL;
+    for (int i = 0; i < count; ++i) {
+        char lit[64];
+        switch (rng() % 4) {
+            case 0: snprintf(lit, sizeof(lit), "%u", rng() * 1000 + rng() % 1000); break;
+            case 1: snprintf(lit, sizeof(lit), "%u.%02u", rng() % 10000, rng() % 100); break;
+            case 2: snprintf(lit, sizeof(lit), "%u.%06u", rng() % 360, rng() * 30 % 1000000); break;
+            case 3: snprintf(lit, sizeof(lit), "0.%u%u%u%u", rng(), rng(), rng(), rng()); break;
+        }
+        arr_push(offsets, arr_count(src));
+        arr_concat(src, lit, (int) strlen(lit));
+        arr_push(src, ' ');
+    }
+    arr_push(offsets, arr_count(src));
+
+    const NumberParser parsers[] = {
+        {"atof", parse_atof},
+        {"number_parse", number_parse},
+    };
+    double *expected = malloc(count * sizeof(double));
+    for (int i = 0; i < count; ++i) {
+        expected[i] = parse_atof(src + offsets[i], offsets[i+1] - offsets[i] - 1);
+    }
+
+    printf("literals: %d (%d bytes), %d runs\n", count, arr_count(src), runs);
+    printf("%-14s %12s %10s %8s\n", "parser", "Mnumbers/s", "MB/s", "speedup");
+    double baseline = 0;
+    for (size_t k = 0; k < sizeof(parsers) / sizeof(parsers[0]); ++k) {
+        double best = 1e30;
+        double sum = 0;
+        for (int r = 0; r < runs; ++r) {
+            double start = now();
+            sum = 0;
+            for (int i = 0; i < count; ++i) {
+                sum += parsers[k].parse(src + offsets[i], offsets[i+1] - offsets[i] - 1);
+            }
+            best = min(best, now() - start);
+        }
+        for (int i = 0; i < count; ++i) {
+            double d = parsers[k].parse(src + offsets[i], offsets[i+1] - offsets[i] - 1);
+            if (memcmp(&d, &expected[i], sizeof(d)) != 0) {
+                fprintf(stderr, "%s: \"%.*s\" parsed to %.17g, expected %.17g\n", parsers[k].name,
+                        offsets[i+1] - offsets[i] - 1, src + offsets[i], d, expected[i]);
+                return 1;
+            }
+        }
+        if (k == 0) {
+            baseline = best;
+        }
+        printf("%-14s %12.2f %10.1f %7.2fx   (sum %g)\n", parsers[k].name, count / best / 1e6,
+                arr_count(src) / best / 1e6, baseline / best, sum);
+    }
+    return 0;
+}
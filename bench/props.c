@@ -0,0 +1,159 @@
+//
+// Property access: a loop whose property sites see six instances in turn,
+// built so the sites see one shape (monomorphic), three (polymorphic) or six,
+// more than an inline cache keeps (megamorphic). The loop is the same in
+// each; only how the instances got their fields differs. Then the same
+// accesses made by two method calls, on instances of one, three or six
+// classes, so the call sites see as many shapes. Reports the best time of
+// each engine and the property accesses (or method calls) per second.
+//
+// Usage: props [iterations] [runs]
+//
+#define LOXY_TRACE 0
+
+#include "../scanner.c"
+#include "../parser.c"
+#include "../resolver.c"
+#include "../interp.c"
+#include "../compiler.c"
+#include "../vm.c"
+
+#include "bench.h"
+
+#define INSTANCES 6
+
+// 3 reads and a write per iteration, then the next instance is rotated in
+#define LOOP \
+    "var i = 0; var sum = 0; var o;\n" \
+    "while (i < %d) {\n" \
+    "    o = s0; s0 = s1; s1 = s2; s2 = s3; s3 = s4; s4 = s5; s5 = o;\n" \
+    "    sum = sum + o.x + o.y;\n" \
+    "    o.x = o.x + 1;\n" \
+    "    i = i + 1;\n" \
+    "}\n" \
+    "result = sum;\n"
+#define ACCESSES_PER_ITERATION 4
+
+// The same accesses through 2 method calls per iteration
+#define METHOD_LOOP \
+    "var i = 0; var sum = 0; var o;\n" \
+    "while (i < %d) {\n" \
+    "    o = s0; s0 = s1; s1 = s2; s2 = s3; s3 = s4; s4 = s5; s5 = o;\n" \
+    "    sum = sum + o.get();\n" \
+    "    o.bump();\n" \
+    "    i = i + 1;\n" \
+    "}\n" \
+    "result = sum;\n"
+#define CALLS_PER_ITERATION 2
+
+// Each class of the instances
+#define CLASS \
+    "class C%d {\n" \
+    "    get() { return this.x + this.y; }\n" \
+    "    bump() { this.x = this.x + 1; }\n" \
+    "}\n"
+
+typedef struct {
+    const char *name;
+    int pads[INSTANCES];    // of each instance
+    int classes[INSTANCES]; // of each instance
+    bool calls;             // make the accesses through method calls
+} Variant;
+
+// The program with instance `k` of class `classes[k]`, given `pads[k]` other
+// fields before x and y
+static Buffer program(const Variant *v, const int iterations)
+{
+    static const char head[] = "var result;\n{\n";
+    static const char tail[] = "}\nresult\n";
+    char *src = NULL; // arr
+    char line[256];
+    for (int k = 0; k < INSTANCES; ++k) {
+        arr_concat(src, line, snprintf(line, sizeof(line), CLASS, k));
+    }
+    arr_concat(src, head, (int) sizeof(head) - 1);
+    for (int k = 0; k < INSTANCES; ++k) {
+        arr_concat(src, line, snprintf(line, sizeof(line), "var s%d = C%d();", k, v->classes[k]));
+        for (int p = 0; p < v->pads[k]; ++p) {
+            arr_concat(src, line, snprintf(line, sizeof(line), " s%d.p%d = 0;", k, p));
+        }
+        arr_concat(src, line, snprintf(line, sizeof(line), " s%d.x = %d; s%d.y = 1;\n", k, k, k));
+    }
+    arr_concat(src, line, snprintf(line, sizeof(line), v->calls ? METHOD_LOOP : LOOP, iterations));
+    arr_concat(src, tail, (int) sizeof(tail) - 1);
+    Buffer b = {.name = v->name, .len = arr_count(src), .head = malloc(arr_count(src) + 1)};
+    memcpy(b.head, src, b.len);
+    b.head[b.len] = '\0';
+    arr_free(src);
+    return b;
+}
+
+static const Variant variants[] = {
+    {"mono", {0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}, false},
+    {"poly", {0, 1, 2, 0, 1, 2}, {0, 0, 0, 0, 0, 0}, false},
+    {"mega", {0, 1, 2, 3, 4, 5}, {0, 0, 0, 0, 0, 0}, false},
+    {"mono()", {0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}, true},
+    {"poly()", {0, 0, 0, 0, 0, 0}, {0, 1, 2, 0, 1, 2}, true},
+    {"mega()", {0, 0, 0, 0, 0, 0}, {0, 1, 2, 3, 4, 5}, true},
+};
+
+int main(int argc, const char *argv[])
+{
+    const int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+    const int runs = argc > 2 ? atoi(argv[2]) : 5;
+    printf("%d iterations, %d runs, %d property accesses per iteration, or %d method calls\n",
+            iterations, runs, ACCESSES_PER_ITERATION, CALLS_PER_ITERATION);
+    printf("%-8s %-6s %10s %14s  %s\n", "sites", "engine", "ms", "M/s", "result");
+
+    for (int v = 0; v < (int) (sizeof(variants) / sizeof(variants[0])); ++v) {
+        Buffer b = program(&variants[v], iterations);
+        const int ops = variants[v].calls ? CALLS_PER_ITERATION : ACCESSES_PER_ITERATION;
+
+        Scanner s = {0};
+        Parser p = {.lines = &s.lines, .filename = b.name};
+        const TokenStream *tokens = scan(&s, &b);
+        Ast *ast = tokens && parse(&p, tokens) ? &p.ast : NULL;
+        Resolver r = {.tokens = tokens, .lines = &s.lines, .filename = b.name};
+        if (had_error || !ast || !resolve(&r, ast)) {
+            return 1;
+        }
+        Heap heap = {0};
+        for (int g = 0; g < arr_count(r.globals); ++g) {
+            arr_push(heap.globals, VALUE_UNDEFINED);
+        }
+
+        Compiler c = {.tokens = tokens, .lines = &s.lines, .filename = b.name};
+        Chunk chunk = {0};
+        if (!compile_ast(&c, ast, &chunk)) {
+            return 1;
+        }
+        Interpreter in = {.tokens = tokens, .lines = &s.lines, .filename = b.name, .heap = &heap};
+        VM vm = {.tokens = tokens, .lines = &s.lines, .filename = b.name, .heap = &heap};
+
+        Value results[2];
+        for (int engine = 0; engine < 2; ++engine) {
+            double best = 1e30;
+            for (int run = 0; run < runs; ++run) {
+                double start = now();
+                const bool ok = engine ? vm_run(&vm, &chunk, &results[engine])
+                                       : interpret(&in, ast, &results[engine]);
+                if (!ok) {
+                    return 1;
+                }
+                best = min(best, now() - start);
+            }
+            printf("%-8s %-6s %10.2f %14.1f  ", b.name, engine ? "vm" : "tree", best * 1e3,
+                    (double) iterations * ops / best * 1e-6);
+            value_println(results[engine]);
+        }
+        if (results[0] != results[1]) {
+            printf("engines disagree\n");
+            return 1;
+        }
+        chunk_free(&chunk);
+        gc_free(&heap);
+        resolver_free(&r);
+        free(b.head);
+    }
+    return 0;
+}
@@ -0,0 +1,115 @@
+//
+// Parallel scanner scaling: `scan_parallel` on 1, 2, 4, ... threads (up to
+// the number of CPUs, or the given maximum) against the serial `scan`, over
+// the same input. Every run is checked to produce the serial token stream.
+//
+// Usage: pscan [path] [max_threads] [runs]
+//   Without a path (or with "-"), scans a generated ~64 MiB program that
+//   includes multi-line strings and comments containing quotes.
+//
+#define LOXY_TRACE 0
+
+#include "../pscan.c"
+
+#include "bench.h"
+
+#define GENERATED_LEN (64 << 20)
+
+static int generate(char *buf, const int len)
+{
+    static const char *idents[] = {
+        "x", "count", "total_amount", "velocity", "accumulated_value_for_row",
+        "this", "nil", "true", "while", "return", "super",
+    };
+    static const char *ops[] = {" + ", " - ", " * ", " / ", " == ", " <= ", " != ", ">"};
+    int n = 0;
+    while (n < len - 256) {
+        n += sprintf(buf + n, "%*s", (int) (rng() % 4) * 4, "");
+        for (int i = rng() % 8; i >= 0; --i) {
+            switch (rng() % 5) {
+                case 0: n += sprintf(buf + n, "%s", idents[rng() % 11]); break;
+                case 1: n += sprintf(buf + n, "%u.%u", rng(), rng() % 1000); break;
+                case 2: n += sprintf(buf + n, "\"string literal number %u\"", rng()); break;
+                case 3: n += sprintf(buf + n, "(%s%u)", idents[rng() % 11], rng() % 100); break;
+                case 4:
+                    if (rng() % 64 == 0) {
+                        n += sprintf(buf + n, "\"multi-line\n  // not a comment\n  string %u\"", rng());
+                    } else {
+                        n += sprintf(buf + n, "%s", idents[rng() % 11]);
+                    }
+                    break;
+            }
+            n += sprintf(buf + n, "%s", ops[rng() % 8]);
+        }
+        n += sprintf(buf + n, "1;%s\n", rng() % 4 ? "" : "   // trailing \"comment\" on this line");
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+static bool same_tokens(const TokenStream *a, const TokenStream *b)
+{
+    const int n = token_stream_count(a);
+    return n == token_stream_count(b)
+        && memcmp(a->types, b->types, n * sizeof(*a->types)) == 0
+        && memcmp(a->offsets, b->offsets, n * sizeof(*a->offsets)) == 0
+        && memcmp(a->lens, b->lens, n * sizeof(*a->lens)) == 0;
+}
+
+int main(int argc, const char *argv[])
+{
+    const bool generated = argc < 2 || strcmp(argv[1], "-") == 0;
+    const int max_threads = argc > 2 ? atoi(argv[2]) : pool_num_cpus();
+    const int runs = argc > 3 ? atoi(argv[3]) : 5;
+
+    Buffer b;
+    if (!generated) {
+        if (buffer_map_file(&b, argv[1]) != 1) {
+            fprintf(stderr, "Could not map file \"%s\".\n", argv[1]);
+            return ERR_FILE;
+        }
+    } else {
+        buffer_init(&b, GENERATED_LEN);
+        b.len = generate(b.head, GENERATED_LEN);
+    }
+    b.name = generated ? "generated" : argv[1];
+    const int len = b.len;
+
+    Scanner serial = {0};
+    double best = 1e30;
+    for (int r = 0; r < runs; ++r) {
+        double start = now();
+        if (!scan(&serial, &b)) {
+            fprintf(stderr, "%s: scan failed\n", b.name);
+            return 1;
+        }
+        best = min(best, now() - start);
+    }
+    const double baseline = best;
+    const int count = token_stream_count(&serial.tokens);
+
+    printf("input: %d bytes, %d tokens, %d cpus, %d runs\n", len, count, pool_num_cpus(), runs);
+    printf("%-8s %10s %12s %8s\n", "threads", "MB/s", "Mtokens/s", "speedup");
+    printf("%-8s %10.1f %12.2f %7.2fx\n", "serial", len / baseline / 1e6, count / baseline / 1e6, 1.0);
+
+    Scanner s = {0};
+    for (int threads = 1; threads <= max_threads; threads = threads < max_threads
+            ? min(threads * 2, max_threads) : threads + 1) {
+        ThreadPool pool;
+        pool_init(&pool, threads);
+        best = 1e30;
+        for (int r = 0; r < runs; ++r) {
+            double start = now();
+            const TokenStream *tokens = scan_parallel(&s, &b, &pool);
+            best = min(best, now() - start);
+            if (!tokens || !same_tokens(tokens, &serial.tokens)) {
+                fprintf(stderr, "%d threads: tokens differ from the serial scanner\n", threads);
+                return 1;
+            }
+        }
+        pool_destroy(&pool);
+        printf("%-8d %10.1f %12.2f %7.2fx\n", threads,
+                len / best / 1e6, count / best / 1e6, baseline / best);
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+//
+// Scanner throughput: the table-driven `scan` and the streaming scanner,
+// each with every set of scan kernels (scalar byte loop, SSE2, AVX2) skipping
+// the runs inside tokens, over the same input. Speedups are against
+// dfa/scalar.
+//
+// Usage: scan [path] [runs]
+//   Without a path, scans a generated ~8 MiB program.
+//
+#define LOXY_TRACE 0
+
+#include "../scanner.c"
+#include "../stream.c"
+
+#include "bench.h"
+
+#define GENERATED_LEN (8 << 20)
+
+static int generate(char *buf, const int len)
+{
+    static const char *idents[] = {
+        "x", "count", "total_amount", "velocity", "accumulated_value_for_row",
+        "this", "nil", "true", "while", "return", "super",
+    };
+    static const char *ops[] = {" + ", " - ", " * ", " / ", " == ", " <= ", " != ", ">"};
+    int n = 0;
+    while (n < len - 256) {
+        n += sprintf(buf + n, "%*s", (int) (rng() % 4) * 4, "");
+        for (int i = rng() % 8; i >= 0; --i) {
+            switch (rng() % 4) {
+                case 0: n += sprintf(buf + n, "%s", idents[rng() % 11]); break;
+                case 1: n += sprintf(buf + n, "%u.%u", rng(), rng() % 1000); break;
+                case 2: n += sprintf(buf + n, "\"string literal number %u\"", rng()); break;
+                case 3: n += sprintf(buf + n, "(%s%u)", idents[rng() % 11], rng() % 100); break;
+            }
+            n += sprintf(buf + n, "%s", ops[rng() % 8]);
+        }
+        n += sprintf(buf + n, "1;%s\n", rng() % 4 ? "" : "   // trailing comment on this line");
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+static void count_token(void *ctx, const Token *t)
+{
+    ++*(long *) ctx;
+}
+
+int main(int argc, const char *argv[])
+{
+    const int runs = argc > 2 ? atoi(argv[2]) : 10;
+
+    Buffer b;
+    if (argc > 1) {
+        if (buffer_map_file(&b, argv[1]) != 1) {
+            fprintf(stderr, "Could not map file \"%s\".\n", argv[1]);
+            return ERR_FILE;
+        }
+    } else {
+        buffer_init(&b, GENERATED_LEN);
+        b.len = generate(b.head, GENERATED_LEN);
+    }
+    b.name = argc > 1 ? argv[1] : "generated";
+    const int len = b.len;
+    int num_lines = 1;
+    for (const char *c = b.head; (c = memchr(c, '\n', b.head + len - c)); ++c) num_lines++;
+
+    Scanner s = {0};
+
+    printf("input: %d bytes, %d lines, %d runs\n", len, num_lines, runs);
+    printf("%-14s %10s %10s %12s %8s\n", "scanner", "tokens", "MB/s", "Mtokens/s", "speedup");
+
+    double baseline = 0;
+    long expected = -1;
+    const ScanKernelKind kinds[] = {SCAN_KERNEL_SCALAR, SCAN_KERNEL_SSE2, SCAN_KERNEL_AVX2};
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); ++k) {
+        const ScanKernels *kernels = scan_kernels_use(kinds[k]);
+        if (!kernels) {
+            continue;
+        }
+        double best = 1e30;
+        for (int r = 0; r < runs; ++r) {
+            double start = now();
+            scan(&s, &b);
+            best = min(best, now() - start);
+        }
+        const long count = token_stream_count(&s.tokens);
+        if (expected < 0) {
+            baseline = best;
+            expected = count;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "dfa/%s", kernels->name);
+        printf("%-14s %10ld %10.1f %12.2f %7.2fx\n", name, count,
+                len / best / 1e6, count / best / 1e6, baseline / best);
+
+        StreamScanner ss = {0};
+        long streamed = 0;
+        best = 1e30;
+        for (int r = 0; r < runs; ++r) {
+            double start = now();
+            stream_init(&ss, b.name, count_token, &streamed);
+            streamed = 0;
+            for (int off = 0; off < len; off += STREAM_CHUNK_LEN) {
+                stream_feed(&ss, b.head + off, min(STREAM_CHUNK_LEN, len - off));
+            }
+            stream_finish(&ss);
+            best = min(best, now() - start);
+        }
+        if (count != expected || streamed != expected) {
+            fprintf(stderr, "%s: token counts %ld (dfa) and %ld (stream) differ from %ld\n",
+                    kernels->name, count, streamed, expected);
+            return 1;
+        }
+        snprintf(name, sizeof(name), "stream/%s", kernels->name);
+        printf("%-14s %10ld %10.1f %12.2f %7.2fx\n", name, streamed,
+                len / best / 1e6, streamed / best / 1e6, baseline / best);
+    }
+    return 0;
+}
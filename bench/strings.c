@@ -0,0 +1,94 @@
+//
+// String building: a loop that appends (or prepends) a short piece to a
+// string n times, then compares the result with itself plus a character,
+// which flattens both, at growing n. With ropes each step is O(1), so the
+// time per step stays flat as the string grows to megabytes; copying both
+// operands on every `+` would make it grow with n. Reports the best time of
+// each engine and the nanoseconds per step.
+//
+// Usage: strings [max n] [runs]   (n from 10000 up to max n, times 10)
+//
+#define LOXY_TRACE 0
+
+#include "../scanner.c"
+#include "../parser.c"
+#include "../resolver.c"
+#include "../interp.c"
+#include "../compiler.c"
+#include "../vm.c"
+
+#include "bench.h"
+
+#define PIECE "abcdefgh"
+
+static const char *variants[] = {
+    "append",
+    "var s = \"\";\n"
+    "{ var i = 0; while (i < %d) { s = s + \"" PIECE "\"; i = i + 1; } }\n"
+    "s + \".\" == s + \".\"\n",
+    "prepend",
+    "var s = \"\";\n"
+    "{ var i = 0; while (i < %d) { s = \"" PIECE "\" + s; i = i + 1; } }\n"
+    "s + \".\" == s + \".\"\n",
+};
+
+int main(int argc, const char *argv[])
+{
+    const int max_n = argc > 1 ? atoi(argv[1]) : 1000000;
+    const int runs = argc > 2 ? atoi(argv[2]) : 3;
+    printf("pieces of %d chars, %d runs\n", (int) sizeof(PIECE) - 1, runs);
+    printf("%-8s %8s %-6s %10s %10s %12s  %s\n", "strings", "n", "engine", "MB", "ms", "ns/step",
+            "result");
+
+    for (int v = 0; v < 2; ++v) {
+        for (int n = 10000; n <= max_n; n *= 10) {
+            Buffer b = {.name = variants[2*v]};
+            b.len = snprintf(NULL, 0, variants[2*v + 1], n);
+            b.head = malloc(b.len + 1);
+            snprintf(b.head, b.len + 1, variants[2*v + 1], n);
+
+            Scanner s = {0};
+            Parser p = {.lines = &s.lines, .filename = b.name};
+            const TokenStream *tokens = scan(&s, &b);
+            Ast *ast = tokens && parse(&p, tokens) ? &p.ast : NULL;
+            Resolver r = {.tokens = tokens, .lines = &s.lines, .filename = b.name};
+            if (had_error || !ast || !resolve(&r, ast)) {
+                return 1;
+            }
+            Heap heap = {0};
+            for (int g = 0; g < arr_count(r.globals); ++g) {
+                arr_push(heap.globals, VALUE_UNDEFINED);
+            }
+
+            Compiler c = {.tokens = tokens, .lines = &s.lines, .filename = b.name};
+            Chunk chunk = {0};
+            if (!compile_ast(&c, ast, &chunk)) {
+                return 1;
+            }
+            Interpreter in = {.tokens = tokens, .lines = &s.lines, .filename = b.name, .heap = &heap};
+            VM vm = {.tokens = tokens, .lines = &s.lines, .filename = b.name, .heap = &heap};
+
+            for (int engine = 0; engine < 2; ++engine) {
+                double best = 1e30;
+                Value result;
+                for (int run = 0; run < runs; ++run) {
+                    double start = now();
+                    const bool ok = engine ? vm_run(&vm, &chunk, &result)
+                                           : interpret(&in, ast, &result);
+                    if (!ok) {
+                        return 1;
+                    }
+                    best = min(best, now() - start);
+                }
+                printf("%-8s %8d %-6s %10.1f %10.2f %12.1f  ", b.name, n, engine ? "vm" : "tree",
+                        n * (sizeof(PIECE) - 1) * 1e-6, best * 1e3, best / n * 1e9);
+                value_println(result);
+            }
+            chunk_free(&chunk);
+            gc_free(&heap);
+            resolver_free(&r);
+            free(b.head);
+        }
+    }
+    return 0;
+}
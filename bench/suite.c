@@ -0,0 +1,275 @@
+//
+// End-to-end front end benchmark: scanning, parsing and printing (as by
+// --ast) timed separately over generated corpora that each stress something
+// different. Every phase runs `runs` times on the same input; the table gives
+// the throughput of the best run and the JSON (--json) the best and median
+// times too, so runs can be saved and diffed.
+//
+// The corpora are deterministic: the same kind and size give the same bytes
+// on every machine. `--corpus kind` writes one to stdout instead, e.g. to
+// time the optimized loxy (`make release`) on it.
+//
+// Usage: suite [--json] [--corpus kind] [MiB] [runs]   (4 MiB each, 10 runs)
+//   kinds: idents, numbers, nested, comments, strings
+//
+#define LOXY_TRACE 0
+
+#include "../scanner.c"
+#include "../parser.c"
+
+#include "bench.h"
+
+static void emit(char **src, const char *fmt, ...)
+{
+    char line[256];
+    va_list args;
+    va_start(args, fmt);
+    const int n = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    arr_concat(*src, line, n);
+}
+
+static const char *words[] = {
+    "total", "count", "index", "customer", "account", "balance", "interest", "rate",
+    "period", "previous", "next", "value", "result", "buffer", "offset", "length",
+};
+#define WORDS (int) (sizeof(words) / sizeof(words[0]))
+
+// A name of one to four words joined by `_`, sometimes with a number after
+static void emit_name(char **src)
+{
+    emit(src, "%s", words[rng() % WORDS]);
+    for (int i = rng() % 4; i > 0; --i) {
+        emit(src, "_%s", words[rng() % WORDS]);
+    }
+    if (rng() % 2) {
+        emit(src, "%u", rng() % 100);
+    }
+}
+
+// Declarations, assignments and prints of long names, with property chains
+static void gen_idents(char **src)
+{
+    switch (rng() % 3) {
+        case 0: emit(src, "var "); emit_name(src); emit(src, " = "); break;
+        case 1: emit(src, "print "); break;
+        case 2: emit_name(src); emit(src, " = "); break;
+    }
+    for (int i = rng() % 4; i >= 0; --i) {
+        emit_name(src);
+        for (int k = rng() % 3; k > 0; --k) {
+            emit(src, ".");
+            emit_name(src);
+        }
+        emit(src, i ? (rng() % 2 ? " + " : " * ") : ";\n");
+    }
+}
+
+// Arithmetic on literals: integers, decimals and long decimals
+static void gen_numbers(char **src)
+{
+    emit(src, "print ");
+    for (int i = rng() % 8; i >= 0; --i) {
+        switch (rng() % 3) {
+            case 0: emit(src, "%u", rng()); break;
+            case 1: emit(src, "%u.%u", rng() % 1000, rng()); break;
+            case 2: emit(src, "%u%u.%u%u", rng(), rng(), rng(), rng()); break;
+        }
+        emit(src, i ? (const char *[]) {" + ", " - ", " * ", " / ", " < "}[rng() % 5] : ";\n");
+    }
+}
+
+// Blocks and loops nested up to 32 deep around expressions nested up to 128
+static void gen_nested(char **src)
+{
+    const int blocks = rng() % 32 + 1;
+    for (int i = 0; i < blocks; ++i) {
+        emit(src, i % 4 == 3 ? "while (x < %u) { " : "{ ", rng() % 10);
+    }
+    emit(src, "print ");
+    const int parens = rng() % 128 + 1;
+    for (int i = 0; i < parens; ++i) {
+        emit(src, rng() % 4 ? "(%u + " : "-(", rng() % 10);
+    }
+    emit(src, "x");
+    for (int i = 0; i < parens; ++i) {
+        emit(src, ")");
+    }
+    emit(src, ";");
+    for (int i = 0; i < blocks; ++i) {
+        emit(src, " }");
+    }
+    emit(src, "\n");
+}
+
+// Short statements among whole-line and trailing comments
+static void gen_comments(char **src)
+{
+    for (int i = rng() % 4; i >= 0; --i) {
+        emit(src, "%*s//", (int) (rng() % 3) * 4, "");
+        for (int k = rng() % 12 + 1; k > 0; --k) {
+            emit(src, " %s", words[rng() % WORDS]);
+        }
+        emit(src, "\n");
+    }
+    emit(src, "var %s = %u;", words[rng() % WORDS], rng());
+    emit(src, rng() % 2 ? " // %s %s\n" : "\n", words[rng() % WORDS], words[rng() % WORDS]);
+}
+
+// String literals of up to 16 KiB, some spanning lines
+static void gen_strings(char **src)
+{
+    emit(src, rng() % 2 ? "var s = \"" : "print s + \"");
+    for (int len = rng() % (16 << 10); len > 0; --len) {
+        arr_push(*src, rng() % 64 ? (char) (' ' + rng() % 95) : '\n');
+        if (arr_last(*src) == '"' || arr_last(*src) == '\\') {
+            arr_last(*src) = '.';
+        }
+    }
+    emit(src, "\";\n");
+}
+
+static const struct {
+    const char *name;
+    void (*statement)(char **src);
+} corpora[] = {
+    {"idents", gen_idents},
+    {"numbers", gen_numbers},
+    {"nested", gen_nested},
+    {"comments", gen_comments},
+    {"strings", gen_strings},
+};
+#define CORPORA (int) (sizeof(corpora) / sizeof(corpora[0]))
+
+// The corpus `k` of about `size` bytes, NUL-terminated
+static Buffer generate(const int k, const int size)
+{
+    rng_state = 12345 + k;
+    char *src = NULL; // arr
+    while (arr_count(src) < size) {
+        corpora[k].statement(&src);
+    }
+    arr_push(src, '\0');
+    return (Buffer) {.name = corpora[k].name, .head = src, .len = arr_count(src) - 1};
+}
+
+typedef struct {
+    double best;
+    double median;
+} Times;
+
+static int compare_doubles(const void *a, const void *b)
+{
+    const double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static Times summarize(double *times, const int runs)
+{
+    qsort(times, runs, sizeof(*times), compare_doubles);
+    return (Times) {times[0], times[runs / 2]};
+}
+
+int main(int argc, const char *argv[])
+{
+    bool json = false;
+    int corpus = -1;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; ++i) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[i], "--corpus") == 0 && i + 1 < argc) {
+            for (corpus = 0; corpus < CORPORA && strcmp(corpora[corpus].name, argv[i+1]) != 0; ++corpus) {}
+            if (corpus == CORPORA) {
+                fprintf(stderr, "Unknown corpus: %s\n", argv[i+1]);
+                return 64;
+            }
+            ++i;
+        } else {
+            fputs("Usage: suite [--json] [--corpus kind] [MiB] [runs]\n", stderr);
+            return 64;
+        }
+    }
+    const double mib = i < argc ? atof(argv[i]) : 4;
+    const int runs = max(i + 1 < argc ? atoi(argv[i+1]) : 10, 1);
+    const int size = (int) (mib * (1 << 20));
+
+    if (corpus >= 0) {
+        Buffer b = generate(corpus, size);
+        fwrite(b.head, 1, b.len, stdout);
+        arr_free(b.head);
+        return 0;
+    }
+
+    if (json) {
+        printf("{\n  \"bytes_per_corpus\": %d,\n  \"runs\": %d,\n  \"corpora\": [", size, runs);
+    } else {
+        printf("%.1f MiB per corpus, %d runs, best of each\n", mib, runs);
+        printf("%-9s %9s %9s | %8s %8s %9s | %8s %9s %9s | %8s %9s %8s\n", "corpus", "tokens",
+                "nodes", "scan ms", "MB/s", "Mtok/s", "parse ms", "Mtok/s", "Mnodes/s",
+                "print ms", "Mnodes/s", "MB/s");
+    }
+    double *times = malloc(runs * sizeof(*times));
+    for (int k = 0; k < CORPORA; ++k) {
+        Buffer b = generate(k, size);
+
+        Scanner s = {0};
+        const TokenStream *tokens = NULL;
+        for (int run = 0; run < runs; ++run) {
+            const double start = now();
+            tokens = scan(&s, &b);
+            times[run] = now() - start;
+        }
+        const Times scan_times = summarize(times, runs);
+
+        Parser p = {.lines = &s.lines, .filename = b.name};
+        for (int run = 0; tokens && run < runs; ++run) {
+            const double start = now();
+            parse(&p, tokens);
+            times[run] = now() - start;
+        }
+        if (had_error || !tokens) {
+            fprintf(stderr, "%s: the corpus does not parse\n", b.name);
+            return 1;
+        }
+        const Times parse_times = summarize(times, runs);
+
+        char *out = NULL; // arr
+        for (int run = 0; run < runs; ++run) {
+            arr_reset(out);
+            const double start = now();
+            out = ast_sprint(out, tokens, &p.ast);
+            times[run] = now() - start;
+        }
+        const Times print_times = summarize(times, runs);
+
+        const double bytes = b.len, out_bytes = arr_count(out);
+        const double count = token_stream_count(tokens), nodes = p.ast.count;
+        if (json) {
+            printf("%s\n    {\"name\": \"%s\", \"bytes\": %d, \"tokens\": %.0f, \"nodes\": %.0f, "
+                    "\"output_bytes\": %.0f,\n", k ? "," : "", b.name, b.len, count, nodes, out_bytes);
+            printf("     \"scan\": {\"best_ms\": %.3f, \"median_ms\": %.3f, \"bytes_per_s\": %.0f, "
+                    "\"tokens_per_s\": %.0f},\n", scan_times.best * 1e3, scan_times.median * 1e3,
+                    bytes / scan_times.best, count / scan_times.best);
+            printf("     \"parse\": {\"best_ms\": %.3f, \"median_ms\": %.3f, \"tokens_per_s\": %.0f, "
+                    "\"nodes_per_s\": %.0f},\n", parse_times.best * 1e3, parse_times.median * 1e3,
+                    count / parse_times.best, nodes / parse_times.best);
+            printf("     \"print\": {\"best_ms\": %.3f, \"median_ms\": %.3f, \"nodes_per_s\": %.0f, "
+                    "\"bytes_per_s\": %.0f}}", print_times.best * 1e3, print_times.median * 1e3,
+                    nodes / print_times.best, out_bytes / print_times.best);
+        } else {
+            printf("%-9s %9.0f %9.0f | %8.2f %8.1f %9.1f | %8.2f %9.1f %9.1f | %8.2f %9.1f %8.1f\n",
+                    b.name, count, nodes,
+                    scan_times.best * 1e3, bytes / scan_times.best * 1e-6, count / scan_times.best * 1e-6,
+                    parse_times.best * 1e3, count / parse_times.best * 1e-6, nodes / parse_times.best * 1e-6,
+                    print_times.best * 1e3, nodes / print_times.best * 1e-6, out_bytes / print_times.best * 1e-6);
+        }
+        arr_free(out);
+        arr_free(b.head);
+    }
+    if (json) {
+        printf("\n  ]\n}\n");
+    }
+    free(times);
+    return 0;
+}
@@ -0,0 +1,98 @@
+//
+// Variable access: a loop that reads and assigns a handful of variables per
+// iteration, with the variables as locals (in a block) and as globals, on
+// each engine. Reports the best time of each and the variable accesses per
+// second.
+//
+// Usage: vars [iterations] [runs]
+//
+#define LOXY_TRACE 0
+
+#include "../scanner.c"
+#include "../parser.c"
+#include "../resolver.c"
+#include "../interp.c"
+#include "../compiler.c"
+#include "../vm.c"
+
+#include "bench.h"
+
+// 9 reads, 4 assignments and a declaration per iteration
+#define LOOP \
+    "var i = 0; var a = 1; var b = 2; var sum = 0;\n" \
+    "while (i < %d) {\n" \
+    "    var t = a + b;\n" \
+    "    a = b;\n" \
+    "    b = t * 0.5;\n" \
+    "    sum = sum + t - b;\n" \
+    "    i = i + 1;\n" \
+    "}\n"
+#define ACCESSES_PER_ITERATION 14
+
+static const char *variants[] = {
+    "locals",  "var result; {\n" LOOP "result = sum; }\nresult\n",
+    "globals", LOOP "sum\n",
+};
+
+int main(int argc, const char *argv[])
+{
+    const int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+    const int runs = argc > 2 ? atoi(argv[2]) : 5;
+    printf("%d iterations, %d runs, %d variable accesses per iteration\n",
+            iterations, runs, ACCESSES_PER_ITERATION);
+    printf("%-8s %-6s %10s %14s  %s\n", "vars", "engine", "ms", "Maccesses/s", "result");
+
+    for (int v = 0; v < 2; ++v) {
+        Buffer b = {.name = variants[2*v]};
+        b.len = snprintf(NULL, 0, variants[2*v + 1], iterations);
+        b.head = malloc(b.len + 1);
+        snprintf(b.head, b.len + 1, variants[2*v + 1], iterations);
+
+        Scanner s = {0};
+        Parser p = {.lines = &s.lines, .filename = b.name};
+        const TokenStream *tokens = scan(&s, &b);
+        Ast *ast = tokens && parse(&p, tokens) ? &p.ast : NULL;
+        Resolver r = {.tokens = tokens, .lines = &s.lines, .filename = b.name};
+        if (had_error || !ast || !resolve(&r, ast)) {
+            return 1;
+        }
+        Heap heap = {0};
+        for (int g = 0; g < arr_count(r.globals); ++g) {
+            arr_push(heap.globals, VALUE_UNDEFINED);
+        }
+
+        Compiler c = {.tokens = tokens, .lines = &s.lines, .filename = b.name};
+        Chunk chunk = {0};
+        if (!compile_ast(&c, ast, &chunk)) {
+            return 1;
+        }
+        Interpreter in = {.tokens = tokens, .lines = &s.lines, .filename = b.name, .heap = &heap};
+        VM vm = {.tokens = tokens, .lines = &s.lines, .filename = b.name, .heap = &heap};
+
+        Value results[2];
+        for (int engine = 0; engine < 2; ++engine) {
+            double best = 1e30;
+            for (int run = 0; run < runs; ++run) {
+                double start = now();
+                const bool ok = engine ? vm_run(&vm, &chunk, &results[engine])
+                                       : interpret(&in, ast, &results[engine]);
+                if (!ok) {
+                    return 1;
+                }
+                best = min(best, now() - start);
+            }
+            printf("%-8s %-6s %10.2f %14.1f  ", b.name, engine ? "vm" : "tree", best * 1e3,
+                    (double) iterations * ACCESSES_PER_ITERATION / best * 1e-6);
+            value_println(results[engine]);
+        }
+        if (results[0] != results[1]) {
+            printf("engines disagree\n");
+            return 1;
+        }
+        chunk_free(&chunk);
+        gc_free(&heap);
+        resolver_free(&r);
+        free(b.head);
+    }
+    return 0;
+}
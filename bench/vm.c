@@ -0,0 +1,73 @@
+//
+// Bytecode VM vs. tree-walking: evaluating one large expression-heavy script
+// (arithmetic, comparisons and short-circuiting logic) with each engine.
+// Reports the time to compile to bytecode, the chunk's size and the best
+// evaluation time of each engine.
+//
+// Usage: vm [terms] [runs]
+//
+#define LOXY_TRACE 0
+
+#include "../scanner.c"
+#include "../parser.c"
+#include "../interp.c"
+#include "../compiler.c"
+#include "../vm.c"
+
+#include "bench.h"
+
+int main(int argc, const char *argv[])
+{
+    const int terms = argc > 1 ? atoi(argv[1]) : 100000;
+    const int runs = argc > 2 ? atoi(argv[2]) : 20;
+
+    Buffer b = {.name = "generated"};
+    b.len = generate_expression(&b.head, terms, NULL, EXPRESSION_FORMS);
+
+    Scanner s = {0};
+    const TokenStream *tokens = scan(&s, &b);
+    Parser p = {0};
+    const Ast *ast = tokens ? parse(&p, tokens) : NULL;
+    if (!ast) {
+        return 1;
+    }
+    printf("input: %d bytes, %d nodes, %d runs, %s dispatch\n",
+            b.len, ast->count, runs, VM_COMPUTED_GOTO ? "computed goto" : "switch");
+
+    Compiler c = {.tokens = tokens, .lines = &s.lines, .filename = b.name};
+    Chunk chunk = {0};
+    double compile_time = 1e30;
+    for (int r = 0; r < runs; ++r) {
+        double start = now();
+        if (!compile_ast(&c, ast, &chunk)) {
+            return 1;
+        }
+        compile_time = min(compile_time, now() - start);
+    }
+    printf("bytecode: %d bytes, %d constants, %d position runs, compiled in %.2f ms\n",
+            arr_count(chunk.code), arr_count(chunk.constants), arr_count(chunk.runs), compile_time * 1e3);
+
+    Interpreter in = {.tokens = tokens, .lines = &s.lines, .filename = b.name};
+    VM vm = {.tokens = tokens, .lines = &s.lines, .filename = b.name};
+    printf("%-6s %10s %12s  %s\n", "engine", "ms", "Mnodes/s", "result");
+    Value results[2];
+    for (int engine = 0; engine < 2; ++engine) {
+        double best = 1e30;
+        for (int r = 0; r < runs; ++r) {
+            double start = now();
+            const bool ok = engine ? vm_run(&vm, &chunk, &results[engine]) : interpret(&in, ast, &results[engine]);
+            if (!ok) {
+                return 1;
+            }
+            best = min(best, now() - start);
+        }
+        char *text = value_sprint(NULL, results[engine]);
+        printf("%-6s %10.2f %12.1f  %.*s\n", engine ? "vm" : "tree",
+                best * 1e3, ast->count / best * 1e-6, arr_count(text), text);
+    }
+    if (results[0] != results[1]) {
+        printf("engines disagree\n");
+        return 1;
+    }
+    return 0;
+}
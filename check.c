@@ -0,0 +1,184 @@
+#define CHECK_C
+
+#ifndef COMMON_H
+#include "common.h"
+#endif
+#ifndef ERROR_C
+#include "error.c"
+#endif
+#ifndef PARSER_C
+#include "parser.c"
+#endif
+#ifndef POOL_C
+#include "pool.c"
+#endif
+#ifndef SCANNER_C
+#include "scanner.c"
+#endif
+
+#include <dirent.h> // opendir, readdir
+#include <time.h>   // clock_gettime
+
+//
+// Batch check mode: scan and parse many files in one process.
+//
+// Every file is a task on the thread pool, checked with a Scanner and Parser
+// of the thread it runs on. A file's diagnostics are written to a memory
+// stream of its own, so files checked at the same time do not interleave;
+// they are printed in the order the files were given once all of them have
+// been checked, followed by a summary.
+//
+typedef enum {
+    CHECK_OK,
+    CHECK_ERROR,      // scan or parse errors
+    CHECK_UNREADABLE, // could not be opened or read
+} CheckStatus;
+
+typedef struct {
+    char *path;
+    CheckStatus status;
+    char *diagnostics; // from open_memstream
+    size_t diagnostics_len;
+} CheckFile;
+
+typedef struct {
+    CheckFile *files; // arr
+    int num_errors;
+    int num_unreadable;
+    double seconds;   // wall time of the last `check_run`
+} Check;
+
+static void check_add_file(Check *restrict c, const char *restrict path)
+{
+    CheckFile f = {.path = strdup(path)};
+    arr_push(c->files, f);
+}
+
+static int check_compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+static bool check_is_lox(const char *name)
+{
+    const size_t len = strlen(name);
+    return len > 4 && strcmp(name + len - 4, ".lox") == 0;
+}
+
+// Add the `.lox` files under the directory `path`, recursively and sorted by name
+static void check_add_dir(Check *restrict c, const char *restrict path)
+{
+    DIR *dir = opendir(path);
+    if (!dir) {
+        check_add_file(c, path); // reported as unreadable
+        return;
+    }
+    char **names = NULL; // arr
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] != '.') {
+            arr_push(names, strdup(entry->d_name));
+        }
+    }
+    closedir(dir);
+    qsort(names, arr_count(names), sizeof(*names), check_compare_names);
+
+    char *child = NULL; // arr
+    for (int i = 0; i < arr_count(names); ++i) {
+        arr_reset(child);
+        arr_concat(child, path, (int) strlen(path));
+        arr_push(child, '/');
+        arr_concat(child, names[i], (int) strlen(names[i]) + 1);
+        struct stat st;
+        if (stat(child, &st) == 0 && S_ISDIR(st.st_mode)) {
+            check_add_dir(c, child);
+        } else if (check_is_lox(names[i])) {
+            check_add_file(c, child);
+        }
+        free(names[i]);
+    }
+    arr_free(child);
+    arr_free(names);
+}
+
+// Add a file, or the `.lox` files under a directory
+void check_add_path(Check *restrict c, const char *restrict path)
+{
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        check_add_dir(c, path);
+    } else {
+        check_add_file(c, path);
+    }
+}
+
+static void check_file(void *ctx, int i)
+{
+    static _Thread_local Scanner s;
+    static _Thread_local Parser p;
+    CheckFile *f = &((Check *) ctx)->files[i];
+
+    FILE *out = open_memstream(&f->diagnostics, &f->diagnostics_len);
+    log_file = out;
+    had_error = false;
+
+    Buffer b = {.name = f->path};
+    const int loaded = buffer_load_file(&b, f->path);
+    if (loaded != 1) {
+        fprintf(out, "Could not %s file \"%s\".\n", loaded == -1 ? "find" : "read", f->path);
+        f->status = CHECK_UNREADABLE;
+    } else {
+        p.lines = &s.lines, p.filename = b.name;
+        parse(&p, scan(&s, &b));
+        f->status = had_error ? CHECK_ERROR : CHECK_OK;
+        buffer_release(&b);
+    }
+
+    log_file = NULL;
+    fclose(out);
+}
+
+// Check every file added so far on `pool`
+void check_run(Check *restrict c, ThreadPool *restrict pool)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pool_run(pool, arr_count(c->files), check_file, c);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    c->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+    c->num_errors = c->num_unreadable = 0;
+    for (int i = 0; i < arr_count(c->files); ++i) {
+        c->num_errors += (c->files[i].status == CHECK_ERROR);
+        c->num_unreadable += (c->files[i].status == CHECK_UNREADABLE);
+    }
+}
+
+// Print every file's diagnostics, in order, and a summary
+void check_report(const Check *c)
+{
+    for (int i = 0; i < arr_count(c->files); ++i) {
+        const CheckFile *f = &c->files[i];
+        fwrite(f->diagnostics, sizeof(char), f->diagnostics_len, stderr);
+    }
+    const int count = arr_count(c->files);
+    fprintf(stderr, "Checked %d file%s in %.3fs: %d ok, %d with errors, %d unreadable.\n",
+            count, count == 1 ? "" : "s", c->seconds,
+            count - c->num_errors - c->num_unreadable, c->num_errors, c->num_unreadable);
+}
+
+// ERR_FILE if a file could not be read, else ERR_COMPILE if one had errors
+int check_exit_code(const Check *c)
+{
+    return c->num_unreadable ? ERR_FILE : c->num_errors ? ERR_COMPILE : 0;
+}
+
+void check_free(Check *c)
+{
+    for (int i = 0; i < arr_count(c->files); ++i) {
+        free(c->files[i].path);
+        free(c->files[i].diagnostics);
+    }
+    arr_free(c->files);
+    c->files = NULL;
+}
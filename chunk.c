@@ -0,0 +1,208 @@
+#define CHUNK_C
+
+#ifndef COMMON_H
+#include "common.h"
+#endif
+#ifndef VALUE_C
+#include "value.c"
+#endif
+
+// X(opcode, bytes of operands)
+#define OPCODES(X) \
+    X(OP_CONSTANT,       1) /* push constants[u8] */ \
+    X(OP_CONSTANT_LONG,  3) /* push constants[u24] */ \
+    X(OP_NIL,            0) \
+    X(OP_TRUE,           0) \
+    X(OP_FALSE,          0) \
+    X(OP_POP,            0) \
+    X(OP_NEGATE,         0) \
+    X(OP_UNARY_PLUS,     0) /* only checks that the operand is a number */ \
+    X(OP_NOT,            0) \
+    X(OP_ADD,            0) \
+    X(OP_SUBTRACT,       0) \
+    X(OP_MULTIPLY,       0) \
+    X(OP_DIVIDE,         0) \
+    X(OP_EQUAL,          0) \
+    X(OP_NOT_EQUAL,      0) \
+    X(OP_GREATER,        0) \
+    X(OP_GREATER_EQUAL,  0) \
+    X(OP_LESS,           0) \
+    X(OP_LESS_EQUAL,     0) \
+    X(OP_GET_LOCAL,      1) /* push slots[u8] */ \
+    X(OP_SET_LOCAL,      1) /* slots[u8] = the top; does not pop */ \
+    X(OP_GET_GLOBAL,     3) /* push globals[u24] */ \
+    X(OP_SET_GLOBAL,     3) /* globals[u24] = the top; does not pop */ \
+    X(OP_DEFINE_GLOBAL,  3) /* pop into globals[u24] */ \
+    X(OP_POPN,           1) /* pop u8 values */ \
+    X(OP_PRINT,          0) /* pop and print */ \
+    X(OP_RESULT,         0) /* pop the program's result */ \
+    X(OP_JUMP_IF_FALSE,  3) /* forward by u24 if the top is falsy; does not pop */ \
+    X(OP_JUMP_IF_TRUE,   3) /* forward by u24 if the top is truthy; does not pop */ \
+    X(OP_POP_JUMP_IF_FALSE, 3) /* pop, and forward by u24 if it was falsy */ \
+    X(OP_JUMP,           3) /* forward by u24 */ \
+    X(OP_LOOP,           3) /* back by u24 */ \
+    X(OP_CLASS,          3) /* push a new class named constants[u24] */ \
+    X(OP_CALL,           1) /* call the value below u8 arguments with them */ \
+    X(OP_TAIL_CALL,      1) /* the same, returning what it returns */ \
+    X(OP_FUNCTION,       3) /* push a new function, functions[u24] */ \
+    X(OP_GET_PROPERTY,   3) /* replace the instance on top with its property names[u24] */ \
+    X(OP_SET_PROPERTY,   3) /* set property names[u24] of the instance below the top; pops the instance */ \
+    X(OP_GET_METHOD,     3) /* replace the instance on top with its method names[u24] and push the
+                               instance, or with its field names[u24] and push nil */ \
+    X(OP_INVOKE,         1) /* call the value below a receiver (nil for none) and u8 arguments */ \
+    X(OP_METHOD,         0) /* pop a function into the methods of the class below it */ \
+    X(OP_RETURN,         0) /* pop the value to return; at the top level, end */
+
+#define OPCODE_ENUM(op, n) op,
+#define OPCODE_NAME(op, n) #op,
+#define OPCODE_OPERANDS(op, n) n,
+
+typedef enum {
+    OPCODES(OPCODE_ENUM)
+} OpCode;
+
+static const char *opcode_names[] = {
+    OPCODES(OPCODE_NAME)
+};
+
+static const uint8_t opcode_operands[] = {
+    OPCODES(OPCODE_OPERANDS)
+};
+
+//
+// Compiled bytecode: 1-byte opcodes with their operands inline, and a pool
+// of the constants they refer to.
+//
+// Source positions are kept run-length encoded, as the token each run of
+// code came from. Only instructions that can fail start a new run; the rest
+// (constants, jumps) extend the one before them. So an expression costs one
+// run per operator rather than a position per byte, and a runtime error can
+// still point at its operator.
+//
+// Each property access is a site with its name in `names`, which the VM
+// keeps an inline cache for. Each function declaration has its code in the
+// chunk, skipped over where it is declared, and what a function made from
+// it needs to know in `functions`.
+//
+typedef struct {
+    uint32_t end;   // offset in `code` one past the run
+    uint32_t token;
+} ChunkRun;
+
+typedef struct {
+    Intern name;
+    int arity;
+    int entry;          // offset in `code` of its body
+    int max_stack;      // deepest its frame gets
+} ChunkFunction;
+
+typedef struct {
+    uint8_t *code;      // arr
+    Value *constants;   // arr
+    ChunkRun *runs;     // arr, by `end`
+    Intern *names;      // arr; by property site
+    ChunkFunction *functions; // arr
+    int max_stack;      // deepest the value stack gets at the top level
+} Chunk;
+
+// How much of each part of a chunk there was, to go back to (see `chunk_rewind`)
+typedef struct {
+    int code;
+    int constants;
+    int names;
+    int functions;
+    int max_stack;
+} ChunkMark;
+
+#define CHUNK_TOKEN_ANY (-1) // an instruction that does not need a position
+#define CHUNK_U24_MAX ((1 << 24) - 1) // the most constants, globals and sites, and the longest jump
+
+void chunk_reset(Chunk *c)
+{
+    arr_reset(c->code);
+    arr_reset(c->constants);
+    arr_reset(c->runs);
+    arr_reset(c->names);
+    arr_reset(c->functions);
+    c->max_stack = 0;
+}
+
+void chunk_free(Chunk *c)
+{
+    arr_free(c->code);
+    arr_free(c->constants);
+    arr_free(c->runs);
+    arr_free(c->names);
+    arr_free(c->functions);
+    memset(c, 0, sizeof(*c));
+}
+
+ChunkMark chunk_mark(const Chunk *c)
+{
+    return (ChunkMark) {arr_count(c->code), arr_count(c->constants), arr_count(c->names),
+        arr_count(c->functions), c->max_stack};
+}
+
+// Drop what was added to `c` since `m`, e.g. a REPL line that did not compile
+void chunk_rewind(Chunk *c, const ChunkMark m)
+{
+    while (arr_count(c->code) > m.code) (void) arr_pop(c->code);
+    while (arr_count(c->runs) > 1 && c->runs[arr_count(c->runs)-2].end >= (uint32_t) m.code) {
+        (void) arr_pop(c->runs);
+    }
+    if (!arr_empty(c->runs) && arr_last(c->runs).end > (uint32_t) m.code) {
+        arr_last(c->runs).end = m.code;
+    }
+    if (!arr_empty(c->runs) && arr_last(c->runs).end == 0) {
+        (void) arr_pop(c->runs);
+    }
+    while (arr_count(c->constants) > m.constants) (void) arr_pop(c->constants);
+    while (arr_count(c->names) > m.names) (void) arr_pop(c->names);
+    while (arr_count(c->functions) > m.functions) (void) arr_pop(c->functions);
+    c->max_stack = m.max_stack;
+}
+
+// Append `byte`, from `token` (or CHUNK_TOKEN_ANY)
+void chunk_write(Chunk *c, const uint8_t byte, const int token)
+{
+    const int n = arr_count(c->runs);
+    arr_push(c->code, byte);
+    if (n && (token == CHUNK_TOKEN_ANY || c->runs[n-1].token == (uint32_t) token)) {
+        c->runs[n-1].end++;
+    } else {
+        arr_push(c->runs, ((ChunkRun) {arr_count(c->code), token == CHUNK_TOKEN_ANY ? 0 : token}));
+    }
+}
+
+// Returns the index of the new constant
+int chunk_add_constant(Chunk *c, const Value v)
+{
+    arr_push(c->constants, v);
+    return arr_count(c->constants) - 1;
+}
+
+// The token the instruction at `offset` came from
+int chunk_token(const Chunk *c, const int offset)
+{
+    int low = 0;
+    int high = arr_count(c->runs) - 1;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (c->runs[mid].end <= (uint32_t) offset) low = mid + 1;
+        else high = mid;
+    }
+    return c->runs[low].token;
+}
+
+void chunk_pp(const Chunk *c)
+{
+    printf("[Chunk %p] %d bytes, %d constants, %d runs, max stack %d\n", (void *) c,
+            arr_count(c->code), arr_count(c->constants), arr_count(c->runs), c->max_stack);
+    for (int i = 0; i < arr_count(c->code); i += 1 + opcode_operands[c->code[i]]) {
+        printf("  %04d %-20s", i, opcode_names[c->code[i]]);
+        for (int j = 1; j <= opcode_operands[c->code[i]]; ++j) {
+            printf(" %3d", c->code[i + j]);
+        }
+        printf("\n");
+    }
+}
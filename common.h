@@ -1,12 +1,21 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE // mmap, MAP_ANONYMOUS, getline
+#endif
+
 #include <stdbool.h>
 #include <stdarg.h> // va_*
 #include <stddef.h> // ptrdiff_t
+#include <stdint.h> // uint8_t, uint32_t
 #include <stdlib.h> // exit
 #include <stdio.h>  // printf, fprintf
 #include <string.h> // memcmp, memcpy, memcpy_s, strlen
+#include <fcntl.h>    // open
+#include <sys/mman.h> // mmap, munmap, madvise
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // close, sysconf
 
 #define min(a,b) ((a)<(b)?(a):(b))
 #define max(a,b) ((a)>(b)?(a):(b))
@@ -62,84 +71,207 @@ char *unescaped(const char *s)
 //
 // }
 
-// TODO store line index elsewhere
 typedef struct {
     const char *restrict name;
     char *head;    // beginning of buffer
-    char **lines;  // array of beginning-of-lines
     int len;       // length of null-terminated string
     int cap;       // capacity of allocated region
-    int num_lines; // do not modify directly
+    bool mapped;   // `head` is a read-only mapping (see buffer_map_file)
 } Buffer;
 
-// typedef struct {
-//     int num_lines;
-//     str lines[];
-// } LineIndex;
-
 void buffer_reset(Buffer *b)
 {
     b->len = 0;
-    b->num_lines = 1;
-    b->lines[0] = b->head;
 }
 
-void buffer_init(Buffer *b, int cap, int num_lines)
+void buffer_init(Buffer *b, int cap)
 {
     b->head = malloc(sizeof(char) * cap);
-    b->lines = malloc(sizeof(char *) * num_lines);
     b->cap = cap;
+    b->mapped = false;
     buffer_reset(b);
 }
 
-static int buffer_add_line(Buffer *restrict b, char *restrict line)
+void buffer_release(Buffer *b)
 {
-    // TODO ensure b->num_lines does not overflow?
-    // TODO update b->len (scan for newline or NUL?) ???
-    b->lines[b->num_lines++] = line;
-    return b->num_lines;
+    if (b->mapped) {
+        munmap(b->head, b->cap);
+    } else {
+        free(b->head);
+    }
+    b->head = NULL;
+    b->len = b->cap = 0;
 }
 
-static int buffer_find_line(Buffer *restrict b, const char *restrict c)
+//
+// Map the file at `path` read-only, without copying it.
+//
+// The scanner expects a NUL after the last char. Rather than writing one,
+// the file is mapped over a zero-filled anonymous reservation that is at
+// least one byte longer than the file: bytes past EOF in the file's last
+// page read as zero, and if the file ends on a page boundary the NUL comes
+// from the reservation's extra page.
+//
+// Returns -1 (and sets errno) if the file cannot be opened, 0 if it is not
+// a regular file (e.g. a pipe) and 1 on success.
+//
+int buffer_map_file(Buffer *restrict b, const char *restrict path)
 {
-    // TODO bounds check `c`
-    int mid;
-    int low = 0;
-    int high = b->num_lines - 1;
-    while (low <= high) {
-        mid = (low + high) / 2;
-        if (c < b->lines[mid]) high = mid - 1;
-        else if (c > b->lines[mid]) low = mid + 1;
-        else return mid;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size >= 0x7FFFFFFF) {
+        close(fd);
+        return 0;
+    }
+
+    const size_t len = st.st_size;
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t reserve = (len / page + 1) * page;
+    char *head = mmap(NULL, reserve, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (head == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    if (len > 0) {
+        if (mmap(head, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            munmap(head, reserve);
+            close(fd);
+            return -1;
+        }
+        madvise(head, len, MADV_SEQUENTIAL);
     }
-    return mid;
+    close(fd);
+
+    b->head = head;
+    b->len = (int) len;
+    b->cap = (int) reserve;
+    b->mapped = true;
+    return 1;
 }
 
-static str buffer_get_line(Buffer *b, int line_index)
+// Read all of `file` (e.g. a pipe) into a buffer that grows to fit it
+bool buffer_read_file(Buffer *restrict b, FILE *restrict file)
 {
-    // TODO bounds check
-    char *line = b->lines[line_index];
-    // does not include tailing \n or \0
-    char *end = strchr(line, '\n');
-    return str_new_s(line, end - line);
+    size_t cap = 65536;
+    size_t len = 0;
+    size_t n;
+    char *head = malloc(cap);
+    while ((n = fread(head + len, sizeof(char), cap - len - 1, file)) > 0) {
+        len += n;
+        if (len + 1 == cap) {
+            head = realloc(head, cap *= 2);
+        }
+    }
+    head[len] = '\0';
+    if (ferror(file) || len >= 0x7FFFFFFF) {
+        free(head);
+        return false;
+    }
+
+    b->head = head;
+    b->len = (int) len;
+    b->cap = (int) cap;
+    b->mapped = false;
+    return true;
 }
 
-static str buffer_last_line(Buffer *b)
+// Map the file at `path`, or read it all if it is not a regular file (e.g. a
+// pipe or /dev/stdin). Returns -1 if it cannot be opened, 0 if it cannot be
+// read and 1 on success.
+int buffer_load_file(Buffer *restrict b, const char *restrict path)
 {
-    return buffer_get_line(b, b->num_lines-1);
+    const int mapped = buffer_map_file(b, path);
+    if (mapped != 0) {
+        return mapped;
+    }
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return 0;
+    }
+    const bool ok = buffer_read_file(b, file);
+    fclose(file);
+    return ok;
 }
 
-// static str buffer_last_line_str(Buffer *b)
-// {
-//     return b->lines[b->num_lines-1];
-// }
+//
+// Offsets of the beginnings of lines in a Buffer.
+//
+// Nothing is recorded while scanning. The first lookup past the indexed
+// prefix sweeps forward with memchr just far enough to answer it, and the
+// offsets found are kept for later lookups until the index is reset.
+//
+typedef struct {
+    const Buffer *buffer;
+    int *starts;  // arr of beginning-of-line offsets; starts[0] is 0
+    int indexed;  // every newline before this offset has been recorded
+} LineIndex;
+
+void line_index_reset(LineIndex *restrict li, const Buffer *restrict b)
+{
+    li->buffer = b;
+    arr_reset(li->starts);
+    arr_push(li->starts, 0);
+    li->indexed = 0;
+}
+
+// Forget the lines after the one containing `offset`: the text from there on
+// changed (is a different REPL line)
+void line_index_truncate(LineIndex *li, const int offset)
+{
+    while (arr_count(li->starts) > 1 && arr_last(li->starts) > offset) (void) arr_pop(li->starts);
+    li->indexed = min(li->indexed, offset);
+}
 
-size_t fsize(FILE *stream)
+// Record line starts until the line containing `offset` is complete
+static void line_index_extend(LineIndex *li, const int offset)
 {
-    fseek(stream, 0L, SEEK_END);
-    long size = ftell(stream);
-    rewind(stream);
-    return size;
+    const char *head = li->buffer->head;
+    const char *end = head + li->buffer->len;
+    const char *c = head + li->indexed;
+    const char *nl;
+    while (c < end) {
+        if (!(nl = memchr(c, '\n', end - c))) {
+            c = end;
+            break;
+        }
+        c = nl + 1;
+        arr_push(li->starts, (int) (c - head));
+        if (c - head > offset) break;
+    }
+    li->indexed = c - head;
+}
+
+// Returns the (0-based) line containing `offset`, or -1 if it is out of bounds
+int line_index_find(LineIndex *li, const int offset)
+{
+    if (offset < 0 || offset > li->buffer->len) {
+        return -1;
+    }
+    if (offset >= li->indexed) {
+        line_index_extend(li, offset);
+    }
+    int low = 0;
+    int high = arr_count(li->starts) - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (li->starts[mid] <= offset) low = mid;
+        else high = mid - 1;
+    }
+    return low;
+}
+
+// Only valid for lines returned by `line_index_find`
+str line_index_get_line(const LineIndex *li, const int line_index)
+{
+    // does not include tailing \n or \0
+    const int from = li->starts[line_index];
+    const int to = (line_index + 1 < arr_count(li->starts))
+        ? li->starts[line_index + 1] - 1
+        : li->buffer->len;
+    return str_new_s(li->buffer->head + from, to - from);
 }
 
 #endif
@@ -0,0 +1,368 @@
+#define COMPILER_C
+
+#ifndef CHUNK_C
+#include "chunk.c"
+#endif
+#ifndef COMMON_H
+#include "common.h"
+#endif
+#ifndef ERROR_C
+#include "error.c"
+#endif
+#ifndef EXPR_C
+#include "expr.c"
+#endif
+#ifndef TOKEN_C
+#include "token.c"
+#endif
+#ifndef VALUE_C
+#include "value.c"
+#endif
+
+//
+// Compiler from the flat AST to bytecode.
+//
+// Post-order is already stack-machine order, so most nodes become one
+// instruction in one linear pass. `and` and `or` short-circuit: right after
+// the last node of the lhs comes a conditional jump over the rhs, which is
+// patched when the operator's node is reached. A loop's test jumps past the
+// loop in the same way, and its end jumps back to the code of its condition.
+// These nest, so their pending jumps are a stack.
+//
+// Variables are resolved to slots (see resolver.c): locals are the value
+// stack from the bottom of the running frame, globals the heap's `globals`.
+// Property sites keep their numbers from the Ast.
+//
+// A function's body is compiled where it is declared, behind a jump over it,
+// and ends with an implicit `return nil`. Its frame's depth is counted on its
+// own, from the function itself in slot 0, so the VM knows how much stack a
+// call needs.
+//
+typedef struct {
+    int function;  // in the chunk's `functions`
+    int depth;     // of the code around the declaration
+    int max_depth;
+} CompilerFunction;
+
+typedef struct {
+    const TokenStream *tokens;
+    LineIndex *lines;     // for the locations of errors
+    const char *filename;
+    int start;            // the node to start from; the REPL's lines before it are in the chunk
+    int *logical_lhs;     // arr; for each node, the logical node it is the lhs of, or -1
+    int *jumps;           // arr of the offsets of unpatched jumps
+    int *offsets;         // arr; for each node, where its code starts
+    CompilerFunction *functions; // arr; the declarations being compiled, innermost last
+} Compiler;
+
+static bool compiler_error(const Compiler *restrict c, const int token, const char *restrict message)
+{
+    error(token_stream_loc(c->tokens, c->lines, c->filename, token), message);
+    return false;
+}
+
+// Constants cannot fail, so they take no position of their own (`token` is
+// only for reporting a full pool)
+static bool emit_constant(const Compiler *restrict c, Chunk *restrict chunk, const Value v, const int token)
+{
+    const int k = chunk_add_constant(chunk, v);
+    if (k > CHUNK_U24_MAX) {
+        return compiler_error(c, token, "Too many constants in one chunk.");
+    }
+    if (k <= UINT8_MAX) {
+        chunk_write(chunk, OP_CONSTANT, CHUNK_TOKEN_ANY);
+        chunk_write(chunk, k, CHUNK_TOKEN_ANY);
+    } else {
+        chunk_write(chunk, OP_CONSTANT_LONG, CHUNK_TOKEN_ANY);
+        chunk_write(chunk, k & 0xff, CHUNK_TOKEN_ANY);
+        chunk_write(chunk, (k >> 8) & 0xff, CHUNK_TOKEN_ANY);
+        chunk_write(chunk, (k >> 16) & 0xff, CHUNK_TOKEN_ANY);
+    }
+    return true;
+}
+
+static void emit_u24(Chunk *chunk, const uint32_t v)
+{
+    chunk_write(chunk, v & 0xff, CHUNK_TOKEN_ANY);
+    chunk_write(chunk, (v >> 8) & 0xff, CHUNK_TOKEN_ANY);
+    chunk_write(chunk, v >> 16, CHUNK_TOKEN_ANY);
+}
+
+// Emits a forward jump to be patched by `patch_jump`
+static void emit_jump(Compiler *restrict c, Chunk *restrict chunk, const OpCode op)
+{
+    arr_push(c->jumps, arr_count(chunk->code));
+    chunk_write(chunk, op, CHUNK_TOKEN_ANY);
+    emit_u24(chunk, 0);
+}
+
+// Points the innermost unpatched jump here
+static bool patch_jump(Compiler *restrict c, Chunk *restrict chunk, const int token)
+{
+    const int jump = arr_pop(c->jumps);
+    const int distance = arr_count(chunk->code) - (jump + 4);
+    if (distance > CHUNK_U24_MAX) {
+        return compiler_error(c, token, "Too much code to jump over.");
+    }
+    chunk->code[jump + 1] = distance & 0xff;
+    chunk->code[jump + 2] = (distance >> 8) & 0xff;
+    chunk->code[jump + 3] = distance >> 16;
+    return true;
+}
+
+static OpCode binary_opcode(const TokenType op)
+{
+    switch (op) {
+        case TOKEN_PLUS:          return OP_ADD;
+        case TOKEN_MINUS:         return OP_SUBTRACT;
+        case TOKEN_STAR:          return OP_MULTIPLY;
+        case TOKEN_SLASH:         return OP_DIVIDE;
+        case TOKEN_EQUAL_EQUAL:   return OP_EQUAL;
+        case TOKEN_BANG_EQUAL:    return OP_NOT_EQUAL;
+        case TOKEN_GREATER:       return OP_GREATER;
+        case TOKEN_GREATER_EQUAL: return OP_GREATER_EQUAL;
+        case TOKEN_LESS:          return OP_LESS;
+        default:                  return OP_LESS_EQUAL;
+    }
+}
+
+static bool compile_nodes(Compiler *restrict c, const Ast *restrict ast, Chunk *restrict chunk)
+{
+    const int n = ast->count;
+    const uint8_t *token_types = c->tokens->types;
+    arr_reset(c->jumps);
+    arr_reset(c->functions);
+    // The nodes before `start` keep their `logical_lhs` and offsets
+    const int from = min(min(arr_count(c->logical_lhs), arr_count(c->offsets)), c->start);
+    while (arr_count(c->logical_lhs) > from) (void) arr_pop(c->logical_lhs);
+    memset(arr_add(c->logical_lhs, n - from), -1, (n - from) * sizeof(int));
+    int *logical_lhs = c->logical_lhs;
+    for (int i = from; i < n; ++i) {
+        if (ast->types[i] == EXPR_LOGICAL) {
+            logical_lhs[ast->args[i]] = i;
+        }
+    }
+
+    while (arr_count(c->offsets) > from) (void) arr_pop(c->offsets);
+    (void) arr_add(c->offsets, n - from);
+    int *offsets = c->offsets;
+    if (arr_count(ast->names) > CHUNK_U24_MAX + 1) {
+        return compiler_error(c, ast->tokens[n-1], "Too many property accesses in one chunk.");
+    }
+    const int sites = arr_count(chunk->names);
+    if (arr_count(ast->names) > sites) { // `names` is NULL in a program without property sites
+        arr_concat(chunk->names, ast->names + sites, arr_count(ast->names) - sites);
+    }
+
+    int depth = 0;
+    int max_depth = 0;
+    for (int i = from; i < n; ++i) {
+        const int token = ast->tokens[i];
+        const uint32_t arg = ast->args[i];
+        offsets[i] = arr_count(chunk->code);
+        switch ((ExprType) ast->types[i]) {
+            case EXPR_NIL:
+                chunk_write(chunk, OP_NIL, CHUNK_TOKEN_ANY);
+                depth++;
+                break;
+            case EXPR_BOOL:
+                chunk_write(chunk, arg ? OP_TRUE : OP_FALSE, CHUNK_TOKEN_ANY);
+                depth++;
+                break;
+            case EXPR_NUMBER:
+                if (!emit_constant(c, chunk, value_number(ast->numbers[arg]), token)) return false;
+                depth++;
+                break;
+            case EXPR_STRING:
+                if (!emit_constant(c, chunk, value_string(arg), token)) return false;
+                depth++;
+                break;
+            case EXPR_GROUPING:
+                break;
+
+            case EXPR_UNARY: {
+                const TokenType op = token_types[token];
+                chunk_write(chunk, op == TOKEN_BANG ? OP_NOT : op == TOKEN_MINUS ? OP_NEGATE : OP_UNARY_PLUS,
+                        op == TOKEN_BANG ? CHUNK_TOKEN_ANY : token);
+                break;
+            }
+
+            case EXPR_BINARY: {
+                const OpCode op = binary_opcode(token_types[token]);
+                chunk_write(chunk, op, op == OP_EQUAL || op == OP_NOT_EQUAL ? CHUNK_TOKEN_ANY : token);
+                depth--;
+                break;
+            }
+
+            case EXPR_LOGICAL:
+                if (!patch_jump(c, chunk, token)) return false;
+                break;
+
+            case EXPR_GET_LOCAL:
+            case EXPR_SET_LOCAL:
+                chunk_write(chunk, ast->types[i] == EXPR_GET_LOCAL ? OP_GET_LOCAL : OP_SET_LOCAL, CHUNK_TOKEN_ANY);
+                chunk_write(chunk, arg, CHUNK_TOKEN_ANY);
+                depth += ast->types[i] == EXPR_GET_LOCAL;
+                break;
+            case EXPR_GET_GLOBAL:
+            case EXPR_SET_GLOBAL: // fail when the global is not defined
+                chunk_write(chunk, ast->types[i] == EXPR_GET_GLOBAL ? OP_GET_GLOBAL : OP_SET_GLOBAL, token);
+                emit_u24(chunk, arg);
+                depth += ast->types[i] == EXPR_GET_GLOBAL;
+                break;
+
+            case EXPR_CLASS: {
+                const int k = chunk_add_constant(chunk, value_string(arg));
+                if (k > CHUNK_U24_MAX) {
+                    return compiler_error(c, token, "Too many constants in one chunk.");
+                }
+                chunk_write(chunk, OP_CLASS, CHUNK_TOKEN_ANY);
+                emit_u24(chunk, k);
+                depth++;
+                break;
+            }
+            case EXPR_CALL:
+            case EXPR_TAIL_CALL:
+                chunk_write(chunk, ast->types[i] == EXPR_CALL ? OP_CALL : OP_TAIL_CALL, token);
+                chunk_write(chunk, arg, CHUNK_TOKEN_ANY);
+                depth -= arg;
+                break;
+            case EXPR_GET_PROPERTY:
+            case EXPR_SET_PROPERTY:
+                chunk_write(chunk, ast->types[i] == EXPR_GET_PROPERTY ? OP_GET_PROPERTY : OP_SET_PROPERTY, token);
+                emit_u24(chunk, arg);
+                depth -= ast->types[i] == EXPR_SET_PROPERTY;
+                break;
+            case EXPR_GET_METHOD:
+                chunk_write(chunk, OP_GET_METHOD, token);
+                emit_u24(chunk, arg);
+                depth++;
+                break;
+            case EXPR_INVOKE:
+                chunk_write(chunk, OP_INVOKE, token);
+                chunk_write(chunk, arg, CHUNK_TOKEN_ANY);
+                depth -= arg + 1;
+                break;
+
+            case STMT_DEFINE_LOCAL: // the value is in its slot
+                break;
+            case STMT_DEFINE_GLOBAL:
+                chunk_write(chunk, OP_DEFINE_GLOBAL, CHUNK_TOKEN_ANY);
+                emit_u24(chunk, arg);
+                depth--;
+                break;
+            case STMT_EXPRESSION:
+            case STMT_PRINT:
+            case STMT_RESULT: {
+                const ExprType type = ast->types[i];
+                chunk_write(chunk, type == STMT_EXPRESSION ? OP_POP : type == STMT_PRINT ? OP_PRINT : OP_RESULT,
+                        CHUNK_TOKEN_ANY);
+                depth--;
+                break;
+            }
+            case STMT_BLOCK_BEGIN:
+                break;
+            case STMT_BLOCK_END:
+                for (int left = arg; left > 0; left -= UINT8_MAX) {
+                    chunk_write(chunk, OP_POPN, CHUNK_TOKEN_ANY);
+                    chunk_write(chunk, min(left, UINT8_MAX), CHUNK_TOKEN_ANY);
+                }
+                depth -= arg;
+                break;
+
+            case STMT_WHILE_TEST:
+                emit_jump(c, chunk, OP_POP_JUMP_IF_FALSE);
+                depth--;
+                break;
+            case STMT_WHILE: {
+                const int distance = arr_count(chunk->code) + 4 - offsets[arg];
+                if (distance > CHUNK_U24_MAX) {
+                    return compiler_error(c, token, "Loop body too large.");
+                }
+                chunk_write(chunk, OP_LOOP, CHUNK_TOKEN_ANY);
+                emit_u24(chunk, distance);
+                if (!patch_jump(c, chunk, token)) return false;
+                break;
+            }
+
+            case STMT_FUNCTION: {
+                if (arr_count(chunk->functions) > CHUNK_U24_MAX) {
+                    return compiler_error(c, token, "Too many functions in one chunk.");
+                }
+                const str name = token_stream_lexeme(c->tokens, token);
+                const ChunkFunction fn = {intern_str(name), ast->args[arg], arr_count(chunk->code) + 4, 0};
+                arr_push(c->functions, ((CompilerFunction) {arr_count(chunk->functions), depth, max_depth}));
+                arr_push(chunk->functions, fn);
+                emit_jump(c, chunk, OP_JUMP); // over the body
+                depth = max_depth = 1; // the function, in slot 0
+                break;
+            }
+            case STMT_PARAM: // the argument is in its slot
+                depth++;
+                break;
+            case STMT_METHOD:
+                chunk_write(chunk, OP_METHOD, CHUNK_TOKEN_ANY);
+                depth--;
+                break;
+            case STMT_RETURN:
+                chunk_write(chunk, OP_RETURN, CHUNK_TOKEN_ANY);
+                depth--;
+                break;
+            case EXPR_FUNCTION: { // the end of the body
+                chunk_write(chunk, OP_NIL, CHUNK_TOKEN_ANY);
+                chunk_write(chunk, OP_RETURN, CHUNK_TOKEN_ANY);
+                const CompilerFunction fn = arr_pop(c->functions);
+                chunk->functions[fn.function].max_stack = max(max_depth, depth + 1);
+                depth = fn.depth;
+                max_depth = fn.max_depth;
+                if (!patch_jump(c, chunk, token)) return false;
+                chunk_write(chunk, OP_FUNCTION, CHUNK_TOKEN_ANY);
+                emit_u24(chunk, fn.function);
+                depth++;
+                break;
+            }
+
+            case EXPR_NONE:
+                return compiler_error(c, token, "Expect expression.");
+            default: // unresolved names
+                break;
+        }
+        max_depth = max(max_depth, depth);
+
+        if (logical_lhs[i] != -1) {
+            // Keep the lhs if it decides the result, else pop it and run the rhs
+            const bool and = token_types[ast->tokens[logical_lhs[i]]] == TOKEN_AND;
+            emit_jump(c, chunk, and ? OP_JUMP_IF_FALSE : OP_JUMP_IF_TRUE);
+            chunk_write(chunk, OP_POP, CHUNK_TOKEN_ANY);
+            depth--;
+        }
+    }
+    chunk_write(chunk, OP_RETURN, CHUNK_TOKEN_ANY);
+    chunk->max_stack = max(chunk->max_stack, max_depth);
+    return true;
+}
+
+//
+// Compiles `ast` into `chunk`; returns false (after reporting it) on an error.
+//
+// From a `start` node, the code of the nodes before it is already in `chunk`
+// (the REPL's lines before the new one, which its functions may call), and
+// the new code replaces its final OP_RETURN. After an error the chunk is
+// left as it was.
+//
+bool compile_ast(Compiler *restrict c, const Ast *restrict ast, Chunk *restrict chunk)
+{
+    if (!c->start) {
+        chunk_reset(chunk);
+        return compile_nodes(c, ast, chunk);
+    }
+    ChunkMark mark = chunk_mark(chunk);
+    mark.code--; // its OP_RETURN
+    chunk_rewind(chunk, mark);
+    if (compile_nodes(c, ast, chunk)) {
+        return true;
+    }
+    chunk_rewind(chunk, mark);
+    chunk_write(chunk, OP_RETURN, CHUNK_TOKEN_ANY);
+    return false;
+}
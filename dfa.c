@@ -0,0 +1,253 @@
+#define DFA_C
+
+#ifndef COMMON_H
+#include "common.h"
+#endif
+#ifndef SIMD_C
+#include "simd.c"
+#endif
+#ifndef TOKEN_C
+#include "token.c"
+#endif
+
+//
+// Tables for the scanner's DFA.
+//
+// Every byte is first mapped to a character class; the DFA then moves from
+// state to state with one lookup per byte until it reaches a final state.
+// A final state says which token was recognized and whether the last byte
+// read belongs to it (it is pushed back when it does not, e.g. the `;` that
+// ends an identifier).
+//
+// States that loop on a whole class of bytes (an identifier's tail, digits,
+// the body of a string or comment) skip the run with a scan kernel from
+// simd.c instead, and the DFA takes over again at the byte that ends it.
+//
+// The scanner relies on the input ending with a NUL (every Buffer does) or,
+// for chunks of a larger buffer, with a newline: no token other than a
+// string continues past either of them.
+//
+// The character classes and the tokens recognized by their first char are
+// generated from the X-macro lists below, so adding a single-char or
+// operator token only means adding it to a list. The transition rows are
+// written out by hand, one per state: a new kind of token (a new state)
+// needs a row, and a new character class a column.
+//
+
+// X(char, token type): single-char tokens
+#define SINGLE_CHAR_TOKENS(X) \
+    X('(', TOKEN_LEFT_PAREN)  \
+    X(')', TOKEN_RIGHT_PAREN) \
+    X('{', TOKEN_LEFT_BRACE)  \
+    X('}', TOKEN_RIGHT_BRACE) \
+    X(';', TOKEN_SEMICOLON)   \
+    X(',', TOKEN_COMMA)       \
+    X('-', TOKEN_MINUS)       \
+    X('+', TOKEN_PLUS)        \
+    X('*', TOKEN_STAR)
+
+// X(char, token type): tokens that may be followed by `=`, which makes them
+// the next token type (e.g. `!` and `!=`)
+#define OPERATOR_TOKENS(X) \
+    X('!', TOKEN_BANG)     \
+    X('=', TOKEN_EQUAL)    \
+    X('<', TOKEN_LESS)     \
+    X('>', TOKEN_GREATER)
+
+#define OPERATOR_EQUAL_ASSERT(c, t) \
+    _Static_assert(t + 1 == t##_EQUAL, #t "_EQUAL must follow " #t);
+OPERATOR_TOKENS(OPERATOR_EQUAL_ASSERT)
+
+typedef enum {
+    CC_OTHER,    // not valid outside strings and comments
+    CC_NUL,      // end of input, or a NUL byte in it
+    CC_SPACE,    // ' ', '\t', '\r'
+    CC_NEWLINE,
+    CC_ALPHA,    // [A-Za-z_]
+    CC_DIGIT,
+    CC_DOT,
+    CC_QUOTE,
+    CC_SLASH,
+    CC_EQUAL,
+    CC_OPERATOR, // OPERATOR_TOKENS other than `=`
+    CC_SINGLE,   // SINGLE_CHAR_TOKENS
+    CC_COUNT
+} CharClass;
+
+#define SINGLE_CHAR_CLASS(c, t) [c] = CC_SINGLE,
+
+static const uint8_t char_class[256] = {
+    ['\0'] = CC_NUL,
+    [' ']  = CC_SPACE, ['\t'] = CC_SPACE, ['\r'] = CC_SPACE,
+    ['\n'] = CC_NEWLINE,
+    ['A'] = CC_ALPHA, ['B'] = CC_ALPHA, ['C'] = CC_ALPHA, ['D'] = CC_ALPHA, ['E'] = CC_ALPHA,
+    ['F'] = CC_ALPHA, ['G'] = CC_ALPHA, ['H'] = CC_ALPHA, ['I'] = CC_ALPHA, ['J'] = CC_ALPHA,
+    ['K'] = CC_ALPHA, ['L'] = CC_ALPHA, ['M'] = CC_ALPHA, ['N'] = CC_ALPHA, ['O'] = CC_ALPHA,
+    ['P'] = CC_ALPHA, ['Q'] = CC_ALPHA, ['R'] = CC_ALPHA, ['S'] = CC_ALPHA, ['T'] = CC_ALPHA,
+    ['U'] = CC_ALPHA, ['V'] = CC_ALPHA, ['W'] = CC_ALPHA, ['X'] = CC_ALPHA, ['Y'] = CC_ALPHA,
+    ['Z'] = CC_ALPHA,
+    ['a'] = CC_ALPHA, ['b'] = CC_ALPHA, ['c'] = CC_ALPHA, ['d'] = CC_ALPHA, ['e'] = CC_ALPHA,
+    ['f'] = CC_ALPHA, ['g'] = CC_ALPHA, ['h'] = CC_ALPHA, ['i'] = CC_ALPHA, ['j'] = CC_ALPHA,
+    ['k'] = CC_ALPHA, ['l'] = CC_ALPHA, ['m'] = CC_ALPHA, ['n'] = CC_ALPHA, ['o'] = CC_ALPHA,
+    ['p'] = CC_ALPHA, ['q'] = CC_ALPHA, ['r'] = CC_ALPHA, ['s'] = CC_ALPHA, ['t'] = CC_ALPHA,
+    ['u'] = CC_ALPHA, ['v'] = CC_ALPHA, ['w'] = CC_ALPHA, ['x'] = CC_ALPHA, ['y'] = CC_ALPHA,
+    ['z'] = CC_ALPHA,
+    ['_'] = CC_ALPHA,
+    ['0'] = CC_DIGIT, ['1'] = CC_DIGIT, ['2'] = CC_DIGIT, ['3'] = CC_DIGIT, ['4'] = CC_DIGIT,
+    ['5'] = CC_DIGIT, ['6'] = CC_DIGIT, ['7'] = CC_DIGIT, ['8'] = CC_DIGIT, ['9'] = CC_DIGIT,
+    ['.'] = CC_DOT,
+    ['"'] = CC_QUOTE,
+    ['/'] = CC_SLASH,
+    SINGLE_CHAR_TOKENS(SINGLE_CHAR_CLASS)
+    ['!'] = CC_OPERATOR, ['<'] = CC_OPERATOR, ['>'] = CC_OPERATOR,
+    ['='] = CC_EQUAL,
+};
+
+// The token type of a token that is recognized by its first char
+#define CHAR_TOKEN(c, t) [c] = t,
+
+static const uint8_t char_token[256] = {
+    SINGLE_CHAR_TOKENS(CHAR_TOKEN)
+    OPERATOR_TOKENS(CHAR_TOKEN)
+    ['.'] = TOKEN_DOT,
+    ['/'] = TOKEN_SLASH,
+};
+
+bool is_alpha(const char c)
+{
+    return char_class[(unsigned char) c] == CC_ALPHA;
+}
+
+bool is_digit(const char c)
+{
+    return char_class[(unsigned char) c] == CC_DIGIT;
+}
+
+bool is_alphanumeric(const char c)
+{
+    return is_alpha(c) || is_digit(c);
+}
+
+bool is_space(const char c)
+{
+    return (unsigned) (char_class[(unsigned char) c] - CC_SPACE) <= CC_NEWLINE - CC_SPACE;
+}
+
+typedef enum {
+    // Runs, skipped by a scan kernel (see `dfa_run`)
+    S_IDENTIFIER,
+    S_NUMBER,
+    S_FRACTION,
+    S_STRING,
+    S_COMMENT,
+
+    S_START,
+    S_NUMBER_DOT,      // digits and a `.`; only a digit continues the number
+    S_SLASH,
+    S_OPERATOR,        // one of OPERATOR_TOKENS; may be followed by `=`
+
+    // Final states
+    F_SINGLE,          // char_token[first char]
+    F_OPERATOR,        // char_token[first char]; push back 1
+    F_OPERATOR_EQUAL,  // char_token[first char] + 1
+    F_IDENTIFIER,      // push back 1
+    F_NUMBER,          // push back 1
+    F_NUMBER_DOT,      // push back 2: the `.` is a token of its own
+    F_STRING,
+    F_STRING_CHECK,    // the input ended inside a string
+    F_SLASH,           // push back 1
+    F_COMMENT,         // push back 1
+    F_COMMENT_CHECK,   // the input ended inside a comment
+    F_NUL,
+    F_ERROR,           // unexpected character
+    S_COUNT
+} DfaState;
+
+#define DFA_FINAL F_SINGLE
+
+// Rows are padded to a power of two so that finding the next state is a
+// shift and an add away from the current one
+#define DFA_ROW_LEN 16
+
+_Static_assert(CC_COUNT <= DFA_ROW_LEN, "CharClass does not fit in a DFA row");
+
+// The transition table: next state = dfa[state][char class]
+static const uint8_t dfa[DFA_FINAL][DFA_ROW_LEN] = {
+    //                 OTHER            NUL              SPACE           NEWLINE          ALPHA         DIGIT         DOT           QUOTE         SLASH         EQUAL             OPERATOR      SINGLE
+    [S_START]      = { F_ERROR,         F_NUL,           F_ERROR,        F_ERROR,         S_IDENTIFIER, S_NUMBER,     F_SINGLE,     S_STRING,     S_SLASH,      S_OPERATOR,       S_OPERATOR,   F_SINGLE     },
+    [S_IDENTIFIER] = { F_IDENTIFIER,    F_IDENTIFIER,    F_IDENTIFIER,   F_IDENTIFIER,    S_IDENTIFIER, S_IDENTIFIER, F_IDENTIFIER, F_IDENTIFIER, F_IDENTIFIER, F_IDENTIFIER,     F_IDENTIFIER, F_IDENTIFIER },
+    [S_NUMBER]     = { F_NUMBER,        F_NUMBER,        F_NUMBER,       F_NUMBER,        F_NUMBER,     S_NUMBER,     S_NUMBER_DOT, F_NUMBER,     F_NUMBER,     F_NUMBER,         F_NUMBER,     F_NUMBER     },
+    [S_NUMBER_DOT] = { F_NUMBER_DOT,    F_NUMBER_DOT,    F_NUMBER_DOT,   F_NUMBER_DOT,    F_NUMBER_DOT, S_FRACTION,   F_NUMBER_DOT, F_NUMBER_DOT, F_NUMBER_DOT, F_NUMBER_DOT,     F_NUMBER_DOT, F_NUMBER_DOT },
+    [S_FRACTION]   = { F_NUMBER,        F_NUMBER,        F_NUMBER,       F_NUMBER,        F_NUMBER,     S_FRACTION,   F_NUMBER,     F_NUMBER,     F_NUMBER,     F_NUMBER,         F_NUMBER,     F_NUMBER     },
+    [S_STRING]     = { S_STRING,        F_STRING_CHECK,  S_STRING,       F_STRING_CHECK,  S_STRING,     S_STRING,     S_STRING,     F_STRING,     S_STRING,     S_STRING,         S_STRING,     S_STRING     },
+    [S_SLASH]      = { F_SLASH,         F_SLASH,         F_SLASH,        F_SLASH,         F_SLASH,      F_SLASH,      F_SLASH,      F_SLASH,      S_COMMENT,    F_SLASH,          F_SLASH,      F_SLASH      },
+    [S_COMMENT]    = { S_COMMENT,       F_COMMENT_CHECK, S_COMMENT,      F_COMMENT,       S_COMMENT,    S_COMMENT,    S_COMMENT,    S_COMMENT,    S_COMMENT,    S_COMMENT,        S_COMMENT,    S_COMMENT    },
+    [S_OPERATOR]   = { F_OPERATOR,      F_OPERATOR,      F_OPERATOR,     F_OPERATOR,      F_OPERATOR,   F_OPERATOR,   F_OPERATOR,   F_OPERATOR,   F_OPERATOR,   F_OPERATOR_EQUAL, F_OPERATOR,   F_OPERATOR   },
+};
+
+_Static_assert(S_COUNT <= UINT8_MAX, "DfaState does not fit in the transition table");
+
+//
+// Runs the DFA from `*state` on the bytes from `p` until it reaches a final
+// state, which it leaves in `*state` (and the state it was in before that in
+// `*last`), and returns the byte after the last one it read. That is past
+// `end` when the token ran into the end of the input, the NUL (or, for a
+// string, `end` itself): given more input, the DFA would go on from `*last`
+// at `end`.
+//
+static inline const char *dfa_run(const ScanKernels *restrict k, DfaState *restrict state,
+        DfaState *restrict last, const char *p, const char *end)
+{
+    DfaState s = *state;
+    do {
+        switch (s) {
+            case S_IDENTIFIER: p = k->skip_alphanumeric(p, end); break;
+            case S_NUMBER:
+            case S_FRACTION:   p = k->skip_digits(p, end); break;
+            case S_COMMENT:    p = k->skip_line(p, end); break;
+            case S_STRING:     // newlines and NULs included; only the end stops it
+                p = k->skip_string(p, end);
+                if (p == end) {
+                    *last = S_STRING;
+                    *state = F_STRING_CHECK;
+                    return end + 1;
+                }
+                break;
+            default:
+                break;
+        }
+        *last = s;
+        s = dfa[s][char_class[(unsigned char) *p++]];
+    } while (s < DFA_FINAL);
+    *state = s;
+    return p;
+}
+
+//
+// The type of the token that final state `state` ends, given its first byte
+// `token`; moves `*p` from the byte after the last one read back to the end
+// of the token. A string's token includes its quotes. TOKEN_NONE means the
+// input ended inside a string and TOKEN_ERROR an unexpected character.
+//
+static inline TokenType dfa_token(const DfaState state, const char *restrict token,
+        const char **restrict p)
+{
+    switch (state) {
+        case F_SINGLE:         return char_token[(unsigned char) *token];
+        case F_OPERATOR:       --*p; return char_token[(unsigned char) *token];
+        case F_OPERATOR_EQUAL: return char_token[(unsigned char) *token] + 1;
+        case F_IDENTIFIER: {
+            const Keyword *k = find_keyword(str_new_s(token, --*p - token));
+            return k ? k->type : TOKEN_IDENTIFIER;
+        }
+        case F_NUMBER:         --*p; return TOKEN_NUMBER;
+        case F_NUMBER_DOT:     *p -= 2; return TOKEN_NUMBER;
+        case F_STRING:         return TOKEN_STRING;
+        case F_STRING_CHECK:   return TOKEN_NONE;
+        case F_SLASH:          --*p; return TOKEN_SLASH;
+        case F_COMMENT:
+        case F_COMMENT_CHECK:  --*p; return TOKEN_COMMENT;
+        case F_NUL:            return TOKEN_EOF;
+        default:               return TOKEN_ERROR;
+    }
+}
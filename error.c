@@ -23,10 +23,22 @@
 #define LINE_NUM_STYLE  ANSI_RESET ANSI_FG_BLUE
 #define COL_NUM_STYLE   ANSI_RESET ANSI_FG_CYAN
 #define MESSAGE_STYLE   ANSI_RESET ANSI_BOLD
+#define TRACE_STYLE     ANSI_RESET ANSI_FG_CYAN
+#define DEBUG_STYLE     ANSI_RESET ANSI_FG_BLUE ANSI_BOLD
 #define INFO_STYLE      ANSI_RESET ANSI_FG_GREEN ANSI_BOLD
+#define WARN_STYLE      ANSI_RESET ANSI_FG_YELLOW ANSI_BOLD
 #define ERROR_STYLE     ANSI_RESET ANSI_FG_RED ANSI_BOLD
 
-static bool had_error;
+// Set to 0 to compile out tracing entirely (see `trace_span`)
+#ifndef LOXY_TRACE
+#define LOXY_TRACE 1
+#endif
+
+#define TRACE_RING_LEN 4096
+
+// Per thread, so files checked in parallel do not see each other's errors
+static _Thread_local bool had_error;
+static _Thread_local bool had_runtime_error;
 
 int digits(unsigned int v) {
     return (v < 10) ? 1 : (v < 100) ? 2 : (v < 1000) ? 3 : (v < 10000) ? 4 :
@@ -49,7 +61,10 @@ int digits(unsigned int v) {
 //    |  - first borrow ends here
 //
 typedef enum {
+    LOG_LVL_TRACE,
+    LOG_LVL_DEBUG,
     LOG_LVL_INFO,
+    LOG_LVL_WARN,
     LOG_LVL_ERROR,
 } LogLevel;
 
@@ -60,48 +75,179 @@ typedef struct {
 } LogLevelConfig;
 
 static LogLevelConfig log_levels[] = {
+    {"trace", TRACE_STYLE, "------------------------------------------------------------"},
+    {"debug", DEBUG_STYLE, "------------------------------------------------------------"},
     {"info",  INFO_STYLE,  "------------------------------------------------------------"},
+    {"warn",  WARN_STYLE,  "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~"},
     {"error", ERROR_STYLE, "^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^"},
 };
 
-void report(const LogLevel level, const char *restrict filename, const int line_num,
-        const str line, const str substr, const char *restrict message)
+// Messages below this level are dropped
+static LogLevel log_level = LOG_LVL_WARN;
+static bool log_ansi = false;
+
+// Where this thread's messages go, e.g. the diagnostics of one file; stderr if NULL
+static _Thread_local FILE *log_file;
+
+// Where a message points: a span (`substr`) of a source line
+typedef struct {
+    const char *filename;
+    int line_num;
+    str line;
+    str substr;
+    long skipped; // bytes of the line before `line` that are not shown
+} LogLoc;
+
+//
+// Trace records are kept in a ring and written out in batches, so tracing
+// every token costs a few stores rather than a formatted write each.
+//
+typedef struct {
+    const char *what;  // static string, e.g. a token type name
+    LineIndex *lines;  // source of the span; only consulted when flushing
+    int offset;
+    int len;
+} TraceRecord;
+
+static _Thread_local TraceRecord trace_ring[TRACE_RING_LEN];
+static _Thread_local int trace_count;
+
+static const char *log_style(const char *style)
+{
+    return log_ansi ? style : "";
+}
+
+static FILE *log_stream(void)
+{
+    return log_file ? log_file : stderr;
+}
+
+void log_flush(void);
+
+// Reads the level from $LOXY_LOG (trace, debug, info, warn or error) and
+// only styles output when stderr is a terminal.
+void log_init(void)
+{
+    log_ansi = isatty(fileno(stderr));
+    const char *env = getenv("LOXY_LOG");
+    if (env) {
+        for (int l = LOG_LVL_TRACE; l <= LOG_LVL_ERROR; ++l) {
+            if (strcmp(env, log_levels[l].level) == 0) {
+                log_level = (LogLevel) l;
+            }
+        }
+    }
+    atexit(log_flush);
+}
+
+bool log_enabled(const LogLevel level)
+{
+    return level >= log_level;
+}
+
+void report(const LogLevel level, const LogLoc loc, const char *restrict message)
 {
-    LogLevelConfig config = log_levels[level];
+    if (!log_enabled(level)) {
+        return;
+    }
+    log_flush(); // keep buffered traces in order with this message
+
+    const LogLevelConfig config = log_levels[level];
+    const str line = loc.line;
+    const str substr = loc.substr;
     const int substr_offset = substr.head - line.head;
     const str before_substr = str_slice(line, 0, substr_offset);
     const str after_substr = str_slice(line, substr_offset + substr.len, line.len);
-    const int col = substr_offset + 1;
-    const int padding = digits(line_num);
+    const long col = loc.skipped + substr_offset + 1;
+    const int padding = digits(loc.line_num);
+    const char *style = log_style(config.style);
+    const char *line_num_style = log_style(LINE_NUM_STYLE);
+    const char *line_style = log_style(LINE_STYLE);
+    FILE *out = log_stream();
 
     // Message
-    fprintf(stderr, "%s%s", config.style, config.level);
-    // fprintf(stderr, "%s", level);
-    fprintf(stderr, MESSAGE_STYLE ": %s\n", message);
-    fprintf(stderr, LINE_NUM_STYLE " %*s--> ", padding, "");
-    fprintf(stderr, FILENAME_STYLE "%s" LINE_NUM_STYLE ":%d" COL_NUM_STYLE ":%d\n",
-            "unknown", line_num, col); // FIXME filename
-    fprintf(stderr, LINE_NUM_STYLE " %*s | \n", padding, "");
-    fprintf(stderr, LINE_NUM_STYLE " %d | ", line_num);
+    fprintf(out, "%s%s", style, config.level);
+    fprintf(out, "%s: %s\n", log_style(MESSAGE_STYLE), message);
+    fprintf(out, "%s %*s--> ", line_num_style, padding, "");
+    fprintf(out, "%s%s%s:%d%s:%ld\n", log_style(FILENAME_STYLE), loc.filename,
+            line_num_style, loc.line_num, log_style(COL_NUM_STYLE), col);
+    fprintf(out, "%s %*s | \n", line_num_style, padding, "");
+    fprintf(out, "%s %d | ", line_num_style, loc.line_num);
 
     // Code
-    fprintf(stderr, LINE_STYLE "%.*s", before_substr.len, before_substr.head);
-    fprintf(stderr, "%s%.*s", config.style, substr.len, substr.head);
-    fprintf(stderr, LINE_STYLE "%.*s\n", after_substr.len, after_substr.head);
+    fprintf(out, "%s%.*s", line_style, before_substr.len, before_substr.head);
+    fprintf(out, "%s%.*s", style, substr.len, substr.head);
+    fprintf(out, "%s%.*s\n", line_style, after_substr.len, after_substr.head);
 
     // Annotation
-    fprintf(stderr, LINE_NUM_STYLE " %*s | ", padding, "");
-    fprintf(stderr, "%s%*s%.*s", config.style, substr_offset, "", substr.len, config.underline);
-    fprintf(stderr, " %s%s" ANSI_RESET "\n", config.style, message);
+    fprintf(out, "%s %*s | ", line_num_style, padding, "");
+    fprintf(out, "%s%*s%.*s", style, substr_offset, "", substr.len, config.underline);
+    fprintf(out, " %s%s%s\n", style, message, log_style(ANSI_RESET));
 }
 
-void info(const int line_num, const str line, const str substr, const char *message)
+void info(const LogLoc loc, const char *message)
 {
-    report(LOG_LVL_INFO, "unknown", line_num, line, substr, message);
+    report(LOG_LVL_INFO, loc, message);
 }
 
-void error(const int line_num, const str line, const str substr, const char *message)
+void warn(const LogLoc loc, const char *message)
 {
-    report(LOG_LVL_ERROR, "unknown", line_num, line, substr, message);
+    report(LOG_LVL_WARN, loc, message);
+}
+
+void error(const LogLoc loc, const char *message)
+{
+    report(LOG_LVL_ERROR, loc, message);
     had_error = true;
 }
+
+void runtime_error(const LogLoc loc, const char *message)
+{
+    report(LOG_LVL_ERROR, loc, message);
+    had_runtime_error = true;
+}
+
+// Write out buffered trace records, one line each, in a single write
+void log_flush(void)
+{
+    static _Thread_local char *buf = NULL;
+    if (trace_count == 0) {
+        return;
+    }
+    arr_reset(buf);
+    const char *style = log_style(TRACE_STYLE);
+    const char *reset = log_style(ANSI_RESET);
+    for (int i = 0; i < trace_count; ++i) {
+        TraceRecord *r = &trace_ring[i];
+        const int line_index = line_index_find(r->lines, r->offset);
+        const int col = r->offset - r->lines->starts[line_index] + 1;
+        const char *head = r->lines->buffer->head + r->offset;
+        const char *name = r->lines->buffer->name ? r->lines->buffer->name : "unknown";
+        int n = snprintf(NULL, 0, "%strace%s %s:%d:%d %s \"%.*s\"\n", style, reset,
+                name, line_index + 1, col, r->what, r->len, head);
+        char *dest = arr_add(buf, n + 1);
+        snprintf(dest, n + 1, "%strace%s %s:%d:%d %s \"%.*s\"\n", style, reset,
+                name, line_index + 1, col, r->what, r->len, head);
+        (void) arr_pop(buf); // NUL
+    }
+    fwrite(buf, sizeof(char), arr_count(buf), log_stream());
+    trace_count = 0;
+}
+
+void log_trace(LineIndex *restrict lines, const int offset, const int len,
+        const char *restrict what)
+{
+    if (trace_count == TRACE_RING_LEN) {
+        log_flush();
+    }
+    trace_ring[trace_count++] = (TraceRecord) {what, lines, offset, len};
+}
+
+// Trace a span of source. Costs one compare when tracing is off at runtime
+// and nothing when compiled with LOXY_TRACE=0.
+#if LOXY_TRACE
+#define trace_span(lines, offset, len, what) \
+    (log_level <= LOG_LVL_TRACE ? log_trace((lines), (offset), (len), (what)) : (void) 0)
+#else
+#define trace_span(lines, offset, len, what) ((void) 0)
+#endif
@@ -3,6 +3,12 @@
 #ifndef COMMON_H
 #include "common.h"
 #endif
+#ifndef INTERN_C
+#include "intern.c"
+#endif
+#ifndef NUMBER_C
+#include "number.c"
+#endif
 #ifndef TOKEN_C
 #include "token.c"
 #endif
@@ -15,7 +21,36 @@ typedef enum {
     EXPR_STRING,
     EXPR_UNARY,
     EXPR_BINARY,
-    EXPR_GROUPING
+    EXPR_LOGICAL,
+    EXPR_GROUPING,
+    EXPR_VARIABLE,      // resolved to one of:
+    EXPR_GET_LOCAL,
+    EXPR_GET_GLOBAL,
+    EXPR_ASSIGN,        // resolved to one of:
+    EXPR_SET_LOCAL,
+    EXPR_SET_GLOBAL,
+    EXPR_GET_PROPERTY,
+    EXPR_SET_PROPERTY,
+    EXPR_CALL,
+    EXPR_TAIL_CALL,
+    EXPR_GET_METHOD,
+    EXPR_INVOKE,
+    EXPR_CLASS,
+    EXPR_FUNCTION,
+    STMT_EXPRESSION,
+    STMT_PRINT,
+    STMT_RESULT,
+    STMT_VAR,           // resolved to one of:
+    STMT_DEFINE_LOCAL,
+    STMT_DEFINE_GLOBAL,
+    STMT_BLOCK_BEGIN,
+    STMT_BLOCK_END,
+    STMT_WHILE_TEST,
+    STMT_WHILE,
+    STMT_FUNCTION,
+    STMT_PARAM,
+    STMT_RETURN,
+    STMT_METHOD,
 } ExprType;
 
 static const char *ExprTypeNames[] = {
@@ -26,181 +61,515 @@ static const char *ExprTypeNames[] = {
     "EXPR_STRING",
     "EXPR_UNARY",
     "EXPR_BINARY",
-    "EXPR_GROUPING"
-};
-
-typedef struct Expr Expr;
-struct Expr {
-    ExprType type;
-    union {
-        struct {
-            Token *token;
-            union {
-                bool boolean;
-                double number;
-                char *string;
-            };
-        } literal;
-        struct {
-            Token *op;
-            Expr *rhs;
-        } unary;
-        struct {
-            Token *op;
-            Expr *lhs;
-            Expr *rhs;
-        } binary;
-        Expr *grouping;
-    };
+    "EXPR_LOGICAL",
+    "EXPR_GROUPING",
+    "EXPR_VARIABLE",
+    "EXPR_GET_LOCAL",
+    "EXPR_GET_GLOBAL",
+    "EXPR_ASSIGN",
+    "EXPR_SET_LOCAL",
+    "EXPR_SET_GLOBAL",
+    "EXPR_GET_PROPERTY",
+    "EXPR_SET_PROPERTY",
+    "EXPR_CALL",
+    "EXPR_TAIL_CALL",
+    "EXPR_GET_METHOD",
+    "EXPR_INVOKE",
+    "EXPR_CLASS",
+    "EXPR_FUNCTION",
+    "STMT_EXPRESSION",
+    "STMT_PRINT",
+    "STMT_RESULT",
+    "STMT_VAR",
+    "STMT_DEFINE_LOCAL",
+    "STMT_DEFINE_GLOBAL",
+    "STMT_BLOCK_BEGIN",
+    "STMT_BLOCK_END",
+    "STMT_WHILE_TEST",
+    "STMT_WHILE",
+    "STMT_FUNCTION",
+    "STMT_PARAM",
+    "STMT_RETURN",
+    "STMT_METHOD",
 };
 
-#define EXPRS_MAX_COUNT 65536
-static Expr exprs[EXPRS_MAX_COUNT];
-static int exprs_count;
-
-static Expr NoneExpr  = { .type = EXPR_NONE };
-static Expr NilExpr   = { .type = EXPR_NIL };
-static Expr FalseExpr = { .type = EXPR_BOOL, .literal.boolean = false };
-static Expr TrueExpr  = { .type = EXPR_BOOL, .literal.boolean = true };
+//
+// Flat AST: the nodes of a program stored contiguously in post-order
+// (children before their parent, each statement after the one before it), as
+// parallel arrays.
+//
+// A node's last child is always the node right before it, so only binary
+// nodes record a child index, that of their lhs:
+//
+//   EXPR_UNARY, EXPR_GROUPING   operand: i-1
+//   EXPR_BINARY, EXPR_LOGICAL   lhs: args[i], rhs: i-1
+//   EXPR_ASSIGN, STMT_VAR       value: i-1 (`var` without one gets a nil)
+//   EXPR_GET_PROPERTY, EXPR_GET_METHOD
+//                               object: i-1
+//   EXPR_SET_PROPERTY           object, then value: i-1
+//   EXPR_CALL, EXPR_TAIL_CALL, EXPR_INVOKE
+//                               callee, then args[i] arguments, the last: i-1
+//   STMT_EXPRESSION, STMT_PRINT, STMT_RESULT, STMT_RETURN
+//                               expression: i-1 (`return;` gets a nil)
+//
+// The engines never need the earlier children of the last two, which are
+// evaluated in order onto the stack; the printer finds them from where the
+// later children's subtrees start.
+//
+// Literal payloads are in `args` too: EXPR_NUMBER's value is
+// numbers[args[i]], EXPR_STRING's is the interned string args[i] and
+// EXPR_BOOL's is args[i]. The lexemes of operators and names are looked up
+// in the TokenStream through `tokens[i]`.
+//
+// Statements that contain statements are bracketed by marker nodes, so the
+// nodes can still be run in order:
+//
+//   {   STMT_BLOCK_BEGIN  statements  STMT_BLOCK_END
+//   while   condition  STMT_WHILE_TEST  body  STMT_WHILE
+//   fn   STMT_FUNCTION  STMT_PARAM...  body  EXPR_FUNCTION  STMT_VAR
+//   class   EXPR_CLASS  methods...  STMT_VAR
+//   method   STMT_FUNCTION  STMT_PARAM...  body  EXPR_FUNCTION  STMT_METHOD
+//
+// STMT_WHILE_TEST's args is the index of its STMT_WHILE, where a false
+// condition goes to, and STMT_WHILE's that of the first node of the
+// condition, where it loops back to.
+//
+// A function declaration defines its name like a `var` whose value is the
+// function. STMT_FUNCTION's args is the index of its EXPR_FUNCTION, which
+// makes the function and is where the definition skips to; EXPR_FUNCTION's
+// args is the number of parameters, each a STMT_PARAM with its name in args
+// (its slot, once resolved). A call runs the body from the node after the
+// last STMT_PARAM, and reaching the EXPR_FUNCTION returns nil. The call
+// whose value a `return` returns (directly, or as the rhs of `and`, `or` or
+// a grouping) is an EXPR_TAIL_CALL, which reuses the caller's frame.
+//
+// A name (EXPR_VARIABLE, EXPR_ASSIGN, STMT_VAR, STMT_PARAM) is parsed with its interned
+// string in args, and the resolver (see resolver.c) rewrites it to the local
+// or global it means, with that variable's slot in args instead. The result
+// of a program is its last expression when that has no `;` (STMT_RESULT),
+// as in the REPL. `class A {}` is an EXPR_CLASS, with its token at the name
+// and the interned name in args, defined by a STMT_VAR of the same name.
+//
+// A method is declared in its class's body like a function, without `fn`,
+// and STMT_METHOD adds it to the class below it (on the stack) instead of
+// defining a name. Its first STMT_PARAM is an implicit `this` (with the
+// method's name as its token), which `this` in the body resolves to, so it
+// is called with the instance as its first argument.
+//
+// Each property access (EXPR_GET_PROPERTY, EXPR_SET_PROPERTY) is a site,
+// numbered in order, with its number in args and its interned name in
+// `names`; the engines keep an inline cache per site (see shape.c). Its
+// token is the name's. A call of a property, `a.m(x)`, is a method call: the
+// property is an EXPR_GET_METHOD site, which leaves the method and the
+// instance (or, if it is a field, its value and a nil), and the call an
+// EXPR_INVOKE, which calls a method with the instance as its receiver.
+//
+// Every token makes at most one node, plus an EXPR_NONE where an operand is
+// missing after it, so the arrays are sized once per parse for twice the
+// number of tokens, and kept for the next parse. They only grow when more
+// tokens are parsed onto the end of the tree (a REPL line, see `parse_more`).
+// Their arr counts are the room in them; `count` and `num_numbers` are the
+// nodes and number literals in use.
+//
+typedef struct {
+    uint8_t *types;   // arr of ExprType
+    uint32_t *tokens; // arr; the literal's or operator's token; for EXPR_NONE, where one was expected
+    uint32_t *args;   // arr
+    double *numbers;  // arr
+    Intern *names;    // arr; the name of each property site
+    int count;
+    int num_numbers;
+} Ast;
 
 static const str expr_nil_s   = (str) { .head = "nil",   .len = 3};
 static const str expr_true_s  = (str) { .head = "true",  .len = 4};
 static const str expr_false_s = (str) { .head = "false", .len = 5};
 static const str expr_group_s = (str) { .head = "group", .len = 5};
+static const str expr_assign_s = (str) { .head = "=",    .len = 1};
+static const str expr_get_s   = (str) { .head = ".",     .len = 1};
+static const str expr_call_s  = (str) { .head = "call",  .len = 4};
+static const str expr_tail_call_s = (str) { .head = "tailcall", .len = 8};
 
-const char *expr_type_string(const Expr *e)
-{
-    return ExprTypeNames[e->type];
-}
-
-char *expr_parenthesize(char *buf, const str lexeme, int n, ...);
-char *expr_sprint(char *restrict str, const Expr *restrict e);
+// Grow `arr` to room for at least `need` elements, at least doubling it
+#define AST_GROW(arr, need) \
+    ((need) > arr_count(arr) ? (void) arr_add(arr, max(2 * arr_count(arr), (need)) - arr_count(arr)) \
+                             : (void) 0)
 
-const char *expr_string(const Expr *e)
+// An empty tree with room for `max_nodes` nodes and `max_numbers` number
+// literals, reusing the arrays of the last one
+void ast_init(Ast *ast, const int max_nodes, const int max_numbers)
 {
-    static char *buf = NULL;
-    arr_reset(buf); // FIXME rather than reset the buffer, need to continue appending
-    switch (e->type) {
-        case EXPR_NONE: return "";
-        case EXPR_NIL: return "nil";
-        case EXPR_BOOL: return (e->literal.boolean ? "true" : "false");
-        case EXPR_NUMBER: return str_to_char(e->literal.token->lexeme);
-        case EXPR_STRING: return e->literal.string;
-        // case EXPR_UNARY: arr_concat(buf, e->unary.op->lexeme.head, e->unary.op->lexeme.len); return buf;// // FIXME ???
-        // case EXPR_UNARY: return expr_parenthesize(buf, e->unary.op->lexeme, 1, e->unary.rhs);
-        case EXPR_UNARY: return "unary"; // FIXME ???
-        case EXPR_BINARY: return "binary"; // FIXME ???
-        case EXPR_GROUPING: return "group"; // FIXME ???
-    }
+    arr_reset(ast->types);
+    arr_reset(ast->tokens);
+    arr_reset(ast->args);
+    arr_reset(ast->numbers);
+    arr_reset(ast->names);
+    ast->count = 0;
+    ast->num_numbers = 0;
+    AST_GROW(ast->types, max_nodes);
+    AST_GROW(ast->tokens, max_nodes);
+    AST_GROW(ast->args, max_nodes);
+    AST_GROW(ast->numbers, max_numbers);
 }
 
-void expr_pp(const Expr *e)
+// Room for `nodes` more nodes and `numbers` more number literals
+void ast_reserve(Ast *ast, const int nodes, const int numbers)
 {
-    printf("[Expr * %p:%s] \"%s\"\n", (void *) e, expr_type_string(e), expr_string(e));
+    AST_GROW(ast->types, ast->count + nodes);
+    AST_GROW(ast->tokens, ast->count + nodes);
+    AST_GROW(ast->args, ast->count + nodes);
+    AST_GROW(ast->numbers, ast->num_numbers + numbers);
 }
 
-char *expr_parenthesize(char *buf, const str lexeme, int n, ...)
+// Drop the nodes from `count` on, with their number literals and property
+// sites (a REPL line that did not compile)
+void ast_truncate(Ast *ast, const int count, const int num_numbers, const int num_names)
 {
-    va_list exprs;
-    va_start(exprs, n);
-    arr_reserve(buf, 2+n); // (, ), ' ' per expr
-    arr_push(buf, '(');
-    arr_concat(buf, lexeme.head, lexeme.len);
-    Expr *e;
-    while (n--) {
-        arr_push(buf, ' ');
-        e = va_arg(exprs, Expr *);
-        buf = expr_sprint(buf, e);
-    }
-    arr_push(buf, ')');
-
-    va_end(exprs);
-    return buf;
+    ast->count = count;
+    ast->num_numbers = num_numbers;
+    while (arr_count(ast->names) > num_names) (void) arr_pop(ast->names);
 }
 
-char *expr_sprint_str(char *buf, const str s)
+// Returns the index of the new node
+int ast_push(Ast *ast, const ExprType type, const int token, const uint32_t arg)
 {
-    arr_concat(buf, s.head, s.len);
-    return buf;
+    const int i = ast->count++;
+    ast->types[i] = type;
+    ast->tokens[i] = token;
+    ast->args[i] = arg;
+    return i;
 }
 
-char *expr_sprint(char *buf, const Expr *e)
+int ast_push_number(Ast *ast, const int token, const double value)
 {
-    switch (e->type) {
-        case EXPR_GROUPING: return expr_parenthesize(buf, expr_group_s, 1, e->grouping);
-        case EXPR_BINARY: return expr_parenthesize(buf, e->binary.op->lexeme, 2, e->binary.lhs, e->binary.rhs);
-        case EXPR_UNARY: return expr_parenthesize(buf, e->unary.op->lexeme, 1, e->unary.rhs);
-        case EXPR_STRING: return expr_sprint_str(buf, e->literal.token->lexeme);
-        case EXPR_NUMBER: return expr_sprint_str(buf, e->literal.token->lexeme);
-        case EXPR_BOOL: return expr_sprint_str(buf, e->literal.boolean ? expr_true_s : expr_false_s);
-        case EXPR_NIL: return expr_sprint_str(buf, expr_nil_s);
-        case EXPR_NONE: return buf;
-    }
-    // TODO assert unreachable
+    ast->numbers[ast->num_numbers] = value;
+    return ast_push(ast, EXPR_NUMBER, token, ast->num_numbers++);
 }
 
-Expr *make_expr(const ExprType t)
+int ast_push_string(Ast *ast, const int token, const str value)
 {
-    Expr *e = &exprs[exprs_count++];
-    e->type = t;
-    return e;
+    return ast_push(ast, EXPR_STRING, token, intern_str(value));
 }
 
-Expr *make_literal_expr(const ExprType et, Token *tok)
+// A new EXPR_GET_PROPERTY site for the name at `token`
+int ast_push_property(Ast *ast, const int token, const str name)
 {
-    Expr *e = make_expr(et);
-    e->literal.token = tok;
-    return e;
+    arr_push(ast->names, intern_str(name));
+    return ast_push(ast, EXPR_GET_PROPERTY, token, arr_count(ast->names) - 1);
 }
 
-Expr *make_nil_expr(Token *t)
+// The index of the root of the last expression pushed
+int ast_root(const Ast *ast)
 {
-    return make_literal_expr(EXPR_NIL, t);
+    return ast->count - 1;
 }
 
-Expr *make_bool_expr(Token *t, bool b)
+const char *expr_type_string(const Ast *ast, const int i)
 {
-    Expr *e = make_literal_expr(EXPR_BOOL, t);
-    e->literal.boolean = b;
-    return e;
+    return ExprTypeNames[ast->types[i]];
 }
 
-Expr *make_number_expr(Token *t)
+// Valid until the next call
+static str expr_number_text(const double d)
 {
-    static char *buf = NULL;
-    arr_copy(buf, t->lexeme.head, t->lexeme.len); arr_push(buf, '\0');
-    Expr *e = make_literal_expr(EXPR_NUMBER, t);
-    e->literal.number = atof(buf);
-    return e;
+    static _Thread_local char buf[32];
+    return str_new_s(buf, number_format(buf, sizeof(buf), d));
 }
 
-Expr *make_string_expr(Token *t)
+// The text of a leaf, or the operator of an inner node
+static str expr_text(const TokenStream *restrict ts, const Ast *restrict ast, const int i)
 {
-    Expr *e = make_literal_expr(EXPR_STRING, t);
-    e->literal.string = str_to_char(t->lexeme);
-    return e;
+    switch ((ExprType) ast->types[i]) {
+        case EXPR_NONE: return (str) {.head = "", .len = 0};
+        case EXPR_NIL: return expr_nil_s;
+        case EXPR_BOOL: return ast->args[i] ? expr_true_s : expr_false_s;
+        case EXPR_STRING: return intern_get(ast->args[i]);
+        case EXPR_GROUPING: return expr_group_s;
+        case EXPR_ASSIGN:
+        case EXPR_SET_LOCAL:
+        case EXPR_SET_GLOBAL:
+        case EXPR_SET_PROPERTY: return expr_assign_s;
+        case EXPR_GET_PROPERTY:
+        case EXPR_GET_METHOD: return expr_get_s;
+        case EXPR_CALL:
+        case EXPR_INVOKE: return expr_call_s;
+        case EXPR_TAIL_CALL: return expr_tail_call_s;
+        case EXPR_NUMBER:
+            if (ts->types[ast->tokens[i]] != TOKEN_NUMBER) { // folded
+                return expr_number_text(ast->numbers[ast->args[i]]);
+            }
+            return token_stream_lexeme(ts, ast->tokens[i]);
+        default: return token_stream_lexeme(ts, ast->tokens[i]);
+    }
 }
 
-Expr *make_unary_expr(Token *restrict op, Expr *restrict rhs)
+void expr_pp(const TokenStream *restrict ts, const Ast *restrict ast, const int i)
 {
-    Expr *e = make_expr(EXPR_UNARY);
-    e->unary.op = op;
-    e->unary.rhs = rhs;
-    return e;
+    str text = expr_text(ts, ast, i);
+    printf("[Expr %d:%s] \"%.*s\"\n", i, expr_type_string(ast, i), text.len, text.head);
 }
 
-Expr *make_binary_expr(Expr *restrict lhs, Token *restrict op, Expr *restrict rhs)
+//
+// Prints the expression of nodes `first` to `root` in prefix notation, e.g.
+// `(+ 1 (group 2))`, in two linear passes over the nodes: the first computes
+// the length of every subtree's text and where it starts (children come
+// first), the second runs backwards from the root, writing each node's own
+// text and placing its children's (parents come first).
+//
+static char *expr_sprint(char *restrict buf, const TokenStream *restrict ts, const Ast *restrict ast,
+        const int first, const int root)
 {
-    Expr *e = make_expr(EXPR_BINARY);
-    e->binary.lhs = lhs;
-    e->binary.op = op;
-    e->binary.rhs = rhs;
-    return e;
+    static _Thread_local int *lens = NULL;   // arr; also reused for the start offsets
+    static _Thread_local int *starts = NULL; // arr; the first node of each subtree
+    arr_reset(lens);
+    arr_reset(starts);
+    (void) arr_add(lens, root + 1); // indexed by node
+    (void) arr_add(starts, root + 1);
+    for (int i = first; i <= root; ++i) {
+        const int len = expr_text(ts, ast, i).len;
+        const int name_len = ts->lens[ast->tokens[i]];
+        starts[i] = i > first ? starts[i-1] : i; // that of its last child, if any
+        switch ((ExprType) ast->types[i]) {
+            case EXPR_UNARY:
+            case EXPR_GROUPING: // (op operand)
+                lens[i] = len + 3 + lens[i-1];
+                break;
+            case EXPR_BINARY:
+            case EXPR_LOGICAL: // (op lhs rhs)
+                starts[i] = starts[ast->args[i]];
+                lens[i] = len + 4 + lens[ast->args[i]] + lens[i-1];
+                break;
+            case EXPR_ASSIGN:
+            case EXPR_SET_LOCAL:
+            case EXPR_SET_GLOBAL: // (= name value)
+                lens[i] = len + 4 + name_len + lens[i-1];
+                break;
+            case EXPR_GET_PROPERTY:
+            case EXPR_GET_METHOD: // (. object name)
+                lens[i] = len + 4 + lens[i-1] + name_len;
+                break;
+            case EXPR_SET_PROPERTY: { // (= (. object name) value)
+                const int object = starts[i-1] - 1;
+                starts[i] = starts[object];
+                lens[i] = len + 9 + lens[object] + name_len + lens[i-1];
+                break;
+            }
+            case EXPR_CALL:
+            case EXPR_TAIL_CALL:
+            case EXPR_INVOKE: { // (call callee arguments...)
+                lens[i] = len + 2;
+                for (int k = 0, child = i - 1; k <= (int) ast->args[i]; ++k, child = starts[child] - 1) {
+                    lens[i] += 1 + lens[child];
+                    starts[i] = starts[child];
+                }
+                break;
+            }
+            default:
+                starts[i] = i;
+                lens[i] = len;
+        }
+    }
+
+// Put the text of node `child` at `c` and move past it. The children still
+// hold their lengths; this replaces them with offsets
+#define EXPR_PLACE(child) \
+    do { \
+        const int child_len = lens[child]; \
+        lens[child] = c - out; \
+        c += child_len; \
+    } while (0)
+
+    char *out = arr_add(buf, lens[root]);
+    lens[root] = 0; // from here on, the offset of each node's text in `out`
+    for (int i = root; i >= first; --i) {
+        const str text = expr_text(ts, ast, i);
+        const str name = token_stream_lexeme(ts, ast->tokens[i]);
+        char *c = out + lens[i];
+        switch ((ExprType) ast->types[i]) {
+            case EXPR_UNARY:
+            case EXPR_GROUPING:
+            case EXPR_BINARY:
+            case EXPR_LOGICAL:
+            case EXPR_ASSIGN:
+            case EXPR_SET_LOCAL:
+            case EXPR_SET_GLOBAL:
+            case EXPR_GET_PROPERTY:
+            case EXPR_GET_METHOD:
+            case EXPR_SET_PROPERTY:
+            case EXPR_CALL:
+            case EXPR_TAIL_CALL:
+            case EXPR_INVOKE:
+                break;
+            default:
+                memcpy(c, text.head, text.len);
+                continue;
+        }
+        *c++ = '(';
+        memcpy(c, text.head, text.len);
+        c += text.len;
+        switch ((ExprType) ast->types[i]) {
+            case EXPR_BINARY:
+            case EXPR_LOGICAL:
+                *c++ = ' ';
+                EXPR_PLACE(ast->args[i]);
+                break;
+            case EXPR_ASSIGN:
+            case EXPR_SET_LOCAL:
+            case EXPR_SET_GLOBAL:
+                *c++ = ' ';
+                memcpy(c, name.head, name.len);
+                c += name.len;
+                break;
+            case EXPR_GET_PROPERTY:
+            case EXPR_GET_METHOD:
+                *c++ = ' ';
+                EXPR_PLACE(i-1);
+                *c++ = ' ';
+                memcpy(c, name.head, name.len);
+                *(c += name.len) = ')';
+                continue;
+            case EXPR_SET_PROPERTY:
+                memcpy(c, " (. ", 4);
+                c += 4;
+                EXPR_PLACE(starts[i-1] - 1);
+                *c++ = ' ';
+                memcpy(c, name.head, name.len);
+                c += name.len;
+                *c++ = ')';
+                break;
+            case EXPR_CALL:
+            case EXPR_TAIL_CALL:
+            case EXPR_INVOKE: {
+                // Find the end, then place the children from the last back
+                char *end = c;
+                for (int k = 0, child = i - 1; k <= (int) ast->args[i]; ++k, child = starts[child] - 1) {
+                    end += 1 + lens[child];
+                }
+                *end = ')';
+                for (int k = 0, child = i - 1; k <= (int) ast->args[i]; ++k, child = starts[child] - 1) {
+                    end -= lens[child];
+                    lens[child] = end - out;
+                    *--end = ' ';
+                }
+                continue;
+            }
+            default:
+                break;
+        }
+        *c++ = ' ';
+        EXPR_PLACE(i-1);
+        *c = ')';
+    }
+#undef EXPR_PLACE
+    return buf;
 }
 
-Expr *make_grouping_expr(Expr *expr)
+//
+// Prints the program, one top-level statement per line, with expressions as
+// by `expr_sprint` and statements around them in the same notation, e.g.
+// `(var a 1)` or `(while (< a 10) (block (print a) (= a (+ a 1))))`. An
+// expression statement prints as just its expression, a function as
+// `(fn name (params...) body...)` and a class as `(class A methods...)`,
+// each method like a function but for `method` in place of `fn`.
+//
+char *ast_sprint(char *restrict buf, const TokenStream *restrict ts, const Ast *restrict ast)
 {
-    Expr *e = make_expr(EXPR_GROUPING);
-    e->grouping = expr;
-    return e;
+    int first = 0; // of the current statement's expression
+    int depth = 0; // of statements inside blocks and loops
+    for (int i = 0; i < ast->count; ++i) {
+        const ExprType type = (ExprType) ast->types[i];
+        if (type < STMT_EXPRESSION && type != EXPR_CLASS) { // part of an expression
+            continue;
+        }
+        if (type == STMT_PARAM) { // printed with its function
+            first = i + 1;
+            continue;
+        }
+        const bool define = type == STMT_VAR || type == STMT_DEFINE_LOCAL || type == STMT_DEFINE_GLOBAL;
+        const bool fn_end = (define && ast->types[i-1] == EXPR_FUNCTION) || type == STMT_METHOD;
+        const bool class_end = define && (ast->types[i-1] == EXPR_CLASS || ast->types[i-1] == STMT_METHOD);
+        if (type != STMT_BLOCK_END && type != STMT_WHILE && !fn_end && !class_end) {
+            if (depth) {
+                arr_push(buf, ' ');
+            } else if (arr_count(buf)) {
+                arr_push(buf, '\n');
+            }
+        }
+        switch (type) {
+            case STMT_PRINT:
+                arr_concat(buf, "(print ", 7);
+                buf = expr_sprint(buf, ts, ast, first, i-1);
+                arr_push(buf, ')');
+                break;
+            case EXPR_CLASS: {
+                const str name = token_stream_lexeme(ts, ast->tokens[i]);
+                arr_concat(buf, "(class ", 7);
+                arr_concat(buf, name.head, name.len);
+                depth++;
+                break;
+            }
+            case STMT_VAR:
+            case STMT_DEFINE_LOCAL:
+            case STMT_DEFINE_GLOBAL: {
+                const str name = token_stream_lexeme(ts, ast->tokens[i]);
+                if (fn_end || class_end) {
+                    arr_push(buf, ')');
+                    depth--;
+                    break;
+                }
+                arr_concat(buf, "(var ", 5);
+                arr_concat(buf, name.head, name.len);
+                arr_push(buf, ' ');
+                buf = expr_sprint(buf, ts, ast, first, i-1);
+                arr_push(buf, ')');
+                break;
+            }
+            case STMT_BLOCK_BEGIN:
+                arr_concat(buf, "(block", 6);
+                depth++;
+                break;
+            case STMT_WHILE_TEST:
+                arr_concat(buf, "(while ", 7);
+                buf = expr_sprint(buf, ts, ast, first, i-1);
+                depth++;
+                break;
+            case STMT_BLOCK_END:
+            case STMT_WHILE:
+            case STMT_METHOD:
+                arr_push(buf, ')');
+                depth--;
+                break;
+            case STMT_FUNCTION: {
+                const str name = token_stream_lexeme(ts, ast->tokens[i]);
+                const bool method = ast->types[ast->args[i] + 1] == STMT_METHOD;
+                if (method) {
+                    arr_concat(buf, "(method ", 8);
+                } else {
+                    arr_concat(buf, "(fn ", 4);
+                }
+                arr_concat(buf, name.head, name.len);
+                arr_concat(buf, " (", 2);
+                const int params = i + 1 + method; // after `this`
+                for (int k = params; ast->types[k] == STMT_PARAM; ++k) {
+                    const str param = token_stream_lexeme(ts, ast->tokens[k]);
+                    if (k > params) {
+                        arr_push(buf, ' ');
+                    }
+                    arr_concat(buf, param.head, param.len);
+                }
+                arr_push(buf, ')');
+                depth++;
+                break;
+            }
+            case STMT_RETURN:
+                arr_concat(buf, "(return ", 8);
+                buf = expr_sprint(buf, ts, ast, first, i-1);
+                arr_push(buf, ')');
+                break;
+            default: // STMT_EXPRESSION, STMT_RESULT
+                buf = expr_sprint(buf, ts, ast, first, i-1);
+        }
+        first = i + 1;
+    }
+    return buf;
 }
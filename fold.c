@@ -0,0 +1,192 @@
+#define FOLD_C
+
+#ifndef COMMON_H
+#include "common.h"
+#endif
+#ifndef EXPR_C
+#include "expr.c"
+#endif
+#ifndef INTERN_C
+#include "intern.c"
+#endif
+#ifndef TOKEN_C
+#include "token.c"
+#endif
+
+//
+// Constant folding, done by the parser as it emits operator nodes.
+//
+// Operands are the last nodes of the Ast (see expr.c), so when they are all
+// literals the operator is evaluated right away and its operands' nodes are
+// replaced by one literal node with the result. The new node keeps the
+// operator's token, for diagnostics. Operations that would be runtime errors
+// (e.g. `-"a"` or `1 < "b"`) are left for the evaluator, with Lox semantics
+// for everything else:
+//
+// - `-`, `*`, `/`, `<`, `<=`, `>` and `>=` take numbers;
+// - `+` takes two numbers or two strings;
+// - `==` and `!=` compare any two values, and values of different types are
+//   never equal;
+// - `!`, `and` and `or` go by truthiness: only `nil` and `false` are false,
+//   and `and`/`or` result in one of their operands.
+//
+// Parenthesized groups only matter for precedence, which the shape of the
+// tree already records, so no grouping nodes are emitted when folding.
+//
+
+static bool fold_is_literal(const Ast *ast, const int i)
+{
+    switch ((ExprType) ast->types[i]) {
+        case EXPR_NIL:
+        case EXPR_BOOL:
+        case EXPR_NUMBER:
+        case EXPR_STRING:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool fold_is_truthy(const Ast *ast, const int i)
+{
+    switch ((ExprType) ast->types[i]) {
+        case EXPR_NIL:  return false;
+        case EXPR_BOOL: return ast->args[i];
+        default:        return true;
+    }
+}
+
+static double fold_number(const Ast *ast, const int i)
+{
+    return ast->numbers[ast->args[i]];
+}
+
+static bool fold_equal(const Ast *ast, const int a, const int b)
+{
+    if (ast->types[a] != ast->types[b]) {
+        return false;
+    }
+    switch ((ExprType) ast->types[a]) {
+        case EXPR_NIL:    return true;
+        case EXPR_BOOL:   return ast->args[a] == ast->args[b];
+        case EXPR_NUMBER: return fold_number(ast, a) == fold_number(ast, b);
+        case EXPR_STRING: return ast->args[a] == ast->args[b]; // interned
+        default:          return false;
+    }
+}
+
+// Make node `i` a literal, keeping its payload slot where it has one
+static void fold_to_bool(Ast *ast, const int i, const int token, const bool b)
+{
+    ast->types[i] = EXPR_BOOL;
+    ast->tokens[i] = token;
+    ast->args[i] = b;
+}
+
+static void fold_to_number(Ast *ast, const int i, const int token, const double d)
+{
+    ast->numbers[ast->args[i]] = d; // node `i` is a number
+    ast->tokens[i] = token;
+}
+
+// Node `to` becomes a copy of literal node `from`, keeping `token`
+static void fold_to_copy(Ast *ast, const int to, const int from, const int token)
+{
+    ast->types[to] = ast->types[from];
+    ast->args[to] = ast->args[from];
+    ast->tokens[to] = token;
+}
+
+// Fold the unary operator `op` (at token `token`) over the last node; returns
+// false if it is not a constant the operator applies to
+bool fold_unary(Ast *ast, const TokenType op, const int token)
+{
+    const int i = ast->count - 1;
+    if (!fold_is_literal(ast, i)) {
+        return false;
+    }
+    switch (op) {
+        case TOKEN_BANG:
+            fold_to_bool(ast, i, token, !fold_is_truthy(ast, i));
+            return true;
+        case TOKEN_MINUS:
+        case TOKEN_PLUS:
+            if (ast->types[i] != EXPR_NUMBER) {
+                return false;
+            }
+            fold_to_number(ast, i, token, op == TOKEN_MINUS ? -fold_number(ast, i) : fold_number(ast, i));
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Fold the binary or logical operator `op` (at token `token`) over the last
+// two nodes, replacing them with one; returns false if they are not constants
+// the operator applies to
+bool fold_binary(Ast *ast, const TokenType op, const int token)
+{
+    const int rhs = ast->count - 1;
+    const int lhs = ast->count - 2;
+    if (lhs < 0 || !fold_is_literal(ast, lhs) || !fold_is_literal(ast, rhs)) {
+        return false;
+    }
+    const bool numbers = ast->types[lhs] == EXPR_NUMBER && ast->types[rhs] == EXPR_NUMBER;
+    switch (op) {
+        case TOKEN_EQUAL_EQUAL:
+        case TOKEN_BANG_EQUAL:
+            fold_to_bool(ast, lhs, token, fold_equal(ast, lhs, rhs) == (op == TOKEN_EQUAL_EQUAL));
+            break;
+        case TOKEN_AND:
+        case TOKEN_OR:
+            fold_to_copy(ast, lhs, fold_is_truthy(ast, lhs) == (op == TOKEN_OR) ? lhs : rhs, token);
+            break;
+        case TOKEN_PLUS:
+            if (ast->types[lhs] == EXPR_STRING && ast->types[rhs] == EXPR_STRING) {
+                static _Thread_local char *buf = NULL; // arr
+                const str a = intern_get(ast->args[lhs]);
+                const str b = intern_get(ast->args[rhs]);
+                arr_reset(buf);
+                arr_concat(buf, a.head, a.len);
+                arr_concat(buf, b.head, b.len);
+                ast->args[lhs] = intern(buf, arr_count(buf));
+                ast->tokens[lhs] = token;
+                break;
+            }
+            if (!numbers) return false;
+            fold_to_number(ast, lhs, token, fold_number(ast, lhs) + fold_number(ast, rhs));
+            break;
+        case TOKEN_MINUS:
+            if (!numbers) return false;
+            fold_to_number(ast, lhs, token, fold_number(ast, lhs) - fold_number(ast, rhs));
+            break;
+        case TOKEN_STAR:
+            if (!numbers) return false;
+            fold_to_number(ast, lhs, token, fold_number(ast, lhs) * fold_number(ast, rhs));
+            break;
+        case TOKEN_SLASH:
+            if (!numbers) return false;
+            fold_to_number(ast, lhs, token, fold_number(ast, lhs) / fold_number(ast, rhs));
+            break;
+        case TOKEN_GREATER:
+            if (!numbers) return false;
+            fold_to_bool(ast, lhs, token, fold_number(ast, lhs) > fold_number(ast, rhs));
+            break;
+        case TOKEN_GREATER_EQUAL:
+            if (!numbers) return false;
+            fold_to_bool(ast, lhs, token, fold_number(ast, lhs) >= fold_number(ast, rhs));
+            break;
+        case TOKEN_LESS:
+            if (!numbers) return false;
+            fold_to_bool(ast, lhs, token, fold_number(ast, lhs) < fold_number(ast, rhs));
+            break;
+        case TOKEN_LESS_EQUAL:
+            if (!numbers) return false;
+            fold_to_bool(ast, lhs, token, fold_number(ast, lhs) <= fold_number(ast, rhs));
+            break;
+        default:
+            return false;
+    }
+    ast->count--; // drop the rhs
+    return true;
+}
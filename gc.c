@@ -0,0 +1,339 @@
+#define GC_C
+
+#ifndef COMMON_H
+#include "common.h"
+#endif
+#ifndef SHAPE_C
+#include "shape.c"
+#endif
+#ifndef VALUE_C
+#include "value.c"
+#endif
+
+#include <time.h> // clock_gettime
+
+#define GC_HEAP_GROW_FACTOR 2
+#define GC_MIN_NEXT_GC (1 << 20) // bytes allocated before the first collection
+#define GC_FLAT_MAX 64            // chars of the longest string `+` makes flat rather than a rope
+
+//
+// Heap of runtime objects, with a precise mark-and-sweep collector.
+//
+// Every object is on one list. A collection marks what is reachable from the
+// roots (the running engine's value stack and the globals), tracing through
+// a stack of gray objects rather than recursing, then frees the rest.
+//
+// Allocating adds to a debt; once the bytes allocated pass `next_gc` the
+// heap is collected and `next_gc` is set to a multiple of what survived, so
+// the work of collecting is proportional to the allocation it pays for. In
+// stress mode every allocation collects, which flushes out values that are
+// not rooted where they should be.
+//
+// A rope's chars are allocated when it is flattened, outside the heap (see
+// value.c), and taken into account at the next allocation or collection.
+//
+// Engines must keep every value they still need on the value stack below
+// `stack_top` whenever they allocate. Their inline caches are registered in
+// `caches` and cleared whenever a class is freed, as its shapes go with it.
+//
+typedef struct {
+    int collections;
+    size_t objects_freed;
+    size_t bytes_freed;
+    size_t peak_bytes;
+    double total_pause; // seconds
+    double max_pause;
+} GcStats;
+
+typedef struct {
+    Obj *objects;
+    size_t bytes_allocated;
+    size_t next_gc;
+    bool stress;
+
+    // Roots
+    Value *stack_base;
+    Value *stack_top;
+    Value *globals;     // arr
+
+    PropertyCache *caches; // of the running engine, cleared when shapes are freed
+    int num_caches;
+
+    Obj **gray;         // arr
+    GcStats stats;
+} Heap;
+
+static size_t gc_obj_size(const Obj *o)
+{
+    switch ((ObjType) o->type) {
+        case OBJ_STRING: {
+            const ObjString *s = (const ObjString *) o;
+            return sizeof(ObjString) + (s->chars ? s->len + 1 : 0);
+        }
+        case OBJ_CLASS: return sizeof(ObjClass);
+        case OBJ_INSTANCE: return sizeof(ObjInstance) + ((const ObjInstance *) o)->capacity * sizeof(Value);
+        case OBJ_FUNCTION: return sizeof(ObjFunction);
+    }
+    return sizeof(Obj);
+}
+
+static void gc_mark_obj(Heap *h, Obj *o)
+{
+    if (o->marked) return;
+    o->marked = true;
+    arr_push(h->gray, o);
+}
+
+static void gc_mark_value(Heap *h, const Value v)
+{
+    if (value_is_obj(v)) {
+        gc_mark_obj(h, value_as_obj(v));
+    }
+}
+
+// Mark what `o` refers to
+static void gc_blacken(Heap *h, Obj *o)
+{
+    switch ((ObjType) o->type) {
+        case OBJ_STRING: {
+            const ObjString *s = (const ObjString *) o;
+            if (!s->chars) { // a rope
+                gc_mark_value(h, s->left);
+                gc_mark_value(h, s->right);
+            }
+            break;
+        }
+        case OBJ_CLASS: {
+            const ObjClass *klass = (const ObjClass *) o;
+            for (int i = 0; i < arr_count(klass->methods); ++i) {
+                gc_mark_value(h, klass->methods[i]);
+            }
+            break;
+        }
+        case OBJ_FUNCTION: break;
+        case OBJ_INSTANCE: {
+            ObjInstance *instance = (ObjInstance *) o;
+            gc_mark_obj(h, &instance->klass->obj);
+            for (int i = 0; i < instance->shape->count; ++i) {
+                gc_mark_value(h, instance->fields[i]);
+            }
+            break;
+        }
+    }
+}
+
+static void gc_free_obj(Obj *o)
+{
+    switch ((ObjType) o->type) {
+        case OBJ_STRING: {
+            ObjString *s = (ObjString *) o;
+            if (s->chars != s->flat) { // a flattened rope's
+                free((char *) s->chars);
+            }
+            break;
+        }
+        case OBJ_CLASS:
+            shape_free((ObjClass *) o);
+            arr_free(((ObjClass *) o)->methods);
+            break;
+        case OBJ_INSTANCE: free(((ObjInstance *) o)->fields); break;
+        case OBJ_FUNCTION: break;
+    }
+    free(o);
+}
+
+static void gc_sweep(Heap *h)
+{
+    bool freed_shapes = false;
+    for (Obj **link = &h->objects, *o; (o = *link); ) {
+        if (o->marked) {
+            o->marked = false;
+            link = &o->next;
+            continue;
+        }
+        *link = o->next;
+        const size_t size = gc_obj_size(o);
+        h->bytes_allocated -= size;
+        h->stats.bytes_freed += size;
+        h->stats.objects_freed++;
+        freed_shapes |= o->type == OBJ_CLASS;
+        gc_free_obj(o);
+    }
+    if (freed_shapes && h->caches) {
+        memset(h->caches, 0, h->num_caches * sizeof(*h->caches));
+    }
+}
+
+// Add the chars of ropes flattened since the last time to the heap's account
+static void gc_count_flattened(Heap *h)
+{
+    h->bytes_allocated += value_flattened_bytes;
+    h->stats.peak_bytes = max(h->stats.peak_bytes, h->bytes_allocated);
+    value_flattened_bytes = 0;
+}
+
+void gc_collect(Heap *h)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    gc_count_flattened(h);
+
+    for (Value *v = h->stack_base; v < h->stack_top; ++v) {
+        gc_mark_value(h, *v);
+    }
+    for (int i = 0; i < arr_count(h->globals); ++i) {
+        gc_mark_value(h, h->globals[i]);
+    }
+    while (!arr_empty(h->gray)) {
+        gc_blacken(h, arr_pop(h->gray));
+    }
+    gc_sweep(h);
+    h->next_gc = max(h->bytes_allocated * GC_HEAP_GROW_FACTOR, (size_t) GC_MIN_NEXT_GC);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double pause = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    h->stats.collections++;
+    h->stats.total_pause += pause;
+    h->stats.max_pause = max(h->stats.max_pause, pause);
+}
+
+// Collect if allocating `size` more bytes is due for it
+static void gc_maybe_collect(Heap *h, const size_t size)
+{
+    gc_count_flattened(h);
+    if (h->stress || h->bytes_allocated + size > max(h->next_gc, (size_t) GC_MIN_NEXT_GC)) {
+        gc_collect(h);
+    }
+}
+
+// Returns a new object of `size` bytes; never collects
+static Obj *gc_allocate_now(Heap *h, const size_t size, const ObjType type)
+{
+    Obj *o = malloc(size);
+    if (!o) {
+        fprintf(stderr, "Out of memory (object of %zu bytes).\n", size);
+        exit(EXIT_FAILURE);
+    }
+    o->type = type;
+    o->marked = false;
+    o->next = h->objects;
+    h->objects = o;
+    h->bytes_allocated += size;
+    h->stats.peak_bytes = max(h->stats.peak_bytes, h->bytes_allocated);
+    return o;
+}
+
+// Returns a new object of `size` bytes; may collect first
+static Obj *gc_allocate(Heap *h, const size_t size, const ObjType type)
+{
+    gc_maybe_collect(h, size);
+    return gc_allocate_now(h, size, type);
+}
+
+// A flat string of `a` then `b`, which are short enough not to be ropes; never collects
+static ObjString *gc_flat_concat(Heap *h, const Value a, const Value b)
+{
+    const str sa = value_as_str(a);
+    const str sb = value_as_str(b);
+    const int len = sa.len + sb.len;
+    ObjString *s = (ObjString *) gc_allocate_now(h, sizeof(ObjString) + len + 1, OBJ_STRING);
+    s->len = len;
+    s->chars = s->flat;
+    s->left = s->right = VALUE_NIL;
+    memcpy(s->flat, sa.head, sa.len);
+    memcpy(s->flat + sa.len, sb.head, sb.len);
+    s->flat[len] = '\0';
+    return s;
+}
+
+// A rope of `left` then `right`; never collects
+static ObjString *gc_rope(Heap *h, const Value left, const Value right)
+{
+    ObjString *s = (ObjString *) gc_allocate_now(h, sizeof(ObjString), OBJ_STRING);
+    s->len = value_string_len(left) + value_string_len(right);
+    s->chars = NULL;
+    s->left = left;
+    s->right = right;
+    return s;
+}
+
+//
+// The string `a` followed by string `b`, which must be rooted; may collect
+// first. Up to GC_FLAT_MAX chars it is flat, else a rope of the two, made
+// without looking at their chars, so building a string by appending in a
+// loop takes time linear in its length.
+//
+Value gc_concat(Heap *h, const Value a, const Value b)
+{
+    const int len = value_string_len(a) + value_string_len(b);
+    if (len <= GC_FLAT_MAX) {
+        gc_maybe_collect(h, sizeof(ObjString) + len + 1);
+        return value_obj(&gc_flat_concat(h, a, b)->obj);
+    }
+    gc_maybe_collect(h, sizeof(ObjString));
+    return value_obj(&gc_rope(h, a, b)->obj);
+}
+
+// A new class named `name`; may collect first
+Value gc_new_class(Heap *h, const Intern name)
+{
+    ObjClass *klass = (ObjClass *) gc_allocate(h, sizeof(ObjClass), OBJ_CLASS);
+    klass->name = name;
+    klass->methods = NULL;
+    shape_init(klass);
+    return value_obj(&klass->obj);
+}
+
+// A new instance of `klass`, which must be rooted, with no fields; may collect first
+Value gc_new_instance(Heap *h, ObjClass *klass)
+{
+    ObjInstance *o = (ObjInstance *) gc_allocate(h, sizeof(ObjInstance), OBJ_INSTANCE);
+    *o = (ObjInstance) {o->obj, klass, klass->shape, NULL, 0};
+    return value_obj(&o->obj);
+}
+
+// A new function; may collect first
+Value gc_new_function(Heap *h, const Intern name, const int arity, const int entry, const int stack)
+{
+    ObjFunction *fn = (ObjFunction *) gc_allocate(h, sizeof(ObjFunction), OBJ_FUNCTION);
+    *fn = (ObjFunction) {fn->obj, name, arity, entry, stack};
+    return value_obj(&fn->obj);
+}
+
+// Make room for `count` fields in `o`. This never collects, so callers
+// need not root anything
+void gc_reserve_fields(Heap *h, ObjInstance *o, const int count)
+{
+    if (count <= o->capacity) {
+        return;
+    }
+    const int capacity = max(max(2 * o->capacity, count), 4);
+    o->fields = realloc(o->fields, capacity * sizeof(Value));
+    h->bytes_allocated += (capacity - o->capacity) * sizeof(Value);
+    h->stats.peak_bytes = max(h->stats.peak_bytes, h->bytes_allocated);
+    o->capacity = capacity;
+}
+
+// Free every object
+void gc_free(Heap *h)
+{
+    for (Obj *o = h->objects, *next; o; o = next) {
+        next = o->next;
+        gc_free_obj(o);
+    }
+    arr_free(h->globals);
+    arr_free(h->gray);
+    value_flattened_bytes = 0;
+    const bool stress = h->stress;
+    memset(h, 0, sizeof(*h));
+    h->stress = stress;
+}
+
+void gc_stats_pp(const Heap *h)
+{
+    const GcStats *s = &h->stats;
+    fprintf(stderr, "gc: %d collections, %.3f ms paused (max %.3f ms), "
+            "freed %zu bytes in %zu objects, peak %zu bytes, live %zu bytes\n",
+            s->collections, s->total_pause * 1e3, s->max_pause * 1e3,
+            s->bytes_freed, s->objects_freed, s->peak_bytes, h->bytes_allocated);
+}
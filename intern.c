@@ -0,0 +1,159 @@
+#define INTERN_C
+
+#ifndef ARENA_C
+#include "arena.c"
+#endif
+#ifndef COMMON_H
+#include "common.h"
+#endif
+
+#include <pthread.h>
+
+#define INTERN_SHARD_BITS 4
+#define INTERN_SHARDS (1 << INTERN_SHARD_BITS)
+#define INTERN_PAGE_BITS 10 // page k holds 2^(INTERN_PAGE_BITS + k) entries
+#define INTERN_MAX_PAGES (32 - INTERN_SHARD_BITS - INTERN_PAGE_BITS)
+
+//
+// Process-wide string interning table.
+//
+// Every distinct string is stored once, NUL-terminated, with its hash, and
+// is named by a 32-bit handle: two strings are equal exactly when their
+// handles are, and their hash is a lookup away.
+//
+// The table is split into shards by hash, each with its own lock, index and
+// storage, so threads interning at the same time (e.g. under --check) rarely
+// wait on each other. A handle is the string's index within its shard and the
+// shard number in the low bits. Entries live in pages that double in size and
+// never move, so `intern_get` needs no lock.
+//
+typedef uint32_t Intern;
+
+typedef struct {
+    const char *chars; // NUL-terminated
+    int len;
+    uint32_t hash;
+} InternEntry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    InternEntry *pages[INTERN_MAX_PAGES];
+    uint32_t count;
+    uint32_t *index;   // open addressing; handle + 1, or 0 if empty
+    uint32_t index_cap; // a power of two
+    Arena chars;
+} InternShard;
+
+static InternShard intern_shards[INTERN_SHARDS] = {
+#define INTERN_SHARD_INIT(i) [i] = {.lock = PTHREAD_MUTEX_INITIALIZER},
+    INTERN_SHARD_INIT(0)  INTERN_SHARD_INIT(1)  INTERN_SHARD_INIT(2)  INTERN_SHARD_INIT(3)
+    INTERN_SHARD_INIT(4)  INTERN_SHARD_INIT(5)  INTERN_SHARD_INIT(6)  INTERN_SHARD_INIT(7)
+    INTERN_SHARD_INIT(8)  INTERN_SHARD_INIT(9)  INTERN_SHARD_INIT(10) INTERN_SHARD_INIT(11)
+    INTERN_SHARD_INIT(12) INTERN_SHARD_INIT(13) INTERN_SHARD_INIT(14) INTERN_SHARD_INIT(15)
+#undef INTERN_SHARD_INIT
+};
+
+_Static_assert(INTERN_SHARDS == 16, "intern_shards initializes 16 locks");
+
+// FNV-1a
+uint32_t intern_hash_chars(const char *chars, const int len)
+{
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < len; ++i) {
+        h = (h ^ (unsigned char) chars[i]) * 16777619u;
+    }
+    return h;
+}
+
+// The entry for index `i` of a shard: page k starts at index 2^PAGE_BITS * (2^k - 1)
+static InternEntry *intern_entry(InternShard *shard, const uint32_t i)
+{
+    const uint32_t m = (i >> INTERN_PAGE_BITS) + 1;
+    const int k = 31 - __builtin_clz(m);
+    return &shard->pages[k][i - (((1u << k) - 1) << INTERN_PAGE_BITS)];
+}
+
+static void intern_grow_index(InternShard *shard)
+{
+    const uint32_t cap = shard->index_cap ? 2 * shard->index_cap : 1024;
+    uint32_t *index = calloc(cap, sizeof(*index));
+    for (uint32_t i = 0; i < shard->count; ++i) {
+        uint32_t slot = intern_entry(shard, i)->hash >> INTERN_SHARD_BITS;
+        while (index[slot & (cap - 1)]) slot++;
+        index[slot & (cap - 1)] = i + 1;
+    }
+    free(shard->index);
+    shard->index = index;
+    shard->index_cap = cap;
+}
+
+// Returns the handle of the string [chars, chars+len), adding it if it is new
+Intern intern(const char *chars, const int len)
+{
+    const uint32_t hash = intern_hash_chars(chars, len);
+    const uint32_t s = hash & (INTERN_SHARDS - 1);
+    InternShard *shard = &intern_shards[s];
+
+    pthread_mutex_lock(&shard->lock);
+    if (2 * (shard->count + 1) > shard->index_cap) {
+        intern_grow_index(shard);
+    }
+    const uint32_t mask = shard->index_cap - 1;
+    uint32_t slot = hash >> INTERN_SHARD_BITS;
+    uint32_t i;
+    for (; (i = shard->index[slot & mask]); slot++) {
+        const InternEntry *e = intern_entry(shard, i - 1);
+        if (e->hash == hash && e->len == len && memcmp(e->chars, chars, len) == 0) {
+            pthread_mutex_unlock(&shard->lock);
+            return (i - 1) << INTERN_SHARD_BITS | s;
+        }
+    }
+
+    i = shard->count++;
+    const uint32_t m = (i >> INTERN_PAGE_BITS) + 1;
+    const int k = 31 - __builtin_clz(m);
+    if (!shard->pages[k]) {
+        shard->pages[k] = malloc(sizeof(InternEntry) << (INTERN_PAGE_BITS + k));
+    }
+    char *copy = arena_alloc_bytes(&shard->chars, len + 1);
+    memcpy(copy, chars, len);
+    copy[len] = '\0';
+    *intern_entry(shard, i) = (InternEntry) {copy, len, hash};
+    shard->index[slot & mask] = i + 1;
+    pthread_mutex_unlock(&shard->lock);
+    return i << INTERN_SHARD_BITS | s;
+}
+
+Intern intern_str(const str s)
+{
+    return intern(s.head, s.len);
+}
+
+static const InternEntry *intern_lookup(const Intern h)
+{
+    return intern_entry(&intern_shards[h & (INTERN_SHARDS - 1)], h >> INTERN_SHARD_BITS);
+}
+
+// The interned string; NUL-terminated
+str intern_get(const Intern h)
+{
+    const InternEntry *e = intern_lookup(h);
+    return str_new_s(e->chars, e->len);
+}
+
+uint32_t intern_hash(const Intern h)
+{
+    return intern_lookup(h)->hash;
+}
+
+// Number of distinct strings interned
+int intern_count(void)
+{
+    int n = 0;
+    for (int s = 0; s < INTERN_SHARDS; ++s) {
+        pthread_mutex_lock(&intern_shards[s].lock);
+        n += intern_shards[s].count;
+        pthread_mutex_unlock(&intern_shards[s].lock);
+    }
+    return n;
+}
@@ -0,0 +1,407 @@
+#define INTERP_C
+
+#ifndef COMMON_H
+#include "common.h"
+#endif
+#ifndef ERROR_C
+#include "error.c"
+#endif
+#ifndef EXPR_C
+#include "expr.c"
+#endif
+#ifndef GC_C
+#include "gc.c"
+#endif
+#ifndef INTERN_C
+#include "intern.c"
+#endif
+#ifndef JIT_C
+#include "jit.c"
+#endif
+#ifndef PROPERTY_C
+#include "property.c"
+#endif
+#ifndef TOKEN_C
+#include "token.c"
+#endif
+#ifndef VALUE_C
+#include "value.c"
+#endif
+
+//
+// Evaluator for the flat AST.
+//
+// Nodes are in post-order, so evaluating them in order is running a stack
+// machine: a literal pushes its value and an operator pops its operands and
+// pushes its result. `and` and `or` short-circuit: after the last node of
+// their lhs, either the lhs is the result and the walk skips to the
+// operator's node, or it is popped and the rhs's value will be the result.
+// Loops jump between their marker nodes (see expr.c).
+//
+// Between statements the stack holds just the locals in scope, in the slots
+// the resolver gave them, so a local is the stack at its slot from the base
+// of the running frame. Each property site has its inline cache in
+// `caches`, which starts empty; a REPL line's sites are added to those of
+// the lines before it, whose caches are kept.
+//
+// A call pushes a frame that says where to return to, and the callee's
+// frame starts at the function itself, with its arguments after it, so they
+// become parameters without moving. A method call's first argument is its
+// receiver, which is the method's `this`. The stack starts out as deep as
+// the top level needs and the frames as INTERP_MIN_FRAMES, and each doubles
+// when a call needs more, up to INTERP_MAX_STACK and INTERP_MAX_FRAMES. They
+// are kept across runs, so a call rarely allocates, and deep recursion is an
+// error, not a crash. A frame keeps its caller's base as an offset, which
+// stays valid when the stack moves. A tail
+// call moves the function and its arguments down over the caller's frame
+// and returns where the caller would have, so a chain of them runs in one
+// frame.
+//
+// With a Jit, subtrees it compiled are run natively instead of walked.
+//
+#define INTERP_MIN_FRAMES 64
+#define INTERP_MAX_FRAMES (1 << 16)
+#define INTERP_MAX_STACK  (1 << 22) // values, beyond what the program's top level needs
+
+typedef struct {
+    int ret;  // the call's node
+    int base; // the caller's, from the bottom of the stack
+} InterpFrame;
+
+typedef struct {
+    const TokenStream *tokens;
+    LineIndex *lines;     // for the locations of errors
+    const char *filename;
+    int start;            // the node to start from; the REPL's lines before it have run
+    Value *stack;         // arr
+    InterpFrame *frames;  // arr
+    int *logical_lhs;     // arr; for each node, the logical node it is the lhs of, or -1
+    PropertyCache *caches; // arr; by property site
+    const Jit *jit;       // compiled from the same Ast, or NULL
+    Heap *heap;           // for strings made at runtime; its stack roots are `stack`
+} Interpreter;
+
+static bool interp_error(const Interpreter *restrict in, const int t, const char *restrict message)
+{
+    runtime_error(token_stream_loc(in->tokens, in->lines, in->filename, t), message);
+    return false;
+}
+
+// A global read or assigned before it was defined, or a missing property
+// (`what`), named by token `t`
+static bool interp_undefined(const Interpreter *restrict in, const int t, const char *restrict what)
+{
+    const str name = token_stream_lexeme(in->tokens, t);
+    char message[sizeof("Undefined  ''.") + strlen(what) + name.len];
+    snprintf(message, sizeof(message), "Undefined %s '%.*s'.", what, name.len, name.head);
+    return interp_error(in, t, message);
+}
+
+// A call with the wrong number of arguments, at token `t`
+static bool interp_arity(const Interpreter *restrict in, const int t, const int expected, const int got)
+{
+    char message[64];
+    snprintf(message, sizeof(message), "Expected %d arguments but got %d.", expected, got);
+    return interp_error(in, t, message);
+}
+
+// Double `in->stack`, to at least `need` and at most `limit` values, keeping
+// what is on it; returns where it now is
+static Value *interp_grow_stack(Interpreter *in, const int need, const int limit)
+{
+    const int count = arr_count(in->stack);
+    (void) arr_add(in->stack, min(max(2 * count, need), limit) - count);
+    return in->stack;
+}
+
+// Runs the resolved `ast`, with its result (or VALUE_UNDEFINED if it has none)
+// in `result`; returns false (after reporting it) on an error
+bool interpret(Interpreter *restrict in, const Ast *restrict ast, Value *restrict result)
+{
+    const uint8_t *types = ast->types;
+    const uint32_t *args = ast->args;
+    const uint8_t *token_types = in->tokens->types;
+    arr_reset(in->stack);
+    const int top = ast->count + 1; // the top level needs one per node at most
+    Value *stack = arr_add(in->stack, top);
+    const Value *stack_end = stack + top;
+    Value *sp = stack;
+    Value *base = stack;
+    arr_reset(in->frames);
+    InterpFrame *frames = arr_add(in->frames, INTERP_MIN_FRAMES);
+    int num_frames = 0;
+    Value *globals = NULL;
+    // The nodes before `start` keep their caches and `logical_lhs`
+    const int sites = arr_count(ast->names);
+    if (!in->start) {
+        arr_reset(in->caches);
+    }
+    while (arr_count(in->caches) > sites) (void) arr_pop(in->caches);
+    const int cached = arr_count(in->caches);
+    memset(arr_add(in->caches, sites - cached), 0, (sites - cached) * sizeof(*in->caches));
+    PropertyCache *caches = in->caches;
+    if (in->heap) {
+        in->heap->stack_base = in->heap->stack_top = stack;
+        in->heap->caches = caches;
+        in->heap->num_caches = sites;
+        globals = in->heap->globals;
+    }
+    *result = VALUE_UNDEFINED;
+    const int from = min(arr_count(in->logical_lhs), in->start);
+    while (arr_count(in->logical_lhs) > from) (void) arr_pop(in->logical_lhs);
+    memset(arr_add(in->logical_lhs, ast->count - from), -1, (ast->count - from) * sizeof(int));
+    int *logical_lhs = in->logical_lhs;
+    for (int i = from; i < ast->count; ++i) {
+        if (types[i] == EXPR_LOGICAL) {
+            logical_lhs[args[i]] = i;
+        } else if (types[i] == EXPR_NONE) { // even where it would be skipped
+            error(token_stream_loc(in->tokens, in->lines, in->filename, ast->tokens[i]), "Expect expression.");
+            return false;
+        }
+    }
+
+    const JitRegion *region = in->jit ? jit_region_from(in->jit, in->start) : NULL;
+    const JitRegion *regions_end = in->jit ? in->jit->regions + arr_count(in->jit->regions) : NULL;
+    for (int i = in->start; i < ast->count; ++i) {
+        while (region < regions_end && region->start < i) region++; // skipped
+        if (region < regions_end && region->start == i) {
+            const double d = region->fn();
+            *sp++ = region->is_bool ? value_bool(d != 0) : value_number(d);
+            i = region->root;
+        } else {
+            switch ((ExprType) types[i]) {
+                case EXPR_NIL:    *sp++ = VALUE_NIL; break;
+                case EXPR_BOOL:   *sp++ = value_bool(args[i]); break;
+                case EXPR_NUMBER: *sp++ = value_number(ast->numbers[args[i]]); break;
+                case EXPR_STRING: *sp++ = value_string(args[i]); break;
+                case EXPR_GROUPING: break;
+                case EXPR_LOGICAL:  break; // the rhs was not skipped, so it is the result
+
+                case EXPR_GET_LOCAL: *sp++ = base[args[i]]; break;
+                case EXPR_SET_LOCAL: base[args[i]] = sp[-1]; break;
+                case EXPR_GET_GLOBAL:
+                    if (globals[args[i]] == VALUE_UNDEFINED) {
+                        return interp_undefined(in, ast->tokens[i], "variable");
+                    }
+                    *sp++ = globals[args[i]];
+                    break;
+                case EXPR_SET_GLOBAL:
+                    if (globals[args[i]] == VALUE_UNDEFINED) {
+                        return interp_undefined(in, ast->tokens[i], "variable");
+                    }
+                    globals[args[i]] = sp[-1];
+                    break;
+
+                case EXPR_CLASS: {
+                    in->heap->stack_top = sp;
+                    const Value klass = gc_new_class(in->heap, args[i]);
+                    *sp++ = klass;
+                    break;
+                }
+                case EXPR_CALL:
+                case EXPR_TAIL_CALL:
+                case EXPR_INVOKE: {
+                    int count = args[i];
+                    bool method = false; // the receiver is the first argument
+                    if (types[i] == EXPR_INVOKE) {
+                        Value *receiver = sp - count - 1;
+                        if (*receiver == VALUE_NIL) { // a field's value, called like any other
+                            memmove(receiver, receiver + 1, count * sizeof(Value));
+                            sp--;
+                        } else {
+                            count++;
+                            method = true;
+                        }
+                    }
+                    Value *callee = sp - count - 1;
+                    if (value_is_obj_type(*callee, OBJ_FUNCTION)) {
+                        const ObjFunction *fn = (const ObjFunction *) value_as_obj(*callee);
+                        if (count != fn->arity) {
+                            return interp_arity(in, ast->tokens[i], fn->arity - method, count - method);
+                        }
+                        if (types[i] == EXPR_TAIL_CALL) {
+                            memmove(base, callee, (count + 1) * sizeof(Value));
+                        } else {
+                            if (num_frames == arr_count(in->frames)) {
+                                if (num_frames == INTERP_MAX_FRAMES) {
+                                    return interp_error(in, ast->tokens[i], "Stack overflow.");
+                                }
+                                (void) arr_add(in->frames, min(num_frames, INTERP_MAX_FRAMES - num_frames));
+                                frames = in->frames;
+                            }
+                            frames[num_frames++] = (InterpFrame) {i, (int) (base - stack)};
+                            base = callee;
+                        }
+                        if (base + fn->stack > stack_end) {
+                            const int at = (int) (base - stack);
+                            if (at + fn->stack > top + INTERP_MAX_STACK) {
+                                return interp_error(in, ast->tokens[i], "Stack overflow.");
+                            }
+                            stack = interp_grow_stack(in, at + fn->stack, top + INTERP_MAX_STACK);
+                            stack_end = stack + arr_count(in->stack);
+                            base = stack + at;
+                            if (in->heap) {
+                                in->heap->stack_base = stack;
+                            }
+                        }
+                        sp = base + 1 + count;
+                        i = fn->entry - 1;
+                        if (in->jit) {
+                            region = jit_region_from(in->jit, i + 1);
+                        }
+                        continue;
+                    }
+                    if (!value_is_obj_type(*callee, OBJ_CLASS)) {
+                        return interp_error(in, ast->tokens[i], "Can only call functions and classes.");
+                    }
+                    if (count != 0) {
+                        return interp_arity(in, ast->tokens[i], 0, count);
+                    }
+                    in->heap->stack_top = sp;
+                    *callee = gc_new_instance(in->heap, (ObjClass *) value_as_obj(*callee));
+                    sp = callee + 1;
+                    break;
+                }
+                case EXPR_GET_METHOD:
+                    if (!value_is_obj_type(sp[-1], OBJ_INSTANCE)) {
+                        return interp_error(in, ast->tokens[i], "Only instances have properties.");
+                    }
+                    if (!property_method(&caches[args[i]], sp - 1, ast->names[args[i]])) {
+                        return interp_undefined(in, ast->tokens[i], "property");
+                    }
+                    sp++;
+                    break;
+                case EXPR_GET_PROPERTY:
+                    if (!value_is_obj_type(sp[-1], OBJ_INSTANCE)) {
+                        return interp_error(in, ast->tokens[i], "Only instances have properties.");
+                    }
+                    if (!property_get(&caches[args[i]], (const ObjInstance *) value_as_obj(sp[-1]),
+                            ast->names[args[i]], &sp[-1])) {
+                        return interp_undefined(in, ast->tokens[i], "property");
+                    }
+                    break;
+                case EXPR_SET_PROPERTY: {
+                    const Value v = *--sp;
+                    if (!value_is_obj_type(sp[-1], OBJ_INSTANCE)) {
+                        return interp_error(in, ast->tokens[i], "Only instances have fields.");
+                    }
+                    property_set(in->heap, &caches[args[i]], (ObjInstance *) value_as_obj(sp[-1]),
+                            ast->names[args[i]], v);
+                    sp[-1] = v;
+                    break;
+                }
+
+                case STMT_DEFINE_LOCAL: break; // the value is in its slot
+                case STMT_DEFINE_GLOBAL: globals[args[i]] = *--sp; break;
+                case STMT_EXPRESSION: sp--; break;
+                case STMT_PRINT: value_println(*--sp); break;
+                case STMT_RESULT: *result = *--sp; break;
+                case STMT_BLOCK_BEGIN: break;
+                case STMT_BLOCK_END: sp -= args[i]; break;
+                case STMT_WHILE_TEST:
+                    if (!value_is_truthy(*--sp)) {
+                        i = args[i]; // past the loop
+                    }
+                    break;
+                case STMT_WHILE:
+                    i = args[i] - 1; // the condition
+                    if (in->jit) {
+                        region = jit_region_from(in->jit, i + 1);
+                    }
+                    continue;
+
+                case STMT_FUNCTION: {
+                    const int end = args[i];
+                    const str name = token_stream_lexeme(in->tokens, ast->tokens[i]);
+                    in->heap->stack_top = sp;
+                    const Value fn = gc_new_function(in->heap, intern_str(name), args[end], i + 1 + args[end], end - i);
+                    *sp++ = fn;
+                    i = end; // past the body, to define it
+                    break;
+                }
+                case STMT_PARAM: break; // the argument is in its slot
+                case STMT_METHOD: // after its class
+                    property_add_method((ObjClass *) value_as_obj(sp[-2]), sp[-1]);
+                    sp--;
+                    break;
+                case EXPR_FUNCTION: // the end of the body
+                    *sp++ = VALUE_NIL;
+                    // fallthrough
+                case STMT_RETURN: {
+                    const InterpFrame frame = frames[--num_frames];
+                    base[0] = sp[-1]; // over the function
+                    sp = base + 1;
+                    base = stack + frame.base;
+                    i = frame.ret; // the call, whose value it is
+                    if (in->jit) {
+                        region = jit_region_from(in->jit, i + 1);
+                    }
+                    break;
+                }
+
+                case EXPR_UNARY: {
+                    const Value v = sp[-1];
+                    const TokenType op = token_types[ast->tokens[i]];
+                    if (op == TOKEN_BANG) {
+                        sp[-1] = value_bool(!value_is_truthy(v));
+                        break;
+                    }
+                    if (!value_is_number(v)) {
+                        return interp_error(in, ast->tokens[i], "Operand must be a number.");
+                    }
+                    if (op == TOKEN_MINUS) {
+                        sp[-1] = value_number(-value_as_number(v));
+                    }
+                    break;
+                }
+
+                case EXPR_BINARY: {
+                    const Value b = *--sp;
+                    const Value a = sp[-1];
+                    const TokenType op = token_types[ast->tokens[i]];
+                    if (op == TOKEN_EQUAL_EQUAL || op == TOKEN_BANG_EQUAL) {
+                        sp[-1] = value_bool(value_equal(a, b) == (op == TOKEN_EQUAL_EQUAL));
+                        break;
+                    }
+                    if (!value_is_number(a) || !value_is_number(b)) {
+                        if (op == TOKEN_PLUS && value_is_string(a) && value_is_string(b)) {
+                            in->heap->stack_top = sp + 1; // `b` is still there
+                            sp[-1] = gc_concat(in->heap, a, b);
+                            break;
+                        }
+                        return interp_error(in, ast->tokens[i], op == TOKEN_PLUS
+                                ? "Operands must be two numbers or two strings."
+                                : "Operands must be numbers.");
+                    }
+                    const double x = value_as_number(a);
+                    const double y = value_as_number(b);
+                    switch (op) {
+                        case TOKEN_PLUS:          sp[-1] = value_number(x + y); break;
+                        case TOKEN_MINUS:         sp[-1] = value_number(x - y); break;
+                        case TOKEN_STAR:          sp[-1] = value_number(x * y); break;
+                        case TOKEN_SLASH:         sp[-1] = value_number(x / y); break;
+                        case TOKEN_GREATER:       sp[-1] = value_bool(x > y); break;
+                        case TOKEN_GREATER_EQUAL: sp[-1] = value_bool(x >= y); break;
+                        case TOKEN_LESS:          sp[-1] = value_bool(x < y); break;
+                        case TOKEN_LESS_EQUAL:    sp[-1] = value_bool(x <= y); break;
+                        default: break;
+                    }
+                    break;
+                }
+
+                default: break; // EXPR_NONE; unresolved names
+            }
+        }
+
+        // The result of a logical operator can be the lhs of another
+        for (int logical; (logical = logical_lhs[i]) != -1; ) {
+            const bool and = token_types[ast->tokens[logical]] == TOKEN_AND;
+            if (value_is_truthy(sp[-1]) == and) {
+                sp--;
+                break;
+            }
+            i = logical; // keep the lhs
+        }
+    }
+    return true;
+}
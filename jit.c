@@ -0,0 +1,429 @@
+#define JIT_C
+
+#ifndef COMMON_H
+#include "common.h"
+#endif
+#ifndef EXPR_C
+#include "expr.c"
+#endif
+#ifndef TOKEN_C
+#include "token.c"
+#endif
+
+// Native code is only generated on Linux x86-64; elsewhere nothing is
+// compiled and the interpreter runs everything
+#ifndef JIT_ENABLED
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_ENABLED 1
+#else
+#define JIT_ENABLED 0
+#endif
+#endif
+
+// Deepest operand stack a compiled subtree may use: one xmm register per
+// operand; deeper subtrees are left to the interpreter
+#define JIT_MAX_DEPTH 16
+
+// Most bytes of code one node compiles to
+#define JIT_MAX_NODE_BYTES 32
+
+//
+// Template JIT for numeric subtrees.
+//
+// A subtree whose leaves are all numbers and whose operators are `+ - * /`,
+// comparisons, `==`, `!=`, unary `-`, `+` and `!` cannot fail, and its value
+// is known to be a number or a bool. Each maximal such subtree with at least
+// one operator becomes a native function returning a double (bools as 0 or
+// 1), with every node stamped out as a fixed SSE2 sequence. Operand `k` of
+// the stack lives in xmm<k>, so the result ends up in xmm0 where the ABI
+// wants it, and number literals are loaded RIP-relative from a pool at the
+// start of the mapping. The interpreter calls the function in place of
+// walking the subtree.
+//
+// Code is written to a private mapping that is made executable (and no
+// longer writable) once every region is compiled. From a `start` node, only
+// the nodes after it are compiled (a REPL line), into a mapping of their
+// own; the regions before it keep theirs, which functions declared on
+// earlier lines still run.
+//
+typedef double (*JitFn)(void);
+
+typedef struct {
+    int start;    // first node of the subtree
+    int root;     // last node
+    bool is_bool; // the result is a bool, else a number
+    JitFn fn;
+} JitRegion;
+
+typedef struct {
+    uint8_t *code;
+    size_t size;
+} JitMapping;
+
+typedef struct {
+    int start;          // the node to start from; the regions before it are kept
+    JitRegion *regions; // arr, by `start`
+    JitMapping *kept;   // arr; the mappings of the regions before the last `start`
+    uint8_t *code;      // mapping: the pool, then code
+    size_t code_size;   // bytes mapped
+    size_t code_used;   // bytes of code
+    size_t code_start;  // where code starts, after the pool
+    double *pool;       // masks, then number literals
+    int pool_used;
+    int nodes;          // nodes compiled
+
+    // Open-addressing index of the pool by the literals' bits, so a literal
+    // used many times takes one slot and the pool stays in cache
+    uint64_t *pool_bits; // arr
+    int *pool_slots;     // arr; 0 if empty
+
+    // Per node, for finding regions
+    uint8_t *kinds;     // arr of JitKind
+    int *starts;        // arr
+    int *depths;        // arr
+} Jit;
+
+typedef enum {
+    JIT_KIND_NONE,      // not compilable
+    JIT_KIND_NUMBER,
+    JIT_KIND_BOOL,
+} JitKind;
+
+void jit_release(Jit *j)
+{
+#if JIT_ENABLED
+    if (j->code) {
+        munmap(j->code, j->code_size);
+    }
+    for (int i = 0; i < arr_count(j->kept); ++i) {
+        munmap(j->kept[i].code, j->kept[i].size);
+    }
+#endif
+    arr_reset(j->kept);
+    j->code = NULL;
+    j->code_size = j->code_start = j->code_used = 0;
+    j->pool = NULL;
+    j->pool_used = 0;
+    j->nodes = 0;
+    arr_reset(j->regions);
+}
+
+void jit_free(Jit *j)
+{
+    jit_release(j);
+    arr_free(j->regions);
+    arr_free(j->kept);
+    arr_free(j->kinds);
+    arr_free(j->starts);
+    arr_free(j->depths);
+    arr_free(j->pool_bits);
+    arr_free(j->pool_slots);
+    memset(j, 0, sizeof(*j));
+}
+
+// The first region that starts at or after node `i`
+const JitRegion *jit_region_from(const Jit *j, const int i)
+{
+    int low = 0;
+    int high = arr_count(j->regions);
+    while (low < high) {
+        const int mid = (low + high) / 2;
+        if (j->regions[mid].start < i) low = mid + 1;
+        else high = mid;
+    }
+    return j->regions + low;
+}
+
+static bool jit_is_arithmetic(const TokenType op)
+{
+    return op == TOKEN_PLUS || op == TOKEN_MINUS || op == TOKEN_STAR || op == TOKEN_SLASH;
+}
+
+// The kind of every node from `from` on, and where its subtree starts
+static void jit_classify(Jit *restrict j, const Ast *restrict ast, const uint8_t *restrict token_types,
+        const int from)
+{
+    const int n = ast->count;
+    while (arr_count(j->kinds) > from) (void) arr_pop(j->kinds);
+    while (arr_count(j->starts) > from) (void) arr_pop(j->starts);
+    while (arr_count(j->depths) > from) (void) arr_pop(j->depths);
+    (void) arr_add(j->kinds, n - from);
+    (void) arr_add(j->starts, n - from);
+    (void) arr_add(j->depths, n - from);
+    uint8_t *kinds = j->kinds;
+    int *starts = j->starts;
+    int *depths = j->depths;
+    for (int i = from; i < n; ++i) {
+        const TokenType op = token_types[ast->tokens[i]];
+        kinds[i] = JIT_KIND_NONE;
+        starts[i] = i;
+        depths[i] = 1;
+        switch ((ExprType) ast->types[i]) {
+            case EXPR_NUMBER:
+                kinds[i] = JIT_KIND_NUMBER;
+                break;
+            case EXPR_GROUPING:
+                kinds[i] = kinds[i-1];
+                starts[i] = starts[i-1];
+                depths[i] = depths[i-1];
+                break;
+            case EXPR_UNARY:
+                starts[i] = starts[i-1];
+                depths[i] = depths[i-1];
+                if (op == TOKEN_BANG) {
+                    kinds[i] = kinds[i-1] ? JIT_KIND_BOOL : JIT_KIND_NONE;
+                } else if (kinds[i-1] == JIT_KIND_NUMBER) {
+                    kinds[i] = JIT_KIND_NUMBER;
+                }
+                break;
+            case EXPR_BINARY: {
+                const int lhs = ast->args[i];
+                starts[i] = starts[lhs];
+                depths[i] = max(depths[lhs], depths[i-1] + 1);
+                if (kinds[lhs] == JIT_KIND_NUMBER && kinds[i-1] == JIT_KIND_NUMBER) {
+                    kinds[i] = jit_is_arithmetic(op) ? JIT_KIND_NUMBER : JIT_KIND_BOOL;
+                }
+                break;
+            }
+            case EXPR_LOGICAL:
+                starts[i] = starts[ast->args[i]];
+                break;
+            default:
+                break;
+        }
+        if (depths[i] > JIT_MAX_DEPTH) {
+            kinds[i] = JIT_KIND_NONE;
+        }
+    }
+}
+
+#if JIT_ENABLED
+
+// Pool slots of the 16-byte masks `xorpd` takes (aligned, as SSE requires)
+#define JIT_POOL_SIGN 0 // flips the sign of a double
+#define JIT_POOL_ONE  2 // flips 0.0 and 1.0
+#define JIT_POOL_LITERALS 4
+
+static inline void emit(Jit *j, const uint8_t *bytes, const int n)
+{
+    memcpy(j->code + j->code_start + j->code_used, bytes, n);
+    j->code_used += n;
+}
+
+#define EMIT(j, ...) emit(j, (const uint8_t[]) {__VA_ARGS__}, sizeof((const uint8_t[]) {__VA_ARGS__}))
+
+// `prefix` [REX] 0F `op` with xmm<r> and xmm<m> (or a general register)
+static void emit_sse_rr(Jit *j, const uint8_t prefix, const uint8_t op, const int r, const int m)
+{
+    const uint8_t rex = 0x40 | (r >> 3) << 2 | (m >> 3);
+    if (prefix) EMIT(j, prefix);
+    if (rex != 0x40) EMIT(j, rex);
+    EMIT(j, 0x0F, op, 0xC0 | (r & 7) << 3 | (m & 7));
+}
+
+// `prefix` [REX] 0F `op` with xmm<r> and pool slot `slot`, RIP-relative
+static void emit_sse_pool(Jit *j, const uint8_t prefix, const uint8_t op, const int r, const int slot)
+{
+    if (prefix) EMIT(j, prefix);
+    if (r >= 8) EMIT(j, 0x44);
+    EMIT(j, 0x0F, op, 0x05 | (r & 7) << 3);
+    const int32_t disp = (int32_t) ((uint8_t *) &j->pool[slot] - (j->code + j->code_start + j->code_used + 4));
+    emit(j, (const uint8_t *) &disp, 4);
+}
+
+#define SSE_MOVSD   0xF2, 0x10
+#define SSE_ADDSD   0xF2, 0x58
+#define SSE_SUBSD   0xF2, 0x5C
+#define SSE_MULSD   0xF2, 0x59
+#define SSE_DIVSD   0xF2, 0x5E
+#define SSE_CVTSI2SD 0xF2, 0x2A
+#define SSE_UCOMISD 0x66, 0x2E
+#define SSE_XORPD   0x66, 0x57
+
+static uint8_t arithmetic_opcode(const TokenType op)
+{
+    switch (op) {
+        case TOKEN_PLUS:  return 0x58; // addsd
+        case TOKEN_MINUS: return 0x5C; // subsd
+        case TOKEN_STAR:  return 0x59; // mulsd
+        default:          return 0x5E; // divsd
+    }
+}
+
+// xmm<a> = xmm<a> `op` xmm<b>, for a comparison
+static void emit_compare(Jit *j, const TokenType op, const int a, const int b)
+{
+    // ucomisd sets ZF, PF and CF for NaN operands, so `above` (CF=0, ZF=0)
+    // and `above or equal` (CF=0) are false for them, as in C
+    switch (op) {
+        case TOKEN_GREATER:       emit_sse_rr(j, SSE_UCOMISD, a, b); EMIT(j, 0x0F, 0x97, 0xC0); break; // seta al
+        case TOKEN_GREATER_EQUAL: emit_sse_rr(j, SSE_UCOMISD, a, b); EMIT(j, 0x0F, 0x93, 0xC0); break; // setae al
+        case TOKEN_LESS:          emit_sse_rr(j, SSE_UCOMISD, b, a); EMIT(j, 0x0F, 0x97, 0xC0); break;
+        case TOKEN_LESS_EQUAL:    emit_sse_rr(j, SSE_UCOMISD, b, a); EMIT(j, 0x0F, 0x93, 0xC0); break;
+        case TOKEN_EQUAL_EQUAL: // sete al; setnp cl; and al, cl
+            emit_sse_rr(j, SSE_UCOMISD, a, b);
+            EMIT(j, 0x0F, 0x94, 0xC0, 0x0F, 0x9B, 0xC1, 0x20, 0xC8);
+            break;
+        default: // !=: setne al; setp cl; or al, cl
+            emit_sse_rr(j, SSE_UCOMISD, a, b);
+            EMIT(j, 0x0F, 0x95, 0xC0, 0x0F, 0x9A, 0xC1, 0x08, 0xC8);
+            break;
+    }
+    EMIT(j, 0x0F, 0xB6, 0xC0);               // movzx eax, al
+    emit_sse_rr(j, SSE_CVTSI2SD, a, 0);      // cvtsi2sd xmm<a>, eax
+}
+
+// The pool slot holding `d`
+static int jit_literal(Jit *j, const double d)
+{
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    const int mask = arr_count(j->pool_slots) - 1;
+    int h = (int) ((bits * 0x9E3779B97F4A7C15ull) >> 40) & mask;
+    for (; j->pool_slots[h]; h = (h + 1) & mask) {
+        if (j->pool_bits[h] == bits) return j->pool_slots[h];
+    }
+    j->pool_bits[h] = bits;
+    j->pool[j->pool_used] = d;
+    return j->pool_slots[h] = j->pool_used++;
+}
+
+// Compile nodes [start, root]; returns the function
+static JitFn jit_emit_region(Jit *restrict j, const Ast *restrict ast, const uint8_t *restrict token_types,
+        const int start, const int root)
+{
+    JitFn fn;
+    const void *entry = j->code + j->code_start + j->code_used;
+    memcpy(&fn, &entry, sizeof(fn)); // ISO C has no cast from data to function pointers
+    int depth = 0; // operands on the stack, in xmm0 to xmm<depth-1>
+    for (int i = start; i <= root; ++i) {
+        const TokenType op = token_types[ast->tokens[i]];
+        switch ((ExprType) ast->types[i]) {
+            case EXPR_NUMBER: {
+                const int slot = jit_literal(j, ast->numbers[ast->args[i]]);
+                // The rhs of an arithmetic operator is used right from the pool
+                if (i < root && ast->types[i+1] == EXPR_BINARY && jit_is_arithmetic(token_types[ast->tokens[i+1]])) {
+                    emit_sse_pool(j, 0xF2, arithmetic_opcode(token_types[ast->tokens[i+1]]), depth - 1, slot);
+                    i++;
+                    break;
+                }
+                emit_sse_pool(j, SSE_MOVSD, depth++, slot);
+                break;
+            }
+            case EXPR_UNARY:
+                if (op == TOKEN_MINUS) {
+                    emit_sse_pool(j, SSE_XORPD, depth - 1, JIT_POOL_SIGN);
+                } else if (op == TOKEN_BANG && j->kinds[i-1] == JIT_KIND_BOOL) {
+                    emit_sse_pool(j, SSE_XORPD, depth - 1, JIT_POOL_ONE);
+                } else if (op == TOKEN_BANG) {
+                    emit_sse_rr(j, SSE_XORPD, depth - 1, depth - 1); // numbers are truthy
+                }
+                break;
+            case EXPR_BINARY:
+                if (jit_is_arithmetic(op)) {
+                    emit_sse_rr(j, 0xF2, arithmetic_opcode(op), depth - 2, depth - 1);
+                } else {
+                    emit_compare(j, op, depth - 2, depth - 1);
+                }
+                depth--;
+                break;
+            default: // groupings
+                break;
+        }
+    }
+    EMIT(j, 0xC3); // ret
+    return fn;
+}
+
+#endif
+
+// Keep the mapping of the regions so far for the nodes before `from`, and
+// forget the regions after it
+static void jit_keep(Jit *j, const int from)
+{
+#if JIT_ENABLED
+    if (j->code) {
+        arr_push(j->kept, ((JitMapping) {j->code, j->code_size}));
+    }
+#endif
+    j->code = NULL;
+    j->code_size = j->code_start = j->code_used = 0;
+    j->pool = NULL;
+    j->pool_used = 0;
+    while (!arr_empty(j->regions) && arr_last(j->regions).start >= from) (void) arr_pop(j->regions);
+}
+
+// Compile the numeric subtrees of `ast` from `start` on; returns the number
+// of regions. Their code stays valid until the next call from a `start` at or
+// before them, or `jit_release`.
+int jit_compile(Jit *restrict j, const Ast *restrict ast, const TokenStream *restrict tokens)
+{
+    const int from = min(j->start, arr_count(j->kinds));
+    if (from) {
+        jit_keep(j, from);
+    } else {
+        jit_release(j);
+    }
+#if JIT_ENABLED
+    const int n = ast->count;
+    jit_classify(j, ast, tokens->types, from);
+
+    // A region is a compilable node whose parent is not, going down from the
+    // root; subtrees with no operator are not worth a call
+    const int before = arr_count(j->regions);
+    int nodes = 0;
+    for (int i = n - 1; i >= from; ) {
+        const int start = j->starts[i];
+        if (j->kinds[i] && start < i && ast->types[i] != EXPR_GROUPING) {
+            arr_push(j->regions, ((JitRegion) {start, i, j->kinds[i] == JIT_KIND_BOOL, NULL}));
+            nodes += i - start + 1;
+            i = start - 1;
+        } else {
+            i--;
+        }
+    }
+    if (!nodes) {
+        return arr_count(j->regions);
+    }
+
+    // Found from the root down, so latest first
+    JitRegion *regions = j->regions + before;
+    const int count = arr_count(j->regions) - before;
+    for (int r = 0; r < count / 2; ++r) {
+        const JitRegion t = regions[r];
+        regions[r] = regions[count - 1 - r];
+        regions[count - 1 - r] = t;
+    }
+
+    const size_t pool_size = (JIT_POOL_LITERALS + nodes) * sizeof(double);
+    j->code_size = pool_size + (size_t) nodes * JIT_MAX_NODE_BYTES + count;
+    j->code = mmap(NULL, j->code_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (j->code == MAP_FAILED) {
+        j->code = NULL;
+        while (arr_count(j->regions) > before) (void) arr_pop(j->regions);
+        return before;
+    }
+    j->pool = (double *) j->code;
+    j->pool[JIT_POOL_SIGN] = -0.0;
+    j->pool[JIT_POOL_ONE] = 1.0; // the high halves of the masks are zero
+    j->pool_used = JIT_POOL_LITERALS;
+    j->code_start = pool_size;
+    j->code_used = 0;
+
+    int index_size = 16;
+    while (index_size < 2 * nodes) index_size *= 2;
+    arr_reset(j->pool_bits);
+    arr_reset(j->pool_slots);
+    (void) arr_add(j->pool_bits, index_size);
+    memset(arr_add(j->pool_slots, index_size), 0, index_size * sizeof(*j->pool_slots));
+    for (int r = 0; r < count; ++r) {
+        regions[r].fn = jit_emit_region(j, ast, tokens->types, regions[r].start, regions[r].root);
+    }
+    if (mprotect(j->code, j->code_size, PROT_READ | PROT_EXEC) != 0) {
+        jit_release(j);
+        return 0;
+    }
+    j->nodes += nodes;
+#endif
+    return arr_count(j->regions);
+}
@@ -13,90 +13,335 @@
 #ifndef SCANNER_C
 #include "scanner.c"
 #endif
+#ifndef STREAM_C
+#include "stream.c"
+#endif
+#ifndef PSCAN_C
+#include "pscan.c"
+#endif
+#ifndef CHECK_C
+#include "check.c"
+#endif
+#ifndef RESOLVER_C
+#include "resolver.c"
+#endif
+#ifndef INTERP_C
+#include "interp.c"
+#endif
+#ifndef COMPILER_C
+#include "compiler.c"
+#endif
+#ifndef VM_C
+#include "vm.c"
+#endif
 
-#define BUFFER_MAX_LEN 65536
-#define BUFFER_MAX_LINES 4096
-#define MAX_TOKENS 1024
-
-int read_file(char *restrict buf, const size_t n, const char *restrict path)
+void read_file(Buffer *restrict b, const char *restrict path)
 {
-    FILE *file = fopen(path, "rb");
-    if (!file) {
+    const int loaded = buffer_load_file(b, path);
+    if (loaded == -1) {
         fprintf(stderr, "Could not find file \"%s\".\n", path);
         exit(ERR_FILE);
     }
-
-    size_t sz = fsize(file);
-    size_t count = (n <= sz ? n - 1 : sz);
-    size_t bytes_read = fread(buf, sizeof(char), count, file);
-    if (bytes_read < count) {
+    if (loaded == 0) {
         fprintf(stderr, "Could not read file \"%s\".\n", path);
-        fclose(file);
         exit(ERR_FILE);
     }
-    buf[bytes_read] = '\0';
-
-    fclose(file);
-    return (int)bytes_read;
 }
 
-void print(Expr *e)
+void print(const Parser *restrict p, const Ast *restrict ast)
 {
     static char *buf = NULL;
-    if (e) {
-        arr_reset(buf);
-        buf = expr_sprint(buf, e);
+    arr_reset(buf);
+    buf = ast_sprint(buf, p->tokens, ast);
+    if (arr_count(buf)) {
         printf("%.*s\n", arr_count(buf), buf);
     }
 }
 
-Expr *eval(Buffer *restrict b, Scanner *restrict s, Parser *restrict p, Token *restrict ts)
+// Scans (on `pool` when there is one), parses and resolves
+const Ast *compile(Buffer *restrict b, Scanner *restrict s, Parser *restrict p, Resolver *restrict r,
+        ThreadPool *restrict pool)
+{
+    p->lines = &s->lines, p->filename = b->name;
+    const Ast *ast = parse(p, pool ? scan_parallel(s, b, pool) : scan(s, b));
+    if (had_error) {
+        return NULL;
+    }
+    r->tokens = p->tokens, r->lines = &s->lines, r->filename = b->name;
+    resolve(r, &p->ast);
+    return ast;
+}
+
+typedef enum {
+    ENGINE_AST,  // print the tree
+    ENGINE_TREE, // walk the tree
+    ENGINE_VM,   // compile to bytecode and run that
+} Engine;
+
+// What runs a parsed program, and the state it keeps between runs
+typedef struct {
+    Engine engine;
+    Resolver resolver;
+    bool jit;      // compile numeric subtrees to native code for the tree-walker
+    bool gc_stats; // print the collector's statistics after each run
+    Interpreter interp;
+    Jit native;
+    Compiler compiler;
+    Chunk chunk;
+    VM vm;
+    Heap heap;
+} Runtime;
+
+// Run `ast` and print its result, if it has one
+void run(const Parser *restrict p, Scanner *restrict s, Runtime *restrict rt, const Ast *restrict ast)
 {
-    return parse(p, scan(s, b, ts));
+    if (!ast) {
+        return;
+    }
+    if (rt->engine == ENGINE_AST) {
+        print(p, ast);
+        return;
+    }
+    while (arr_count(rt->heap.globals) < arr_count(rt->resolver.globals)) {
+        arr_push(rt->heap.globals, VALUE_UNDEFINED);
+    }
+    Value v;
+    bool ok;
+    if (rt->engine == ENGINE_VM) {
+        Compiler *c = &rt->compiler;
+        c->tokens = p->tokens, c->lines = &s->lines, c->filename = s->buffer->name;
+        VM *vm = &rt->vm;
+        vm->tokens = p->tokens, vm->lines = &s->lines, vm->filename = s->buffer->name;
+        vm->heap = &rt->heap;
+        ok = compile_ast(c, ast, &rt->chunk) && vm_run(vm, &rt->chunk, &v);
+    } else {
+        Interpreter *in = &rt->interp;
+        in->tokens = p->tokens, in->lines = &s->lines, in->filename = s->buffer->name;
+        in->heap = &rt->heap;
+        in->jit = NULL;
+        if (rt->jit) {
+            jit_compile(&rt->native, ast, p->tokens);
+            in->jit = &rt->native;
+        }
+        ok = interpret(in, ast, &v);
+    }
+    if (ok && v != VALUE_UNDEFINED) {
+        value_println(v);
+    }
+    if (rt->gc_stats) {
+        gc_stats_pp(&rt->heap);
+    }
 }
 
 void eval_file(Buffer *restrict b, Scanner *restrict s, Parser *restrict p,
-        Token *restrict ts, const char *restrict path)
+        Runtime *restrict rt, ThreadPool *restrict pool, const char *restrict path)
 {
-    // TODO use arr instead?
-    // b->name = path;
-    b->len = read_file(b->head, BUFFER_MAX_LEN, path);
+    b->name = path;
+    read_file(b, path);
 
-    Expr *e = eval(b, s, p, ts);
+    const Ast *ast = compile(b, s, p, &rt->resolver, pool);
     if (had_error) {
         exit(ERR_COMPILE);
     }
-    print(e);
+    run(p, s, rt, ast);
+    if (had_error) {
+        exit(ERR_COMPILE);
+    }
+    if (had_runtime_error) {
+        exit(ERR_RUNTIME);
+    }
+    buffer_release(b);
+}
+
+void print_token(void *ctx, const Token *t)
+{
+    printf("%s %.*s\n", token_type_name(t), t->lexeme.len, t->lexeme.head);
+}
+
+// Print the tokens of `path` (or stdin) as they are scanned, in bounded memory
+void stream_tokens(const char *path)
+{
+    FILE *file = path ? fopen(path, "rb") : stdin;
+    if (!file) {
+        fprintf(stderr, "Could not find file \"%s\".\n", path);
+        exit(ERR_FILE);
+    }
+    bool ok = stream_scan_file(file, path ? path : "stdin", print_token, NULL);
+    if (file != stdin) {
+        fclose(file);
+    }
+    if (!ok) {
+        exit(ERR_COMPILE);
+    }
+}
+
+// Where the lines of a REPL session that compiled end
+typedef struct {
+    int source;  // bytes
+    int tokens;  // before the TOKEN_EOF
+    int nodes;
+    int numbers; // number literals in the Ast
+    int names;   // property sites
+} ReplMark;
+
+// Scans, parses and resolves the end of `b` after `m` as more of the program
+// that ends there
+const Ast *compile_more(Buffer *restrict b, Scanner *restrict s, Parser *restrict p, Resolver *restrict r,
+        const ReplMark m)
+{
+    p->lines = &s->lines, p->filename = b->name;
+    const Ast *ast = parse_more(p, scan_more(s, b, m.source, m.tokens), m.tokens);
+    if (had_error) {
+        return NULL;
+    }
+    r->tokens = p->tokens, r->lines = &s->lines, r->filename = b->name;
+    r->start = m.nodes;
+    resolve(r, &p->ast);
+    return ast;
 }
 
-void repl(Buffer *restrict b, Scanner *restrict s, Parser *restrict p, Token *restrict ts)
+//
+// Each line is the next part of one program made of the lines before it
+// that compiled. Only the new line is scanned, parsed, resolved and compiled,
+// onto the end of their tokens, nodes and code, which are kept, with the
+// globals, so functions they declared can still be called. The engines start
+// at the new line's. A line that does not compile is dropped. Errors are
+// located in the whole session, so line numbers keep counting.
+//
+void repl(Buffer *restrict b, Scanner *restrict s, Parser *restrict p, Runtime *restrict rt)
 {
     b->name = "repl";
+    char *source = NULL; // arr; the lines that compiled, then the new one
+    ReplMark end = {0};  // of the lines that compiled
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
     for (;;) {
         fputs(ANSI_BOLD "loxy> " ANSI_RESET, stdout);
-        if (!fgets(b->head, BUFFER_MAX_LEN, stdin)) {
+        if ((len = getline(&line, &cap, stdin)) < 0) {
             fputs(ANSI_RESET "\n", stdout);
             break;
         }
-        if (b->head[0] != '\n') {
-            print(eval(b, s, p, ts));
+        if (line[0] == '\n') {
+            continue;
+        }
+        arr_concat(source, line, (int) len);
+        arr_push(source, '\0');
+        b->head = source;
+        b->len = arr_count(source) - 1;
+        (void) arr_pop(source);
+        rt->interp.start = rt->compiler.start = rt->native.start = end.nodes;
+        rt->vm.start = end.nodes ? arr_count(rt->chunk.code) - 1 : 0; // the OP_RETURN the line replaces
+        const Ast *ast = compile_more(b, s, p, &rt->resolver, end);
+        if (!had_error) {
+            run(p, s, rt, ast);
+        }
+        if (had_error || rt->engine == ENGINE_AST) {
+            while (arr_count(source) > end.source) (void) arr_pop(source);
+            ast_truncate(&p->ast, end.nodes, end.numbers, end.names);
+        } else {
+            end = (ReplMark) {arr_count(source), token_stream_count(&s->tokens) - 1,
+                p->ast.count, p->ast.num_numbers, arr_count(p->ast.names)};
         }
-        buffer_reset(b);
         had_error = false;
+        had_runtime_error = false;
     }
+    free(line);
+    arr_free(source);
+    b->head = NULL;
+}
+
+int usage(void)
+{
+    fputs("Usage: loxy [--tokens | --ast | --vm | --jit] [--fold] [--gc-stats] [--gc-stress]\n"
+          "            [--threads N] [path]\n"
+          "       loxy --check [--threads N] path...\n", stderr);
+    return ERR_USAGE;
 }
 
 int main(int argc, const char *argv[])
 {
-    Buffer b;
-    buffer_init(&b, BUFFER_MAX_LEN, BUFFER_MAX_LINES);
-    Scanner *s = malloc(sizeof(Scanner));
-    Parser *p = malloc(sizeof(Parser));
-    Token *ts = malloc(sizeof(Token) * MAX_TOKENS);
-
-    switch (argc) {
-        case 1: repl(&b, s, p, ts); break;
-        case 2: eval_file(&b, s, p, ts, argv[1]); break;
-        default: fputs("Usage: loxy [path]\n", stderr); return ERR_USAGE;
+    Buffer b = {0};
+    Scanner *s = calloc(1, sizeof(Scanner));
+    Parser *p = calloc(1, sizeof(Parser));
+    Runtime *rt = calloc(1, sizeof(Runtime));
+    rt->engine = ENGINE_TREE;
+    log_init();
+
+    const char *path = NULL;
+    bool tokens = false;
+    bool check = false;
+    const char **check_paths = NULL; // arr
+    int threads = -1; // 0: one per CPU; -1: 1, or one per CPU with --check
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--tokens") == 0) {
+            tokens = true;
+        } else if (strcmp(argv[i], "--ast") == 0) {
+            rt->engine = ENGINE_AST;
+        } else if (strcmp(argv[i], "--vm") == 0) {
+            rt->engine = ENGINE_VM;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            rt->jit = true;
+        } else if (strcmp(argv[i], "--gc-stats") == 0) {
+            rt->gc_stats = true;
+        } else if (strcmp(argv[i], "--gc-stress") == 0) {
+            rt->heap.stress = true;
+        } else if (strcmp(argv[i], "--check") == 0) {
+            check = true;
+        } else if (strcmp(argv[i], "--fold") == 0) {
+            p->fold = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && i+1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+            return usage();
+        } else if (!path) {
+            path = argv[i];
+            arr_push(check_paths, argv[i]);
+        } else if (check) {
+            arr_push(check_paths, argv[i]);
+        } else {
+            return usage();
+        }
+    }
+    if (rt->jit && rt->engine != ENGINE_TREE) {
+        return usage();
+    }
+    if (threads == -1) {
+        threads = check ? 0 : 1;
+    }
+
+    if (check) {
+        if (!path || tokens) {
+            return usage();
+        }
+        Check c = {0};
+        for (int i = 0; i < arr_count(check_paths); ++i) {
+            check_add_path(&c, check_paths[i]);
+        }
+        ThreadPool pool;
+        pool_init(&pool, threads);
+        check_run(&c, &pool);
+        pool_destroy(&pool);
+        check_report(&c);
+        const int code = check_exit_code(&c);
+        check_free(&c);
+        return code;
+    }
+    if (tokens) {
+        stream_tokens(path);
+        return 0;
+    }
+    if (!path) {
+        repl(&b, s, p, rt);
+        return 0;
+    }
+
+    ThreadPool pool;
+    if (threads != 1) {
+        pool_init(&pool, threads);
+    }
+    eval_file(&b, s, p, rt, threads != 1 ? &pool : NULL, path);
+    if (threads != 1) {
+        pool_destroy(&pool);
     }
 }
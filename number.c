@@ -0,0 +1,169 @@
+#define NUMBER_C
+
+#ifndef COMMON_H
+#include "common.h"
+#endif
+
+#include <math.h> // INFINITY
+
+#include "pow5.h"
+
+//
+// Number literals: `digits` or `digits.digits`, straight from the source span.
+//
+// The value is correctly rounded (the same double strtod returns) and no
+// copy or allocation is made:
+//
+// - integers below 2^53 are converted directly;
+// - a mantissa below 2^53 with at most 22 fraction digits is divided by an
+//   exact power of ten, which IEEE division rounds correctly (Clinger);
+// - anything else with at most 19 significant digits goes through the
+//   Eisel-Lemire algorithm: multiply the normalized mantissa by a 128-bit
+//   approximation of the power of five and round the product.
+//
+// Literals with more than 19 significant digits fall back to strtod on a
+// NUL-terminated copy.
+//
+__extension__ typedef unsigned __int128 uint128;
+
+#define NUMBER_MAX_DIGITS 19          // 10^19 - 1 fits in a uint64_t
+#define NUMBER_MAX_EXACT (1ull << 53) // integers up to here are exact doubles
+#define NUMBER_MANTISSA_BITS 52       // explicit bits of a double's mantissa
+
+static const double exact_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static double number_from_bits(const uint64_t bits)
+{
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+// w * 10^q for w != 0 and q in [POW5_MIN_Q, POW5_MAX_Q]
+static double number_eisel_lemire(uint64_t w, const int q)
+{
+    const int lz = __builtin_clzll(w);
+    w <<= lz;
+
+    // The product's top 55 bits are enough unless its low 9 bits of the high
+    // word are all ones; then the next 64 bits of 5^q settle the carry.
+    const uint64_t *pow5 = pow5_128[q - POW5_MIN_Q];
+    uint128 product = (uint128) w * pow5[0];
+    uint64_t hi = (uint64_t) (product >> 64);
+    uint64_t lo = (uint64_t) product;
+    if ((hi & 0x1FF) == 0x1FF) {
+        uint64_t next = (uint64_t) (((uint128) w * pow5[1]) >> 64);
+        lo += next;
+        hi += (next > lo);
+    }
+
+    const int upper_bit = (int) (hi >> 63);
+    const int shift = upper_bit + 64 - NUMBER_MANTISSA_BITS - 3;
+    uint64_t mantissa = hi >> shift;
+    // floor(log2(10^q)) + 63, plus the exponent bias
+    int power2 = (((152170 + 65536) * q) >> 16) + 63 + upper_bit - lz + 1023;
+
+    if (power2 <= 0) { // subnormal
+        if (-power2 + 1 >= 64) {
+            return 0.0;
+        }
+        mantissa >>= -power2 + 1;
+        mantissa += (mantissa & 1);
+        mantissa >>= 1;
+        power2 = (mantissa < (1ull << NUMBER_MANTISSA_BITS)) ? 0 : 1;
+        return number_from_bits(mantissa | (uint64_t) power2 << NUMBER_MANTISSA_BITS);
+    }
+
+    // Exactly halfway between two doubles: round to even
+    if (lo <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1
+            && (mantissa << shift) == hi) {
+        mantissa &= ~1ull;
+    }
+    mantissa += (mantissa & 1);
+    mantissa >>= 1;
+    if (mantissa >= (2ull << NUMBER_MANTISSA_BITS)) { // rounded up to the next power of two
+        mantissa = 1ull << NUMBER_MANTISSA_BITS;
+        power2++;
+    }
+    mantissa &= ~(1ull << NUMBER_MANTISSA_BITS);
+    if (power2 >= 0x7FF) {
+        return INFINITY;
+    }
+    return number_from_bits(mantissa | (uint64_t) power2 << NUMBER_MANTISSA_BITS);
+}
+
+static double number_parse_slow(const char *p, const int len)
+{
+    char *buf = malloc(len + 1);
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+    double d = strtod(buf, NULL);
+    free(buf);
+    return d;
+}
+
+// The value of the number literal [p, p+len)
+double number_parse(const char *p, const int len)
+{
+    const char *end = p + len;
+    const char *c = p;
+    uint64_t w = 0;
+
+    while (c < end && *c == '0') c++; // leading zeros are not significant
+    const char *digits = c;
+    while (c < end && *c != '.') {
+        w = w * 10 + (uint64_t) (*c++ - '0');
+    }
+    int num_digits = c - digits;
+    int q = 0;
+    if (c < end) {
+        const char *fraction = ++c; // skip the `.`
+        if (num_digits == 0) {
+            while (c < end && *c == '0') c++;
+        }
+        const char *significant = c;
+        while (c < end) {
+            w = w * 10 + (uint64_t) (*c++ - '0');
+        }
+        num_digits += c - significant;
+        q = -(int) (c - fraction);
+    }
+
+    if (num_digits > NUMBER_MAX_DIGITS) {
+        return number_parse_slow(p, len);
+    }
+    if (q == 0 && w <= NUMBER_MAX_EXACT) {
+        return (double) w;
+    }
+    if (w <= NUMBER_MAX_EXACT && q >= -22) {
+        return (double) w / exact_pow10[-q];
+    }
+    if (w == 0 || q < POW5_MIN_Q) {
+        return 0.0;
+    }
+    return number_eisel_lemire(w, q);
+}
+
+double number_parse_str(const str s)
+{
+    return number_parse(s.head, s.len);
+}
+
+// Writes the shortest text that reads back as `d` (e.g. `3`, `0.1`, `inf`)
+// to `buf`; returns its length. Every NaN is `nan`: the sign of a NaN depends
+// on the order the hardware saw the operands in, which is not Lox's concern.
+int number_format(char *buf, const int size, const double d)
+{
+    if (d != d) {
+        return snprintf(buf, size, "nan");
+    }
+    int len = 0;
+    for (int precision = 15; precision <= 17; ++precision) {
+        len = snprintf(buf, size, "%.*g", precision, d);
+        if (strtod(buf, NULL) == d) break;
+    }
+    return len;
+}
@@ -9,192 +9,684 @@
 #ifndef EXPR_C
 #include "expr.c"
 #endif
+#ifndef FOLD_C
+#include "fold.c"
+#endif
 #ifndef TOKEN_C
 #include "token.c"
 #endif
 
+// A set of token types, one bit per type
+typedef uint64_t TokenSet;
+
+#define TOKEN_BIT(t) ((TokenSet) 1 << (t))
+
+_Static_assert(TOKEN_EOF < 64, "TokenType does not fit in a TokenSet");
+
+static const TokenSet PREFIX_OPERATORS = TOKEN_BIT(TOKEN_BANG) | TOKEN_BIT(TOKEN_PLUS)
+    | TOKEN_BIT(TOKEN_MINUS);
+static const TokenSet OPERANDS = TOKEN_BIT(TOKEN_NIL) | TOKEN_BIT(TOKEN_FALSE)
+    | TOKEN_BIT(TOKEN_TRUE) | TOKEN_BIT(TOKEN_NUMBER) | TOKEN_BIT(TOKEN_STRING)
+    | TOKEN_BIT(TOKEN_IDENTIFIER) | TOKEN_BIT(TOKEN_THIS);
+
+typedef enum {
+    PREC_NONE,
+    PREC_ASSIGNMENT, // =
+    PREC_OR,         // or
+    PREC_AND,        // and
+    PREC_EQUALITY,   // == !=
+    PREC_COMPARISON, // < > <= >=
+    PREC_TERM,       // + -
+    PREC_FACTOR,     // * /
+    PREC_UNARY,      // ! + -
+} Precedence;
+
+typedef struct {
+    uint8_t prec;       // Precedence; PREC_NONE if the token is not an infix operator
+    bool right_assoc;
+    uint8_t expr_type;  // ExprType of the node it makes
+} InfixRule;
+
+// Infix operators, indexed by TokenType
+static const InfixRule infix_rules[TOKEN_EOF + 1] = {
+    [TOKEN_EQUAL]         = {PREC_ASSIGNMENT, true,  EXPR_ASSIGN},
+    [TOKEN_OR]            = {PREC_OR,         false, EXPR_LOGICAL},
+    [TOKEN_AND]           = {PREC_AND,        false, EXPR_LOGICAL},
+    [TOKEN_EQUAL_EQUAL]   = {PREC_EQUALITY,   false, EXPR_BINARY},
+    [TOKEN_BANG_EQUAL]    = {PREC_EQUALITY,   false, EXPR_BINARY},
+    [TOKEN_GREATER]       = {PREC_COMPARISON, false, EXPR_BINARY},
+    [TOKEN_GREATER_EQUAL] = {PREC_COMPARISON, false, EXPR_BINARY},
+    [TOKEN_LESS]          = {PREC_COMPARISON, false, EXPR_BINARY},
+    [TOKEN_LESS_EQUAL]    = {PREC_COMPARISON, false, EXPR_BINARY},
+    [TOKEN_MINUS]         = {PREC_TERM,       false, EXPR_BINARY},
+    [TOKEN_PLUS]          = {PREC_TERM,       false, EXPR_BINARY},
+    [TOKEN_SLASH]         = {PREC_FACTOR,     false, EXPR_BINARY},
+    [TOKEN_STAR]          = {PREC_FACTOR,     false, EXPR_BINARY},
+};
+
+// An operator waiting for its right operand (see `expression`)
+typedef struct {
+    uint8_t prec;      // PREC_NONE for an open parenthesis or call
+    uint8_t expr_type; // EXPR_UNARY, EXPR_BINARY, EXPR_LOGICAL, EXPR_ASSIGN, EXPR_SET_PROPERTY,
+                       // EXPR_GROUPING or EXPR_CALL (which may turn out to be an EXPR_INVOKE)
+    int token;         // for EXPR_ASSIGN and EXPR_SET_PROPERTY, the name's
+    int arg;           // for EXPR_SET_PROPERTY, its site; for EXPR_CALL, the arguments before the current one
+} PendingOp;
+
+// A statement waiting for the statements it contains (see `parse`)
+typedef struct {
+    uint8_t type; // STMT_BLOCK_BEGIN, STMT_WHILE_TEST for a loop's body, STMT_FUNCTION,
+                  // or EXPR_CLASS for a class's body, which contains its methods
+    int node;     // of that type
+    int start;    // of a loop, the first node of its condition; of a function, its arity
+    int token;    // its `{` or `while`, or the function's name
+} OpenStmt;
+
+// Walks the dense `types` array of the token stream; lexemes are only looked
+// up (by index) when a node needs one.
 typedef struct {
-    Token *tokens;
-    Token *cursor;
+    const TokenStream *tokens;
+    LineIndex *lines;     // for the locations of errors
+    const char *filename;
+    const uint8_t *types; // tokens->types
+    int cursor;           // index of the next token
+    int previous;         // index of the last token consumed
+    int numbers;          // TOKEN_NUMBERs consumed; indexes tokens->numbers
     bool eof;
+    bool panic;           // after an error, until the next statement
+    PendingOp *ops;       // arr
+    OpenStmt *open;       // arr
+    int functions;        // of `open`, how many are functions
+    int *operands;        // arr of the roots of complete operands, as Ast indices
+    Ast ast;              // the nodes of the last parse
+    bool fold;            // fold constants and drop groupings (see fold.c)
 } Parser;
 
 void parser_pp(const Parser *p)
 {
+    Token cursor = token_stream_get(p->tokens, p->cursor);
     printf("[Parser * %p:%s]\n", (void *) p, bool_str(p->eof));
-    printf("  Token: "); token_pp(p->tokens);
-    printf("  Cursor: "); token_pp(p->cursor);
+    printf("  Cursor %d: ", p->cursor); token_pp(&cursor);
 }
 
-void parser_error(const Parser *restrict p, const char *restrict message)
+// Reports the first error of a statement; the rest are likely caused by it
+void parser_error_at(Parser *restrict p, const int token, const char *restrict message)
 {
-    Token t = *p->cursor;
-    if (t.type == TOKEN_EOF) {
-        // FIXME
-        // int num_lines = 111;
-        // error(num_lines, scanner_last_line_str(s),
-        //         str_new_s(s->token, s->cursor - s->token - 1), message);
-    } else {
-        // FIXME
-        // int num_lines = 111;
-        // error(num_lines, scanner_last_line_str(s),
-        //         str_new_s(s->token, s->cursor - s->token - 1), message);
+    if (p->panic) {
+        return;
     }
+    p->panic = true;
+    error(token_stream_loc(p->tokens, p->lines, p->filename, token), message);
+}
+
+void parser_error(Parser *restrict p, const char *restrict message)
+{
+    parser_error_at(p, p->cursor, message);
 }
 
-Token *parser_advance(Parser *p)
+// Comments are in the token stream but not in the grammar
+static void parser_skip_comments(Parser *p)
 {
-    Token *t = p->cursor++;
-    p->eof = (p->cursor->type == TOKEN_EOF);
+    while (p->types[p->cursor] == TOKEN_COMMENT) {
+        p->cursor++;
+    }
+    p->eof = (p->types[p->cursor] == TOKEN_EOF);
+}
+
+// Returns the index of the consumed token
+int parser_advance(Parser *p)
+{
+    int t = p->previous = p->cursor++;
+    p->numbers += (p->types[t] == TOKEN_NUMBER);
+    parser_skip_comments(p);
     return t;
 }
 
+TokenType peek(const Parser *p)
+{
+    return (TokenType) p->types[p->cursor];
+}
+
 bool check(const Parser *p, const TokenType t)
 {
-    return !p->eof && p->cursor->type == t;
+    return peek(p) == t;
 }
 
-Token *consume(Parser *restrict p, const TokenType t, const char *restrict message)
+bool check_any(const Parser *p, const TokenSet set)
+{
+    return (set & TOKEN_BIT(peek(p))) != 0;
+}
+
+int consume(Parser *restrict p, const TokenType t, const char *restrict message)
 {
     if (check(p, t)) return parser_advance(p);
     parser_error(p, message);
-    return &TokenNone;
+    return TOKEN_INDEX_NONE;
 }
 
-bool match(Parser *p, int n, ...)
+bool match_any(Parser *p, const TokenSet set)
 {
-    va_list token_types;
-    va_start(token_types, n);
-    while (n--) {
-        if (check(p, va_arg(token_types, TokenType))) {
-            parser_advance(p);
-            return true;
-        }
+    if (check_any(p, set)) {
+        parser_advance(p);
+        return true;
     }
-    va_end(token_types);
     return false;
 }
 
- void synchronize(Parser *p) {
-     parser_advance(p);
+void synchronize(Parser *p) {
+    parser_advance(p);
+
+    while (!p->eof) {
+        if (p->types[p->previous] == TOKEN_SEMICOLON) {
+            return;
+        }
+
+        switch (peek(p)) {
+            case TOKEN_CLASS:
+            case TOKEN_FN:
+            case TOKEN_VAR:
+            case TOKEN_FOR:
+            case TOKEN_IF:
+            case TOKEN_WHILE:
+            case TOKEN_PRINT:
+            case TOKEN_RETURN:
+                return;
+            default:
+                break;
+        }
+
+        parser_advance(p);
+    }
+}
+
+// Returns the index of the new node
+int operand(Parser *p)
+{
+    const int t = parser_advance(p);
+    switch (p->types[t]) {
+        case TOKEN_NIL:    return ast_push(&p->ast, EXPR_NIL, t, 0);
+        case TOKEN_FALSE:  return ast_push(&p->ast, EXPR_BOOL, t, false);
+        case TOKEN_TRUE:   return ast_push(&p->ast, EXPR_BOOL, t, true);
+        case TOKEN_NUMBER: return ast_push_number(&p->ast, t, p->tokens->numbers[p->numbers-1]);
+        case TOKEN_STRING: return ast_push_string(&p->ast, t, token_stream_lexeme(p->tokens, t));
+        case TOKEN_IDENTIFIER:
+        case TOKEN_THIS: // a parameter of methods (see resolver.c)
+            return ast_push(&p->ast, EXPR_VARIABLE, t, intern_str(token_stream_lexeme(p->tokens, t)));
+        default:           return ast_push(&p->ast, EXPR_NONE, t, 0);
+    }
+}
 
-     while (!p->eof) {
-         if (p->cursor[-1].type == TOKEN_SEMICOLON) {
-             return;
-         }
+// A call whose callee is a property right before its `(`, `a.m(x)`, is a
+// method call: the property becomes an EXPR_GET_METHOD
+static ExprType call_type(Parser *p, const int callee, const int paren)
+{
+    if (p->ast.types[callee] == EXPR_GET_PROPERTY && (int) p->ast.tokens[callee] == paren - 1) {
+        p->ast.types[callee] = EXPR_GET_METHOD;
+        return EXPR_INVOKE;
+    }
+    return EXPR_CALL;
+}
+
+// Pop the top pending operator and emit its node; its operand(s) are the
+// last complete ones, so their nodes come right before it
+static void reduce(Parser *p)
+{
+    const PendingOp op = arr_pop(p->ops);
+    (void) arr_pop(p->operands); // rhs: the node before the new one
+    if (op.expr_type == EXPR_CALL) { // and the callee and other arguments before it
+        for (int k = 0; k < op.arg; ++k) {
+            (void) arr_pop(p->operands);
+        }
+        const int callee = arr_pop(p->operands);
+        arr_push(p->operands, ast_push(&p->ast, call_type(p, callee, op.token), op.token, op.arg + 1));
+        return;
+    }
+    if (op.expr_type == EXPR_SET_PROPERTY) {
+        (void) arr_pop(p->operands); // the object
+        arr_push(p->operands, ast_push(&p->ast, EXPR_SET_PROPERTY, op.token, op.arg));
+        return;
+    }
+    const bool binary = (op.expr_type == EXPR_BINARY || op.expr_type == EXPR_LOGICAL);
+    const uint32_t lhs = binary ? arr_pop(p->operands) : 0;
+    if (op.expr_type == EXPR_ASSIGN) {
+        const str name = token_stream_lexeme(p->tokens, op.token);
+        arr_push(p->operands, ast_push(&p->ast, EXPR_ASSIGN, op.token, intern_str(name)));
+        return;
+    }
+    if (p->fold) {
+        const TokenType type = p->types[op.token];
+        const bool folded = op.expr_type == EXPR_GROUPING || (binary
+            ? fold_binary(&p->ast, type, op.token)
+            : fold_unary(&p->ast, type, op.token));
+        if (folded) {
+            arr_push(p->operands, ast_root(&p->ast));
+            return;
+        }
+    }
+    arr_push(p->operands, ast_push(&p->ast, op.expr_type, op.token, lhs));
+}
 
-         switch (p->cursor->type) {
-             case TOKEN_CLASS:
-             case TOKEN_FN:
-             case TOKEN_VAR:
-             case TOKEN_FOR:
-             case TOKEN_IF:
-             case TOKEN_WHILE:
-             case TOKEN_PRINT:
-             case TOKEN_RETURN:
-                 return;
-             default:
-                 break;
-         }
+// Reduce the pending operators above `base` that bind at least as tightly as
+// `rule`; an open parenthesis stops it
+static void reduce_above(Parser *p, const int base, const InfixRule rule)
+{
+    while (arr_count(p->ops) > base) {
+        const PendingOp top = arr_last(p->ops);
+        if (top.prec == PREC_NONE || top.prec < rule.prec
+                || (top.prec == rule.prec && rule.right_assoc)) {
+            return;
+        }
+        reduce(p);
+    }
+}
 
-         parser_advance(p);
-     }
- }
+//
+// Pratt parser, driven by `infix_rules` and run with explicit stacks instead
+// of recursion, so nesting depth is only limited by memory.
+//
+// In prefix position the parser pushes prefix operators and open parentheses
+// until it reaches an operand. In infix position, a property access or a call
+// with no arguments applies to the operand before it at once, and a call with
+// arguments is pushed like an open parenthesis, which each `,` reduces back
+// to; an operator first reduces the pending operators that bind at least as
+// tightly, then waits for its right operand; a `)` reduces everything back to
+// its `(`. Anything else ends the expression.
+//
+int expression(Parser *p)
+{
+    const int base = arr_count(p->ops);
+    for (;;) {
+        // Prefix position
+        while (check_any(p, PREFIX_OPERATORS) || check(p, TOKEN_LEFT_PAREN)) {
+            const bool paren = check(p, TOKEN_LEFT_PAREN);
+            PendingOp op = {
+                .prec = paren ? PREC_NONE : PREC_UNARY,
+                .expr_type = paren ? EXPR_GROUPING : EXPR_UNARY,
+                .token = parser_advance(p),
+            };
+            arr_push(p->ops, op);
+        }
+        if (check_any(p, OPERANDS)) {
+            arr_push(p->operands, operand(p));
+        } else {
+            parser_error(p, "Expect expression.");
+            arr_push(p->operands, ast_push(&p->ast, EXPR_NONE, p->cursor, 0));
+        }
 
-Expr *expression(Parser *p);
+        // Infix position
+        const InfixRule end = {PREC_NONE, false, EXPR_NONE};
+        for (;;) {
+            if (check(p, TOKEN_DOT)) {
+                parser_advance(p);
+                const int name = consume(p, TOKEN_IDENTIFIER, "Expect property name after '.'.");
+                if (name != TOKEN_INDEX_NONE) {
+                    (void) arr_pop(p->operands);
+                    arr_push(p->operands, ast_push_property(&p->ast, name, token_stream_lexeme(p->tokens, name)));
+                }
+                continue;
+            }
+            if (check(p, TOKEN_LEFT_PAREN)) {
+                const PendingOp call = {PREC_NONE, EXPR_CALL, parser_advance(p), 0};
+                if (!check(p, TOKEN_RIGHT_PAREN)) {
+                    arr_push(p->ops, call);
+                    break; // to its first argument
+                }
+                parser_advance(p);
+                const int callee = arr_pop(p->operands);
+                arr_push(p->operands, ast_push(&p->ast, call_type(p, callee, call.token), call.token, 0));
+                continue;
+            }
+            const InfixRule rule = infix_rules[peek(p)];
+            if (rule.prec != PREC_NONE) {
+                reduce_above(p, base, rule);
+                PendingOp op = {rule.prec, rule.expr_type, parser_advance(p), 0};
+                if (rule.expr_type == EXPR_ASSIGN) {
+                    // Only a bare name or a property can be assigned to. It is
+                    // the last node, and the assignment's node will stand for
+                    // it; a property's object stays, as the first operand
+                    const int target = arr_pop(p->operands);
+                    const bool bare = (int) p->ast.tokens[target] == op.token - 1;
+                    if (p->ast.types[target] == EXPR_VARIABLE && bare
+                            && p->types[p->ast.tokens[target]] == TOKEN_IDENTIFIER) {
+                        p->ast.count--;
+                        op.token = op.token - 1;
+                    } else if (p->ast.types[target] == EXPR_GET_PROPERTY && bare) {
+                        p->ast.count--;
+                        arr_push(p->operands, target - 1);
+                        op = (PendingOp) {op.prec, EXPR_SET_PROPERTY, op.token - 1, p->ast.args[target]};
+                    } else {
+                        parser_error_at(p, op.token, "Invalid assignment target.");
+                    }
+                }
+                arr_push(p->ops, op);
+                break;
+            }
+            reduce_above(p, base, end);
+            if (arr_count(p->ops) == base) {
+                return arr_pop(p->operands);
+            }
+            // An open parenthesis or call; unclosed ones are still complete
+            PendingOp *open = &arr_last(p->ops);
+            if (open->expr_type == EXPR_CALL && check(p, TOKEN_COMMA)) {
+                parser_advance(p);
+                if (++open->arg == 255) {
+                    parser_error(p, "Can't have more than 255 arguments.");
+                }
+                break; // to the next argument
+            }
+            consume(p, TOKEN_RIGHT_PAREN, open->expr_type == EXPR_CALL
+                    ? "Expect ')' after arguments." : "Expect ')' after expression.");
+            reduce(p);
+        }
+    }
+}
 
-Expr *primary(Parser *p)
+static void var_declaration(Parser *p)
 {
-    // printf("primary: \"%.*s\"\n", (p->cursor-1)->lexeme.len, (p->cursor-1)->lexeme.head);
-    if (match(p, 1, TOKEN_NIL))    return make_nil_expr(p->cursor-1);
-    if (match(p, 1, TOKEN_FALSE))  return make_bool_expr(p->cursor-1, false);
-    if (match(p, 1, TOKEN_TRUE))   return make_bool_expr(p->cursor-1, true);
-    if (match(p, 1, TOKEN_NUMBER)) return make_number_expr(p->cursor-1);
-    if (match(p, 1, TOKEN_STRING)) return make_string_expr(p->cursor-1);
+    parser_advance(p);
+    const int name = consume(p, TOKEN_IDENTIFIER, "Expect variable name.");
+    if (name == TOKEN_INDEX_NONE) {
+        return;
+    }
+    if (match_any(p, TOKEN_BIT(TOKEN_EQUAL))) {
+        expression(p);
+    } else {
+        ast_push(&p->ast, EXPR_NIL, name, 0);
+    }
+    consume(p, TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+    ast_push(&p->ast, STMT_VAR, name, intern_str(token_stream_lexeme(p->tokens, name)));
+}
 
-    if (match(p, 1, TOKEN_LEFT_PAREN)) {
-        Expr *e = expression(p);
-        consume(p, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
-        return make_grouping_expr(e);
+// `class A {` opens a class, whose body holds its methods, up to its `}`
+static void class_declaration(Parser *p)
+{
+    parser_advance(p);
+    const int name = consume(p, TOKEN_IDENTIFIER, "Expect class name.");
+    if (name == TOKEN_INDEX_NONE) {
+        return;
     }
+    const int node = ast_push(&p->ast, EXPR_CLASS, name, intern_str(token_stream_lexeme(p->tokens, name)));
+    if (consume(p, TOKEN_LEFT_BRACE, "Expect '{' before class body.") == TOKEN_INDEX_NONE) {
+        p->ast.count--;
+        return;
+    }
+    const OpenStmt klass = {EXPR_CLASS, node, 0, name};
+    arr_push(p->open, klass);
+}
 
-    parser_error(p, "Expect expression");
-    return &NoneExpr;
+// The end of a class's body defines `A` like a `var` whose value is the class
+static void class_end(Parser *p)
+{
+    const OpenStmt klass = arr_pop(p->open);
+    parser_advance(p);
+    ast_push(&p->ast, STMT_VAR, klass.token, p->ast.args[klass.node]);
 }
 
-Expr *unary(Parser *p)
+// `(a, b) {` after the name of a function or method opens its body, which
+// ends at its `}` like a block's. A method's first parameter is `this`.
+static void fn_header(Parser *p, const int name, const bool method)
 {
-    if (match(p, 3, TOKEN_BANG, TOKEN_PLUS, TOKEN_MINUS)) {
-        Token *op = p->cursor-1;
-        Expr *rhs = unary(p);
-        return make_unary_expr(op, rhs);
+    const int node = ast_push(&p->ast, STMT_FUNCTION, name, 0);
+    if (method) {
+        ast_push(&p->ast, STMT_PARAM, name, intern("this", 4));
+    }
+    consume(p, TOKEN_LEFT_PAREN, method ? "Expect '(' after method name." : "Expect '(' after function name.");
+    int arity = method;
+    if (!check(p, TOKEN_RIGHT_PAREN)) {
+        do {
+            const int param = consume(p, TOKEN_IDENTIFIER, "Expect parameter name.");
+            if (param == TOKEN_INDEX_NONE) {
+                break;
+            }
+            if (++arity - method > 255) {
+                parser_error_at(p, param, "Can't have more than 255 parameters.");
+            }
+            ast_push(&p->ast, STMT_PARAM, param, intern_str(token_stream_lexeme(p->tokens, param)));
+        } while (match_any(p, TOKEN_BIT(TOKEN_COMMA)));
     }
-    return primary(p);
+    consume(p, TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+    consume(p, TOKEN_LEFT_BRACE, method ? "Expect '{' before method body." : "Expect '{' before function body.");
+    const OpenStmt fn = {STMT_FUNCTION, node, arity, name};
+    arr_push(p->open, fn);
+    p->functions++;
 }
 
-Expr *multiplication(Parser *p)
+// `fn f(a, b) {`
+static void fn_declaration(Parser *p)
 {
-    Expr *e = unary(p);
-    while (match(p, 2, TOKEN_SLASH, TOKEN_STAR)) {
-        Token *op = p->cursor-1;
-        Expr *rhs = unary(p);
-        e = make_binary_expr(e, op, rhs);
+    parser_advance(p);
+    const int name = consume(p, TOKEN_IDENTIFIER, "Expect function name.");
+    if (name != TOKEN_INDEX_NONE) {
+        fn_header(p, name, false);
     }
-    return e;
 }
 
-Expr *addition(Parser *p)
+// In a class's body: `m(a, b) {` or the class's `}`
+static void class_member(Parser *p)
 {
-    Expr *e = multiplication(p);
-    while (match(p, 2, TOKEN_MINUS, TOKEN_PLUS)) {
-        Token *op = p->cursor-1;
-        Expr *rhs = multiplication(p);
-        e = make_binary_expr(e, op, rhs);
+    if (check(p, TOKEN_RIGHT_BRACE)) {
+        class_end(p);
+        return;
+    }
+    const int name = consume(p, TOKEN_IDENTIFIER, "Expect method name.");
+    if (name != TOKEN_INDEX_NONE) {
+        fn_header(p, name, true);
     }
-    return e;
 }
 
-Expr *comparison(Parser *p)
+// The end of a function's body defines the function, or a method's adds it
+// to its class
+static void fn_end(Parser *p)
 {
-    Expr *e = addition(p);
-    while (match(p, 4, TOKEN_GREATER, TOKEN_GREATER_EQUAL, TOKEN_LESS, TOKEN_LESS_EQUAL)) {
-        Token *op = p->cursor-1;
-        Expr *rhs = addition(p);
-        e = make_binary_expr(e, op, rhs);
+    const OpenStmt fn = arr_pop(p->open);
+    p->functions--;
+    parser_advance(p);
+    p->ast.args[fn.node] = ast_push(&p->ast, EXPR_FUNCTION, fn.token, fn.start);
+    if (!arr_empty(p->open) && arr_last(p->open).type == EXPR_CLASS) {
+        ast_push(&p->ast, STMT_METHOD, fn.token, 0);
+        return;
     }
-    return e;
+    ast_push(&p->ast, STMT_VAR, fn.token, intern_str(token_stream_lexeme(p->tokens, fn.token)));
 }
 
-Expr *equality(Parser *p)
+// `return value;`; a call it returns the value of directly becomes a tail call
+static void return_statement(Parser *p)
 {
-    Expr *e = comparison(p);
-    while (match(p, 2, TOKEN_EQUAL_EQUAL, TOKEN_BANG_EQUAL)) {
-        Token *op = p->cursor-1;
-        Expr *rhs = comparison(p);
-        e = make_binary_expr(e, op, rhs);
+    const int t = parser_advance(p);
+    if (!p->functions) {
+        parser_error_at(p, t, "Can't return from top-level code.");
     }
-    return e;
+    if (check(p, TOKEN_SEMICOLON)) {
+        ast_push(&p->ast, EXPR_NIL, t, 0);
+    } else {
+        int value = expression(p);
+        while (p->ast.types[value] == EXPR_LOGICAL || p->ast.types[value] == EXPR_GROUPING) {
+            value--; // the rhs, or the operand
+        }
+        if (p->ast.types[value] == EXPR_CALL) {
+            p->ast.types[value] = EXPR_TAIL_CALL;
+        }
+    }
+    consume(p, TOKEN_SEMICOLON, "Expect ';' after return value.");
+    ast_push(&p->ast, STMT_RETURN, t, 0);
 }
 
-Expr *expression(Parser *p)
+// Parses one statement, or the start or end of one that contains statements
+static void statement(Parser *p)
 {
-    return equality(p);
+    if (!arr_empty(p->open) && arr_last(p->open).type == EXPR_CLASS) {
+        class_member(p);
+        return;
+    }
+    const bool body = !arr_empty(p->open) && arr_last(p->open).type == STMT_WHILE_TEST;
+    switch (peek(p)) {
+        case TOKEN_VAR:
+            if (body) { // a declaration is not a statement
+                parser_error(p, "Expect expression.");
+                return;
+            }
+            var_declaration(p);
+            break;
+
+        case TOKEN_CLASS:
+            if (body) {
+                parser_error(p, "Expect expression.");
+                return;
+            }
+            class_declaration(p);
+            break;
+
+        case TOKEN_FN:
+            if (body) {
+                parser_error(p, "Expect expression.");
+                return;
+            }
+            fn_declaration(p);
+            return;
+
+        case TOKEN_RETURN:
+            return_statement(p);
+            break;
+
+        case TOKEN_PRINT: {
+            const int t = parser_advance(p);
+            expression(p);
+            consume(p, TOKEN_SEMICOLON, "Expect ';' after value.");
+            ast_push(&p->ast, STMT_PRINT, t, 0);
+            break;
+        }
+
+        case TOKEN_LEFT_BRACE: {
+            const int t = parser_advance(p);
+            const OpenStmt block = {STMT_BLOCK_BEGIN, ast_push(&p->ast, STMT_BLOCK_BEGIN, t, 0), 0, t};
+            arr_push(p->open, block);
+            return;
+        }
+
+        case TOKEN_RIGHT_BRACE:
+            if (arr_empty(p->open) || body) {
+                parser_error(p, "Expect expression.");
+                return;
+            }
+            if (arr_last(p->open).type == STMT_FUNCTION) {
+                fn_end(p);
+                break;
+            }
+            (void) arr_pop(p->open);
+            ast_push(&p->ast, STMT_BLOCK_END, parser_advance(p), 0);
+            break;
+
+        case TOKEN_WHILE: {
+            const int t = parser_advance(p);
+            consume(p, TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
+            const int start = p->ast.count;
+            expression(p);
+            const int paren = consume(p, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+            const int test = ast_push(&p->ast, STMT_WHILE_TEST, paren == TOKEN_INDEX_NONE ? t : paren, 0);
+            const OpenStmt loop = {STMT_WHILE_TEST, test, start, t};
+            arr_push(p->open, loop);
+            return;
+        }
+
+        default:
+            expression(p);
+            if (check(p, TOKEN_SEMICOLON)) {
+                ast_push(&p->ast, STMT_EXPRESSION, parser_advance(p), 0);
+            } else if (p->eof && arr_empty(p->open)) {
+                ast_push(&p->ast, STMT_RESULT, p->previous + 1, 0); // right after the expression
+            } else {
+                parser_error(p, "Expect ';' after expression.");
+            }
+    }
+
+    // A complete statement completes the loops it is the body of
+    while (!arr_empty(p->open) && arr_last(p->open).type == STMT_WHILE_TEST) {
+        const OpenStmt loop = arr_pop(p->open);
+        p->ast.args[loop.node] = ast_push(&p->ast, STMT_WHILE, loop.token, loop.start);
+    }
 }
 
-Expr *parse(Parser *p, Token *tokens)
+// The statements from the cursor to the end of the tokens
+static void parse_statements(Parser *p)
 {
-    if (tokens->type == TOKEN_NONE) {
+    parser_skip_comments(p);
+    p->panic = false;
+    arr_reset(p->ops);
+    arr_reset(p->operands);
+    arr_reset(p->open);
+    p->functions = 0;
+
+    while (!p->eof) {
+        const int start = p->cursor;
+        statement(p);
+        if (p->panic) {
+            // Skip the rest of the statement, unless it was all consumed
+            if (!p->eof && (p->cursor == start || p->types[p->previous] != TOKEN_SEMICOLON)) {
+                synchronize(p);
+            }
+            p->panic = false;
+        }
+    }
+    if (!arr_empty(p->open) && !had_error) { // else likely left open by the error
+        const uint8_t type = arr_last(p->open).type;
+        parser_error(p, type == STMT_WHILE_TEST ? "Expect expression."
+                : type == STMT_FUNCTION ? "Expect '}' after function body."
+                : type == EXPR_CLASS ? "Expect '}' after class body." : "Expect '}' after block.");
+    }
+}
+
+//
+// Parses a program: declarations and statements, the last of which may be an
+// expression without a `;` whose value is the program's result.
+//
+// Like expressions, statements are parsed without recursion: a block or a
+// loop is pushed on the `open` stack when it starts, and statements complete
+// whatever is on top of it, so blocks nest as deep as memory allows. A
+// function's body is open the same way, from its header to its `}`, and so is
+// a class's, whose statements are its methods. After an
+// error the parser skips to the next statement and carries on, to report
+// errors that are independent of it.
+//
+// Returns the program's nodes, or NULL if it could not be scanned.
+//
+const Ast *parse(Parser *restrict p, const TokenStream *restrict tokens)
+{
+    if (!tokens) {
         had_error = true;
         return NULL;
     }
     p->tokens = tokens;
-    p->cursor = p->tokens;
-    p->eof = false;
-    exprs_count = 0;
+    p->types = tokens->types;
+    p->cursor = 0;
+    p->previous = -1;
+    p->numbers = 0;
+    ast_init(&p->ast, 2 * token_stream_count(tokens), arr_count(tokens->numbers));
+    parse_statements(p);
+    return &p->ast;
+}
 
-    Expr *e = expression(p);
-    if (e->type == EXPR_NONE) {
-        return NULL;
+//
+// Parse the tokens from `first` on as more statements of the program whose
+// nodes are in `p->ast` (the REPL's new line after the lines before it),
+// appending their nodes. The tokens before `first` must be the ones that
+// program was parsed from; `tokens` may have moved since.
+//
+const Ast *parse_more(Parser *restrict p, const TokenStream *restrict tokens, const int first)
+{
+    if (!tokens || !first) {
+        return parse(p, tokens);
+    }
+    p->tokens = tokens;
+    p->types = tokens->types;
+    p->cursor = first;
+    p->previous = first - 1;
+    const int count = token_stream_count(tokens);
+    int numbers = 0;
+    for (int i = first; i < count; ++i) {
+        numbers += p->types[i] == TOKEN_NUMBER;
     }
-    return e;
+    p->numbers = arr_count(tokens->numbers) - numbers;
+    ast_reserve(&p->ast, 2 * (count - first), numbers);
+    parse_statements(p);
+    return &p->ast;
 }
@@ -0,0 +1,198 @@
+#define POOL_C
+
+#ifndef COMMON_H
+#include "common.h"
+#endif
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+//
+// Fixed-size work-stealing thread pool running "parallel for" batches.
+//
+// `pool_run` splits the task indices [0, num_tasks) into one contiguous range
+// per thread. A thread takes tasks from the front of its own range; once it
+// runs out, it steals the back half of another thread's range, so threads
+// that finish early (or got cheap tasks) take over work from the others
+// without contending on a shared counter. The calling thread works on the
+// batch too and `pool_run` returns once every task has finished. Batches are
+// run one at a time.
+//
+typedef void (*PoolTask)(void *ctx, int i);
+
+// A range of task indices [begin, end), packed into one word so it can be
+// updated with a single compare-and-swap
+typedef _Atomic uint64_t PoolRange;
+
+#define POOL_RANGE(begin, end) ((uint64_t) (uint32_t) (end) << 32 | (uint32_t) (begin))
+#define POOL_BEGIN(r)          ((int) (uint32_t) (r))
+#define POOL_END(r)            ((int) (uint32_t) ((r) >> 32))
+
+typedef struct {
+    pthread_t *workers; // arr
+    pthread_mutex_t lock;
+    pthread_cond_t batch_ready;
+    pthread_cond_t batch_done;
+    unsigned batch;     // incremented for every batch; wakes the workers
+    int busy;           // workers still working on the current batch
+    bool stop;
+
+    PoolTask task;
+    void *ctx;
+    PoolRange *ranges;  // the tasks left to each thread; 0 is the caller's
+    atomic_int next_id; // hands out worker ids
+} ThreadPool;
+
+// Number of online CPUs (at least 1)
+int pool_num_cpus(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+}
+
+int pool_num_threads(const ThreadPool *pool)
+{
+    return arr_count(pool->workers) + 1;
+}
+
+// Take the first task of thread `id`'s range; returns -1 if it is empty
+static int pool_take(ThreadPool *pool, const int id)
+{
+    PoolRange *own = &pool->ranges[id];
+    uint64_t r = atomic_load(own);
+    while (POOL_BEGIN(r) < POOL_END(r)) {
+        if (atomic_compare_exchange_weak(own, &r, POOL_RANGE(POOL_BEGIN(r) + 1, POOL_END(r)))) {
+            return POOL_BEGIN(r);
+        }
+    }
+    return -1;
+}
+
+// Move the back half of another thread's range into thread `id`'s empty one;
+// returns false if there was nothing left to steal
+static bool pool_steal(ThreadPool *pool, const int id)
+{
+    const int n = pool_num_threads(pool);
+    for (int k = 1; k < n; ++k) {
+        PoolRange *victim = &pool->ranges[(id + k) % n];
+        uint64_t r = atomic_load(victim);
+        while (POOL_BEGIN(r) < POOL_END(r)) {
+            const int mid = POOL_END(r) - (POOL_END(r) - POOL_BEGIN(r) + 1) / 2;
+            if (atomic_compare_exchange_weak(victim, &r, POOL_RANGE(POOL_BEGIN(r), mid))) {
+                atomic_store(&pool->ranges[id], POOL_RANGE(mid, POOL_END(r)));
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void pool_work(ThreadPool *pool, const int id)
+{
+    do {
+        int i;
+        while ((i = pool_take(pool, id)) >= 0) {
+            pool->task(pool->ctx, i);
+        }
+    } while (pool_steal(pool, id));
+}
+
+static void *pool_worker(void *arg)
+{
+    ThreadPool *pool = arg;
+    const int id = atomic_fetch_add(&pool->next_id, 1);
+    unsigned seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->batch == seen && !pool->stop) {
+            pthread_cond_wait(&pool->batch_ready, &pool->lock);
+        }
+        if (pool->stop) {
+            break;
+        }
+        seen = pool->batch;
+        pthread_mutex_unlock(&pool->lock);
+
+        pool_work(pool, id);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) {
+            pthread_cond_signal(&pool->batch_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// Start a pool of `num_threads` threads, counting the caller; 0 means one per CPU
+void pool_init(ThreadPool *pool, int num_threads)
+{
+    memset(pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->batch_ready, NULL);
+    pthread_cond_init(&pool->batch_done, NULL);
+    atomic_init(&pool->next_id, 1);
+
+    if (num_threads <= 0) {
+        num_threads = pool_num_cpus();
+    }
+    pool->ranges = calloc(num_threads, sizeof(*pool->ranges));
+    for (int i = 1; i < num_threads; ++i) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, pool_worker, pool) != 0) {
+            break; // run with the threads we have
+        }
+        arr_push(pool->workers, t);
+    }
+}
+
+// Run `task(ctx, i)` for every i in [0, num_tasks) and wait for all of them
+void pool_run(ThreadPool *restrict pool, const int num_tasks, PoolTask task, void *restrict ctx)
+{
+    pool->task = task;
+    pool->ctx = ctx;
+    if (arr_empty(pool->workers) || num_tasks == 1) {
+        atomic_store(&pool->ranges[0], POOL_RANGE(0, num_tasks));
+        pool_work(pool, 0);
+        return;
+    }
+    const int n = pool_num_threads(pool);
+    for (int t = 0; t < n; ++t) {
+        atomic_store(&pool->ranges[t], POOL_RANGE((long) num_tasks * t / n,
+                (long) num_tasks * (t + 1) / n));
+    }
+
+
+    pthread_mutex_lock(&pool->lock);
+    pool->busy = arr_count(pool->workers);
+    pool->batch++;
+    pthread_cond_broadcast(&pool->batch_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    pool_work(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0) {
+        pthread_cond_wait(&pool->batch_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_destroy(ThreadPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->batch_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < arr_count(pool->workers); ++i) {
+        pthread_join(pool->workers[i], NULL);
+    }
+    arr_free(pool->workers);
+    pool->workers = NULL;
+    free(pool->ranges);
+    pool->ranges = NULL;
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->batch_ready);
+    pthread_cond_destroy(&pool->batch_done);
+}
@@ -0,0 +1,363 @@
+//
+// 128-bit approximations of 5^q for q in [POW5_MIN_Q, POW5_MAX_Q], used by the
+// Eisel-Lemire number parser in number.c. Generated; do not edit.
+//
+// For q >= 0, 5^q shifted into [2^127, 2^128) and truncated.
+// For q < 0, 2^b / 5^-q + 1 (b chosen so the result has 128 significant
+// bits), truncated to 128 bits. Each entry is {high 64 bits, low 64 bits}.
+//
+// See Daniel Lemire, "Number Parsing at a Gigabyte per Second" (2021).
+//
+#ifndef POW5_H
+#define POW5_H
+
+#define POW5_MIN_Q (-342)
+#define POW5_MAX_Q 0
+
+static const uint64_t pow5_128[POW5_MAX_Q - POW5_MIN_Q + 1][2] = {
+    {0xeef453d6923bd65a, 0x113faa2906a13b3f}, // 5^-342
+    {0x9558b4661b6565f8, 0x4ac7ca59a424c507}, // 5^-341
+    {0xbaaee17fa23ebf76, 0x5d79bcf00d2df649}, // 5^-340
+    {0xe95a99df8ace6f53, 0xf4d82c2c107973dc}, // 5^-339
+    {0x91d8a02bb6c10594, 0x79071b9b8a4be869}, // 5^-338
+    {0xb64ec836a47146f9, 0x9748e2826cdee284}, // 5^-337
+    {0xe3e27a444d8d98b7, 0xfd1b1b2308169b25}, // 5^-336
+    {0x8e6d8c6ab0787f72, 0xfe30f0f5e50e20f7}, // 5^-335
+    {0xb208ef855c969f4f, 0xbdbd2d335e51a935}, // 5^-334
+    {0xde8b2b66b3bc4723, 0xad2c788035e61382}, // 5^-333
+    {0x8b16fb203055ac76, 0x4c3bcb5021afcc31}, // 5^-332
+    {0xaddcb9e83c6b1793, 0xdf4abe242a1bbf3d}, // 5^-331
+    {0xd953e8624b85dd78, 0xd71d6dad34a2af0d}, // 5^-330
+    {0x87d4713d6f33aa6b, 0x8672648c40e5ad68}, // 5^-329
+    {0xa9c98d8ccb009506, 0x680efdaf511f18c2}, // 5^-328
+    {0xd43bf0effdc0ba48, 0x0212bd1b2566def2}, // 5^-327
+    {0x84a57695fe98746d, 0x014bb630f7604b57}, // 5^-326
+    {0xa5ced43b7e3e9188, 0x419ea3bd35385e2d}, // 5^-325
+    {0xcf42894a5dce35ea, 0x52064cac828675b9}, // 5^-324
+    {0x818995ce7aa0e1b2, 0x7343efebd1940993}, // 5^-323
+    {0xa1ebfb4219491a1f, 0x1014ebe6c5f90bf8}, // 5^-322
+    {0xca66fa129f9b60a6, 0xd41a26e077774ef6}, // 5^-321
+    {0xfd00b897478238d0, 0x8920b098955522b4}, // 5^-320
+    {0x9e20735e8cb16382, 0x55b46e5f5d5535b0}, // 5^-319
+    {0xc5a890362fddbc62, 0xeb2189f734aa831d}, // 5^-318
+    {0xf712b443bbd52b7b, 0xa5e9ec7501d523e4}, // 5^-317
+    {0x9a6bb0aa55653b2d, 0x47b233c92125366e}, // 5^-316
+    {0xc1069cd4eabe89f8, 0x999ec0bb696e840a}, // 5^-315
+    {0xf148440a256e2c76, 0xc00670ea43ca250d}, // 5^-314
+    {0x96cd2a865764dbca, 0x380406926a5e5728}, // 5^-313
+    {0xbc807527ed3e12bc, 0xc605083704f5ecf2}, // 5^-312
+    {0xeba09271e88d976b, 0xf7864a44c633682e}, // 5^-311
+    {0x93445b8731587ea3, 0x7ab3ee6afbe0211d}, // 5^-310
+    {0xb8157268fdae9e4c, 0x5960ea05bad82964}, // 5^-309
+    {0xe61acf033d1a45df, 0x6fb92487298e33bd}, // 5^-308
+    {0x8fd0c16206306bab, 0xa5d3b6d479f8e056}, // 5^-307
+    {0xb3c4f1ba87bc8696, 0x8f48a4899877186c}, // 5^-306
+    {0xe0b62e2929aba83c, 0x331acdabfe94de87}, // 5^-305
+    {0x8c71dcd9ba0b4925, 0x9ff0c08b7f1d0b14}, // 5^-304
+    {0xaf8e5410288e1b6f, 0x07ecf0ae5ee44dd9}, // 5^-303
+    {0xdb71e91432b1a24a, 0xc9e82cd9f69d6150}, // 5^-302
+    {0x892731ac9faf056e, 0xbe311c083a225cd2}, // 5^-301
+    {0xab70fe17c79ac6ca, 0x6dbd630a48aaf406}, // 5^-300
+    {0xd64d3d9db981787d, 0x092cbbccdad5b108}, // 5^-299
+    {0x85f0468293f0eb4e, 0x25bbf56008c58ea5}, // 5^-298
+    {0xa76c582338ed2621, 0xaf2af2b80af6f24e}, // 5^-297
+    {0xd1476e2c07286faa, 0x1af5af660db4aee1}, // 5^-296
+    {0x82cca4db847945ca, 0x50d98d9fc890ed4d}, // 5^-295
+    {0xa37fce126597973c, 0xe50ff107bab528a0}, // 5^-294
+    {0xcc5fc196fefd7d0c, 0x1e53ed49a96272c8}, // 5^-293
+    {0xff77b1fcbebcdc4f, 0x25e8e89c13bb0f7a}, // 5^-292
+    {0x9faacf3df73609b1, 0x77b191618c54e9ac}, // 5^-291
+    {0xc795830d75038c1d, 0xd59df5b9ef6a2417}, // 5^-290
+    {0xf97ae3d0d2446f25, 0x4b0573286b44ad1d}, // 5^-289
+    {0x9becce62836ac577, 0x4ee367f9430aec32}, // 5^-288
+    {0xc2e801fb244576d5, 0x229c41f793cda73f}, // 5^-287
+    {0xf3a20279ed56d48a, 0x6b43527578c1110f}, // 5^-286
+    {0x9845418c345644d6, 0x830a13896b78aaa9}, // 5^-285
+    {0xbe5691ef416bd60c, 0x23cc986bc656d553}, // 5^-284
+    {0xedec366b11c6cb8f, 0x2cbfbe86b7ec8aa8}, // 5^-283
+    {0x94b3a202eb1c3f39, 0x7bf7d71432f3d6a9}, // 5^-282
+    {0xb9e08a83a5e34f07, 0xdaf5ccd93fb0cc53}, // 5^-281
+    {0xe858ad248f5c22c9, 0xd1b3400f8f9cff68}, // 5^-280
+    {0x91376c36d99995be, 0x23100809b9c21fa1}, // 5^-279
+    {0xb58547448ffffb2d, 0xabd40a0c2832a78a}, // 5^-278
+    {0xe2e69915b3fff9f9, 0x16c90c8f323f516c}, // 5^-277
+    {0x8dd01fad907ffc3b, 0xae3da7d97f6792e3}, // 5^-276
+    {0xb1442798f49ffb4a, 0x99cd11cfdf41779c}, // 5^-275
+    {0xdd95317f31c7fa1d, 0x40405643d711d583}, // 5^-274
+    {0x8a7d3eef7f1cfc52, 0x482835ea666b2572}, // 5^-273
+    {0xad1c8eab5ee43b66, 0xda3243650005eecf}, // 5^-272
+    {0xd863b256369d4a40, 0x90bed43e40076a82}, // 5^-271
+    {0x873e4f75e2224e68, 0x5a7744a6e804a291}, // 5^-270
+    {0xa90de3535aaae202, 0x711515d0a205cb36}, // 5^-269
+    {0xd3515c2831559a83, 0x0d5a5b44ca873e03}, // 5^-268
+    {0x8412d9991ed58091, 0xe858790afe9486c2}, // 5^-267
+    {0xa5178fff668ae0b6, 0x626e974dbe39a872}, // 5^-266
+    {0xce5d73ff402d98e3, 0xfb0a3d212dc8128f}, // 5^-265
+    {0x80fa687f881c7f8e, 0x7ce66634bc9d0b99}, // 5^-264
+    {0xa139029f6a239f72, 0x1c1fffc1ebc44e80}, // 5^-263
+    {0xc987434744ac874e, 0xa327ffb266b56220}, // 5^-262
+    {0xfbe9141915d7a922, 0x4bf1ff9f0062baa8}, // 5^-261
+    {0x9d71ac8fada6c9b5, 0x6f773fc3603db4a9}, // 5^-260
+    {0xc4ce17b399107c22, 0xcb550fb4384d21d3}, // 5^-259
+    {0xf6019da07f549b2b, 0x7e2a53a146606a48}, // 5^-258
+    {0x99c102844f94e0fb, 0x2eda7444cbfc426d}, // 5^-257
+    {0xc0314325637a1939, 0xfa911155fefb5308}, // 5^-256
+    {0xf03d93eebc589f88, 0x793555ab7eba27ca}, // 5^-255
+    {0x96267c7535b763b5, 0x4bc1558b2f3458de}, // 5^-254
+    {0xbbb01b9283253ca2, 0x9eb1aaedfb016f16}, // 5^-253
+    {0xea9c227723ee8bcb, 0x465e15a979c1cadc}, // 5^-252
+    {0x92a1958a7675175f, 0x0bfacd89ec191ec9}, // 5^-251
+    {0xb749faed14125d36, 0xcef980ec671f667b}, // 5^-250
+    {0xe51c79a85916f484, 0x82b7e12780e7401a}, // 5^-249
+    {0x8f31cc0937ae58d2, 0xd1b2ecb8b0908810}, // 5^-248
+    {0xb2fe3f0b8599ef07, 0x861fa7e6dcb4aa15}, // 5^-247
+    {0xdfbdcece67006ac9, 0x67a791e093e1d49a}, // 5^-246
+    {0x8bd6a141006042bd, 0xe0c8bb2c5c6d24e0}, // 5^-245
+    {0xaecc49914078536d, 0x58fae9f773886e18}, // 5^-244
+    {0xda7f5bf590966848, 0xaf39a475506a899e}, // 5^-243
+    {0x888f99797a5e012d, 0x6d8406c952429603}, // 5^-242
+    {0xaab37fd7d8f58178, 0xc8e5087ba6d33b83}, // 5^-241
+    {0xd5605fcdcf32e1d6, 0xfb1e4a9a90880a64}, // 5^-240
+    {0x855c3be0a17fcd26, 0x5cf2eea09a55067f}, // 5^-239
+    {0xa6b34ad8c9dfc06f, 0xf42faa48c0ea481e}, // 5^-238
+    {0xd0601d8efc57b08b, 0xf13b94daf124da26}, // 5^-237
+    {0x823c12795db6ce57, 0x76c53d08d6b70858}, // 5^-236
+    {0xa2cb1717b52481ed, 0x54768c4b0c64ca6e}, // 5^-235
+    {0xcb7ddcdda26da268, 0xa9942f5dcf7dfd09}, // 5^-234
+    {0xfe5d54150b090b02, 0xd3f93b35435d7c4c}, // 5^-233
+    {0x9efa548d26e5a6e1, 0xc47bc5014a1a6daf}, // 5^-232
+    {0xc6b8e9b0709f109a, 0x359ab6419ca1091b}, // 5^-231
+    {0xf867241c8cc6d4c0, 0xc30163d203c94b62}, // 5^-230
+    {0x9b407691d7fc44f8, 0x79e0de63425dcf1d}, // 5^-229
+    {0xc21094364dfb5636, 0x985915fc12f542e4}, // 5^-228
+    {0xf294b943e17a2bc4, 0x3e6f5b7b17b2939d}, // 5^-227
+    {0x979cf3ca6cec5b5a, 0xa705992ceecf9c42}, // 5^-226
+    {0xbd8430bd08277231, 0x50c6ff782a838353}, // 5^-225
+    {0xece53cec4a314ebd, 0xa4f8bf5635246428}, // 5^-224
+    {0x940f4613ae5ed136, 0x871b7795e136be99}, // 5^-223
+    {0xb913179899f68584, 0x28e2557b59846e3f}, // 5^-222
+    {0xe757dd7ec07426e5, 0x331aeada2fe589cf}, // 5^-221
+    {0x9096ea6f3848984f, 0x3ff0d2c85def7621}, // 5^-220
+    {0xb4bca50b065abe63, 0x0fed077a756b53a9}, // 5^-219
+    {0xe1ebce4dc7f16dfb, 0xd3e8495912c62894}, // 5^-218
+    {0x8d3360f09cf6e4bd, 0x64712dd7abbbd95c}, // 5^-217
+    {0xb080392cc4349dec, 0xbd8d794d96aacfb3}, // 5^-216
+    {0xdca04777f541c567, 0xecf0d7a0fc5583a0}, // 5^-215
+    {0x89e42caaf9491b60, 0xf41686c49db57244}, // 5^-214
+    {0xac5d37d5b79b6239, 0x311c2875c522ced5}, // 5^-213
+    {0xd77485cb25823ac7, 0x7d633293366b828b}, // 5^-212
+    {0x86a8d39ef77164bc, 0xae5dff9c02033197}, // 5^-211
+    {0xa8530886b54dbdeb, 0xd9f57f830283fdfc}, // 5^-210
+    {0xd267caa862a12d66, 0xd072df63c324fd7b}, // 5^-209
+    {0x8380dea93da4bc60, 0x4247cb9e59f71e6d}, // 5^-208
+    {0xa46116538d0deb78, 0x52d9be85f074e608}, // 5^-207
+    {0xcd795be870516656, 0x67902e276c921f8b}, // 5^-206
+    {0x806bd9714632dff6, 0x00ba1cd8a3db53b6}, // 5^-205
+    {0xa086cfcd97bf97f3, 0x80e8a40eccd228a4}, // 5^-204
+    {0xc8a883c0fdaf7df0, 0x6122cd128006b2cd}, // 5^-203
+    {0xfad2a4b13d1b5d6c, 0x796b805720085f81}, // 5^-202
+    {0x9cc3a6eec6311a63, 0xcbe3303674053bb0}, // 5^-201
+    {0xc3f490aa77bd60fc, 0xbedbfc4411068a9c}, // 5^-200
+    {0xf4f1b4d515acb93b, 0xee92fb5515482d44}, // 5^-199
+    {0x991711052d8bf3c5, 0x751bdd152d4d1c4a}, // 5^-198
+    {0xbf5cd54678eef0b6, 0xd262d45a78a0635d}, // 5^-197
+    {0xef340a98172aace4, 0x86fb897116c87c34}, // 5^-196
+    {0x9580869f0e7aac0e, 0xd45d35e6ae3d4da0}, // 5^-195
+    {0xbae0a846d2195712, 0x8974836059cca109}, // 5^-194
+    {0xe998d258869facd7, 0x2bd1a438703fc94b}, // 5^-193
+    {0x91ff83775423cc06, 0x7b6306a34627ddcf}, // 5^-192
+    {0xb67f6455292cbf08, 0x1a3bc84c17b1d542}, // 5^-191
+    {0xe41f3d6a7377eeca, 0x20caba5f1d9e4a93}, // 5^-190
+    {0x8e938662882af53e, 0x547eb47b7282ee9c}, // 5^-189
+    {0xb23867fb2a35b28d, 0xe99e619a4f23aa43}, // 5^-188
+    {0xdec681f9f4c31f31, 0x6405fa00e2ec94d4}, // 5^-187
+    {0x8b3c113c38f9f37e, 0xde83bc408dd3dd04}, // 5^-186
+    {0xae0b158b4738705e, 0x9624ab50b148d445}, // 5^-185
+    {0xd98ddaee19068c76, 0x3badd624dd9b0957}, // 5^-184
+    {0x87f8a8d4cfa417c9, 0xe54ca5d70a80e5d6}, // 5^-183
+    {0xa9f6d30a038d1dbc, 0x5e9fcf4ccd211f4c}, // 5^-182
+    {0xd47487cc8470652b, 0x7647c3200069671f}, // 5^-181
+    {0x84c8d4dfd2c63f3b, 0x29ecd9f40041e073}, // 5^-180
+    {0xa5fb0a17c777cf09, 0xf468107100525890}, // 5^-179
+    {0xcf79cc9db955c2cc, 0x7182148d4066eeb4}, // 5^-178
+    {0x81ac1fe293d599bf, 0xc6f14cd848405530}, // 5^-177
+    {0xa21727db38cb002f, 0xb8ada00e5a506a7c}, // 5^-176
+    {0xca9cf1d206fdc03b, 0xa6d90811f0e4851c}, // 5^-175
+    {0xfd442e4688bd304a, 0x908f4a166d1da663}, // 5^-174
+    {0x9e4a9cec15763e2e, 0x9a598e4e043287fe}, // 5^-173
+    {0xc5dd44271ad3cdba, 0x40eff1e1853f29fd}, // 5^-172
+    {0xf7549530e188c128, 0xd12bee59e68ef47c}, // 5^-171
+    {0x9a94dd3e8cf578b9, 0x82bb74f8301958ce}, // 5^-170
+    {0xc13a148e3032d6e7, 0xe36a52363c1faf01}, // 5^-169
+    {0xf18899b1bc3f8ca1, 0xdc44e6c3cb279ac1}, // 5^-168
+    {0x96f5600f15a7b7e5, 0x29ab103a5ef8c0b9}, // 5^-167
+    {0xbcb2b812db11a5de, 0x7415d448f6b6f0e7}, // 5^-166
+    {0xebdf661791d60f56, 0x111b495b3464ad21}, // 5^-165
+    {0x936b9fcebb25c995, 0xcab10dd900beec34}, // 5^-164
+    {0xb84687c269ef3bfb, 0x3d5d514f40eea742}, // 5^-163
+    {0xe65829b3046b0afa, 0x0cb4a5a3112a5112}, // 5^-162
+    {0x8ff71a0fe2c2e6dc, 0x47f0e785eaba72ab}, // 5^-161
+    {0xb3f4e093db73a093, 0x59ed216765690f56}, // 5^-160
+    {0xe0f218b8d25088b8, 0x306869c13ec3532c}, // 5^-159
+    {0x8c974f7383725573, 0x1e414218c73a13fb}, // 5^-158
+    {0xafbd2350644eeacf, 0xe5d1929ef90898fa}, // 5^-157
+    {0xdbac6c247d62a583, 0xdf45f746b74abf39}, // 5^-156
+    {0x894bc396ce5da772, 0x6b8bba8c328eb783}, // 5^-155
+    {0xab9eb47c81f5114f, 0x066ea92f3f326564}, // 5^-154
+    {0xd686619ba27255a2, 0xc80a537b0efefebd}, // 5^-153
+    {0x8613fd0145877585, 0xbd06742ce95f5f36}, // 5^-152
+    {0xa798fc4196e952e7, 0x2c48113823b73704}, // 5^-151
+    {0xd17f3b51fca3a7a0, 0xf75a15862ca504c5}, // 5^-150
+    {0x82ef85133de648c4, 0x9a984d73dbe722fb}, // 5^-149
+    {0xa3ab66580d5fdaf5, 0xc13e60d0d2e0ebba}, // 5^-148
+    {0xcc963fee10b7d1b3, 0x318df905079926a8}, // 5^-147
+    {0xffbbcfe994e5c61f, 0xfdf17746497f7052}, // 5^-146
+    {0x9fd561f1fd0f9bd3, 0xfeb6ea8bedefa633}, // 5^-145
+    {0xc7caba6e7c5382c8, 0xfe64a52ee96b8fc0}, // 5^-144
+    {0xf9bd690a1b68637b, 0x3dfdce7aa3c673b0}, // 5^-143
+    {0x9c1661a651213e2d, 0x06bea10ca65c084e}, // 5^-142
+    {0xc31bfa0fe5698db8, 0x486e494fcff30a62}, // 5^-141
+    {0xf3e2f893dec3f126, 0x5a89dba3c3efccfa}, // 5^-140
+    {0x986ddb5c6b3a76b7, 0xf89629465a75e01c}, // 5^-139
+    {0xbe89523386091465, 0xf6bbb397f1135823}, // 5^-138
+    {0xee2ba6c0678b597f, 0x746aa07ded582e2c}, // 5^-137
+    {0x94db483840b717ef, 0xa8c2a44eb4571cdc}, // 5^-136
+    {0xba121a4650e4ddeb, 0x92f34d62616ce413}, // 5^-135
+    {0xe896a0d7e51e1566, 0x77b020baf9c81d17}, // 5^-134
+    {0x915e2486ef32cd60, 0x0ace1474dc1d122e}, // 5^-133
+    {0xb5b5ada8aaff80b8, 0x0d819992132456ba}, // 5^-132
+    {0xe3231912d5bf60e6, 0x10e1fff697ed6c69}, // 5^-131
+    {0x8df5efabc5979c8f, 0xca8d3ffa1ef463c1}, // 5^-130
+    {0xb1736b96b6fd83b3, 0xbd308ff8a6b17cb2}, // 5^-129
+    {0xddd0467c64bce4a0, 0xac7cb3f6d05ddbde}, // 5^-128
+    {0x8aa22c0dbef60ee4, 0x6bcdf07a423aa96b}, // 5^-127
+    {0xad4ab7112eb3929d, 0x86c16c98d2c953c6}, // 5^-126
+    {0xd89d64d57a607744, 0xe871c7bf077ba8b7}, // 5^-125
+    {0x87625f056c7c4a8b, 0x11471cd764ad4972}, // 5^-124
+    {0xa93af6c6c79b5d2d, 0xd598e40d3dd89bcf}, // 5^-123
+    {0xd389b47879823479, 0x4aff1d108d4ec2c3}, // 5^-122
+    {0x843610cb4bf160cb, 0xcedf722a585139ba}, // 5^-121
+    {0xa54394fe1eedb8fe, 0xc2974eb4ee658828}, // 5^-120
+    {0xce947a3da6a9273e, 0x733d226229feea32}, // 5^-119
+    {0x811ccc668829b887, 0x0806357d5a3f525f}, // 5^-118
+    {0xa163ff802a3426a8, 0xca07c2dcb0cf26f7}, // 5^-117
+    {0xc9bcff6034c13052, 0xfc89b393dd02f0b5}, // 5^-116
+    {0xfc2c3f3841f17c67, 0xbbac2078d443ace2}, // 5^-115
+    {0x9d9ba7832936edc0, 0xd54b944b84aa4c0d}, // 5^-114
+    {0xc5029163f384a931, 0x0a9e795e65d4df11}, // 5^-113
+    {0xf64335bcf065d37d, 0x4d4617b5ff4a16d5}, // 5^-112
+    {0x99ea0196163fa42e, 0x504bced1bf8e4e45}, // 5^-111
+    {0xc06481fb9bcf8d39, 0xe45ec2862f71e1d6}, // 5^-110
+    {0xf07da27a82c37088, 0x5d767327bb4e5a4c}, // 5^-109
+    {0x964e858c91ba2655, 0x3a6a07f8d510f86f}, // 5^-108
+    {0xbbe226efb628afea, 0x890489f70a55368b}, // 5^-107
+    {0xeadab0aba3b2dbe5, 0x2b45ac74ccea842e}, // 5^-106
+    {0x92c8ae6b464fc96f, 0x3b0b8bc90012929d}, // 5^-105
+    {0xb77ada0617e3bbcb, 0x09ce6ebb40173744}, // 5^-104
+    {0xe55990879ddcaabd, 0xcc420a6a101d0515}, // 5^-103
+    {0x8f57fa54c2a9eab6, 0x9fa946824a12232d}, // 5^-102
+    {0xb32df8e9f3546564, 0x47939822dc96abf9}, // 5^-101
+    {0xdff9772470297ebd, 0x59787e2b93bc56f7}, // 5^-100
+    {0x8bfbea76c619ef36, 0x57eb4edb3c55b65a}, // 5^-99
+    {0xaefae51477a06b03, 0xede622920b6b23f1}, // 5^-98
+    {0xdab99e59958885c4, 0xe95fab368e45eced}, // 5^-97
+    {0x88b402f7fd75539b, 0x11dbcb0218ebb414}, // 5^-96
+    {0xaae103b5fcd2a881, 0xd652bdc29f26a119}, // 5^-95
+    {0xd59944a37c0752a2, 0x4be76d3346f0495f}, // 5^-94
+    {0x857fcae62d8493a5, 0x6f70a4400c562ddb}, // 5^-93
+    {0xa6dfbd9fb8e5b88e, 0xcb4ccd500f6bb952}, // 5^-92
+    {0xd097ad07a71f26b2, 0x7e2000a41346a7a7}, // 5^-91
+    {0x825ecc24c873782f, 0x8ed400668c0c28c8}, // 5^-90
+    {0xa2f67f2dfa90563b, 0x728900802f0f32fa}, // 5^-89
+    {0xcbb41ef979346bca, 0x4f2b40a03ad2ffb9}, // 5^-88
+    {0xfea126b7d78186bc, 0xe2f610c84987bfa8}, // 5^-87
+    {0x9f24b832e6b0f436, 0x0dd9ca7d2df4d7c9}, // 5^-86
+    {0xc6ede63fa05d3143, 0x91503d1c79720dbb}, // 5^-85
+    {0xf8a95fcf88747d94, 0x75a44c6397ce912a}, // 5^-84
+    {0x9b69dbe1b548ce7c, 0xc986afbe3ee11aba}, // 5^-83
+    {0xc24452da229b021b, 0xfbe85badce996168}, // 5^-82
+    {0xf2d56790ab41c2a2, 0xfae27299423fb9c3}, // 5^-81
+    {0x97c560ba6b0919a5, 0xdccd879fc967d41a}, // 5^-80
+    {0xbdb6b8e905cb600f, 0x5400e987bbc1c920}, // 5^-79
+    {0xed246723473e3813, 0x290123e9aab23b68}, // 5^-78
+    {0x9436c0760c86e30b, 0xf9a0b6720aaf6521}, // 5^-77
+    {0xb94470938fa89bce, 0xf808e40e8d5b3e69}, // 5^-76
+    {0xe7958cb87392c2c2, 0xb60b1d1230b20e04}, // 5^-75
+    {0x90bd77f3483bb9b9, 0xb1c6f22b5e6f48c2}, // 5^-74
+    {0xb4ecd5f01a4aa828, 0x1e38aeb6360b1af3}, // 5^-73
+    {0xe2280b6c20dd5232, 0x25c6da63c38de1b0}, // 5^-72
+    {0x8d590723948a535f, 0x579c487e5a38ad0e}, // 5^-71
+    {0xb0af48ec79ace837, 0x2d835a9df0c6d851}, // 5^-70
+    {0xdcdb1b2798182244, 0xf8e431456cf88e65}, // 5^-69
+    {0x8a08f0f8bf0f156b, 0x1b8e9ecb641b58ff}, // 5^-68
+    {0xac8b2d36eed2dac5, 0xe272467e3d222f3f}, // 5^-67
+    {0xd7adf884aa879177, 0x5b0ed81dcc6abb0f}, // 5^-66
+    {0x86ccbb52ea94baea, 0x98e947129fc2b4e9}, // 5^-65
+    {0xa87fea27a539e9a5, 0x3f2398d747b36224}, // 5^-64
+    {0xd29fe4b18e88640e, 0x8eec7f0d19a03aad}, // 5^-63
+    {0x83a3eeeef9153e89, 0x1953cf68300424ac}, // 5^-62
+    {0xa48ceaaab75a8e2b, 0x5fa8c3423c052dd7}, // 5^-61
+    {0xcdb02555653131b6, 0x3792f412cb06794d}, // 5^-60
+    {0x808e17555f3ebf11, 0xe2bbd88bbee40bd0}, // 5^-59
+    {0xa0b19d2ab70e6ed6, 0x5b6aceaeae9d0ec4}, // 5^-58
+    {0xc8de047564d20a8b, 0xf245825a5a445275}, // 5^-57
+    {0xfb158592be068d2e, 0xeed6e2f0f0d56712}, // 5^-56
+    {0x9ced737bb6c4183d, 0x55464dd69685606b}, // 5^-55
+    {0xc428d05aa4751e4c, 0xaa97e14c3c26b886}, // 5^-54
+    {0xf53304714d9265df, 0xd53dd99f4b3066a8}, // 5^-53
+    {0x993fe2c6d07b7fab, 0xe546a8038efe4029}, // 5^-52
+    {0xbf8fdb78849a5f96, 0xde98520472bdd033}, // 5^-51
+    {0xef73d256a5c0f77c, 0x963e66858f6d4440}, // 5^-50
+    {0x95a8637627989aad, 0xdde7001379a44aa8}, // 5^-49
+    {0xbb127c53b17ec159, 0x5560c018580d5d52}, // 5^-48
+    {0xe9d71b689dde71af, 0xaab8f01e6e10b4a6}, // 5^-47
+    {0x9226712162ab070d, 0xcab3961304ca70e8}, // 5^-46
+    {0xb6b00d69bb55c8d1, 0x3d607b97c5fd0d22}, // 5^-45
+    {0xe45c10c42a2b3b05, 0x8cb89a7db77c506a}, // 5^-44
+    {0x8eb98a7a9a5b04e3, 0x77f3608e92adb242}, // 5^-43
+    {0xb267ed1940f1c61c, 0x55f038b237591ed3}, // 5^-42
+    {0xdf01e85f912e37a3, 0x6b6c46dec52f6688}, // 5^-41
+    {0x8b61313bbabce2c6, 0x2323ac4b3b3da015}, // 5^-40
+    {0xae397d8aa96c1b77, 0xabec975e0a0d081a}, // 5^-39
+    {0xd9c7dced53c72255, 0x96e7bd358c904a21}, // 5^-38
+    {0x881cea14545c7575, 0x7e50d64177da2e54}, // 5^-37
+    {0xaa242499697392d2, 0xdde50bd1d5d0b9e9}, // 5^-36
+    {0xd4ad2dbfc3d07787, 0x955e4ec64b44e864}, // 5^-35
+    {0x84ec3c97da624ab4, 0xbd5af13bef0b113e}, // 5^-34
+    {0xa6274bbdd0fadd61, 0xecb1ad8aeacdd58e}, // 5^-33
+    {0xcfb11ead453994ba, 0x67de18eda5814af2}, // 5^-32
+    {0x81ceb32c4b43fcf4, 0x80eacf948770ced7}, // 5^-31
+    {0xa2425ff75e14fc31, 0xa1258379a94d028d}, // 5^-30
+    {0xcad2f7f5359a3b3e, 0x096ee45813a04330}, // 5^-29
+    {0xfd87b5f28300ca0d, 0x8bca9d6e188853fc}, // 5^-28
+    {0x9e74d1b791e07e48, 0x775ea264cf55347e}, // 5^-27
+    {0xc612062576589dda, 0x95364afe032a819e}, // 5^-26
+    {0xf79687aed3eec551, 0x3a83ddbd83f52205}, // 5^-25
+    {0x9abe14cd44753b52, 0xc4926a9672793543}, // 5^-24
+    {0xc16d9a0095928a27, 0x75b7053c0f178294}, // 5^-23
+    {0xf1c90080baf72cb1, 0x5324c68b12dd6339}, // 5^-22
+    {0x971da05074da7bee, 0xd3f6fc16ebca5e04}, // 5^-21
+    {0xbce5086492111aea, 0x88f4bb1ca6bcf585}, // 5^-20
+    {0xec1e4a7db69561a5, 0x2b31e9e3d06c32e6}, // 5^-19
+    {0x9392ee8e921d5d07, 0x3aff322e62439fd0}, // 5^-18
+    {0xb877aa3236a4b449, 0x09befeb9fad487c3}, // 5^-17
+    {0xe69594bec44de15b, 0x4c2ebe687989a9b4}, // 5^-16
+    {0x901d7cf73ab0acd9, 0x0f9d37014bf60a11}, // 5^-15
+    {0xb424dc35095cd80f, 0x538484c19ef38c95}, // 5^-14
+    {0xe12e13424bb40e13, 0x2865a5f206b06fba}, // 5^-13
+    {0x8cbccc096f5088cb, 0xf93f87b7442e45d4}, // 5^-12
+    {0xafebff0bcb24aafe, 0xf78f69a51539d749}, // 5^-11
+    {0xdbe6fecebdedd5be, 0xb573440e5a884d1c}, // 5^-10
+    {0x89705f4136b4a597, 0x31680a88f8953031}, // 5^-9
+    {0xabcc77118461cefc, 0xfdc20d2b36ba7c3e}, // 5^-8
+    {0xd6bf94d5e57a42bc, 0x3d32907604691b4d}, // 5^-7
+    {0x8637bd05af6c69b5, 0xa63f9a49c2c1b110}, // 5^-6
+    {0xa7c5ac471b478423, 0x0fcf80dc33721d54}, // 5^-5
+    {0xd1b71758e219652b, 0xd3c36113404ea4a9}, // 5^-4
+    {0x83126e978d4fdf3b, 0x645a1cac083126ea}, // 5^-3
+    {0xa3d70a3d70a3d70a, 0x3d70a3d70a3d70a4}, // 5^-2
+    {0xcccccccccccccccc, 0xcccccccccccccccd}, // 5^-1
+    {0x8000000000000000, 0x0000000000000000}, // 5^0
+};
+
+#endif
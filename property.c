@@ -0,0 +1,152 @@
+#define PROPERTY_C
+
+#ifndef COMMON_H
+#include "common.h"
+#endif
+#ifndef GC_C
+#include "gc.c"
+#endif
+#ifndef SHAPE_C
+#include "shape.c"
+#endif
+
+//
+// Property access through a site's inline cache (see shape.c), shared by the
+// engines. The fast paths check the first way and are inlined; the rest of
+// the cache and the shape lookup are out of line. A method call's site
+// caches its field or its class's method the same way.
+//
+
+static bool property_get_slow(PropertyCache *restrict c, const ObjInstance *restrict o,
+        const Intern name, Value *restrict v)
+{
+    int slot;
+    const int k = property_cache_find(c, o->shape);
+    if (k != -1) {
+        slot = c->slots[k];
+    } else if ((slot = shape_lookup(o->shape, name)) != -1) {
+        property_cache_add(c, o->shape, NULL, slot);
+    } else {
+        return false;
+    }
+    *v = o->fields[slot];
+    return true;
+}
+
+// Reads field `name` of `o` into `v`; returns false if it has none
+static inline bool property_get(PropertyCache *restrict c, const ObjInstance *restrict o,
+        const Intern name, Value *restrict v)
+{
+    if (c->shapes[0] == o->shape) {
+        *v = o->fields[c->slots[0]];
+        return true;
+    }
+    return property_get_slow(c, o, name, v);
+}
+
+static void property_set_slow(Heap *restrict h, PropertyCache *restrict c, ObjInstance *restrict o,
+        const Intern name, const Value v)
+{
+    Shape *next;
+    int slot;
+    const int k = property_cache_find(c, o->shape);
+    if (k != -1) {
+        next = c->next[k];
+        slot = c->slots[k];
+    } else if ((slot = shape_lookup(o->shape, name)) != -1) {
+        next = NULL;
+        property_cache_add(c, o->shape, NULL, slot);
+    } else {
+        next = shape_transition(o->klass, o->shape, name);
+        slot = o->shape->count;
+        property_cache_add(c, o->shape, next, slot);
+    }
+    if (next) {
+        gc_reserve_fields(h, o, next->count);
+        o->shape = next;
+    }
+    o->fields[slot] = v;
+}
+
+// Sets field `name` of `o` to `v`, adding it if it is new
+static inline void property_set(Heap *restrict h, PropertyCache *restrict c, ObjInstance *restrict o,
+        const Intern name, const Value v)
+{
+    if (c->shapes[0] == o->shape && !c->next[0]) {
+        o->fields[c->slots[0]] = v;
+        return;
+    }
+    property_set_slow(h, c, o, name, v);
+}
+
+// The index of `klass`'s method `name`, or -1 if it has none
+static int property_find_method(const ObjClass *klass, const Intern name)
+{
+    for (int m = 0; m < arr_count(klass->methods); ++m) {
+        if (((const ObjFunction *) value_as_obj(klass->methods[m]))->name == name) {
+            return m;
+        }
+    }
+    return -1;
+}
+
+// Adds method `fn` to `klass`, over one of the same name
+void property_add_method(ObjClass *klass, const Value fn)
+{
+    const int m = property_find_method(klass, ((const ObjFunction *) value_as_obj(fn))->name);
+    if (m != -1) {
+        klass->methods[m] = fn;
+    } else {
+        arr_push(klass->methods, fn);
+    }
+}
+
+// A method call's slot (see `property_method`) of the instance in `sp[0]`
+static inline void property_method_load(const ObjInstance *restrict o, const int slot, Value *restrict sp)
+{
+    if (slot >= 0) {
+        sp[0] = o->fields[slot];
+        sp[1] = VALUE_NIL;
+    } else {
+        sp[1] = sp[0];
+        sp[0] = o->klass->methods[-1 - slot];
+    }
+}
+
+static bool property_method_slow(PropertyCache *restrict c, Value *restrict sp, const Intern name)
+{
+    const ObjInstance *o = (const ObjInstance *) value_as_obj(sp[0]);
+    int slot;
+    const int k = property_cache_find(c, o->shape);
+    if (k != -1) {
+        slot = c->slots[k];
+    } else {
+        if ((slot = shape_lookup(o->shape, name)) == -1) {
+            const int m = property_find_method(o->klass, name);
+            if (m == -1) {
+                return false;
+            }
+            slot = -1 - m;
+        }
+        property_cache_add(c, o->shape, NULL, slot);
+    }
+    property_method_load(o, slot, sp);
+    return true;
+}
+
+//
+// For a method call on the instance in `sp[0]`: leaves the method `name` of
+// its class and the instance, the receiver, in `sp[0]` and `sp[1]`, or its
+// field `name` and nil, as fields come first; returns false if it has
+// neither. The cache keeps a method as slot `-1 - index`, which the shape's
+// class settles, since a class's methods don't change once it is defined.
+//
+static inline bool property_method(PropertyCache *restrict c, Value *restrict sp, const Intern name)
+{
+    const ObjInstance *o = (const ObjInstance *) value_as_obj(sp[0]);
+    if (c->shapes[0] == o->shape) {
+        property_method_load(o, c->slots[0], sp);
+        return true;
+    }
+    return property_method_slow(c, sp, name);
+}
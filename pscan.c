@@ -0,0 +1,181 @@
+#define PSCAN_C
+
+#ifndef COMMON_H
+#include "common.h"
+#endif
+#ifndef ERROR_C
+#include "error.c"
+#endif
+#ifndef POOL_C
+#include "pool.c"
+#endif
+#ifndef SCANNER_C
+#include "scanner.c"
+#endif
+#ifndef TOKEN_C
+#include "token.c"
+#endif
+
+#ifndef PSCAN_MIN_CHUNK_LEN
+#define PSCAN_MIN_CHUNK_LEN (64 << 10) // smaller inputs are scanned serially
+#endif
+#define PSCAN_CHUNKS_PER_THREAD 4      // for load balancing
+
+//
+// Parallel scanner.
+//
+// The buffer is split into chunks that each end just after a newline, and
+// every chunk is lexed on the thread pool as if it began between tokens.
+// Comments end at a newline, so the only token that can cross a chunk
+// boundary is a multi-line string. That guess is checked in order afterwards:
+// a chunk that actually begins inside a string is lexed again from the
+// closing quote (the fix-up pass), which also discards anything the first
+// pass mistook for comments or other tokens inside the string. The per-chunk
+// token arrays are then copied into one stream, in parallel.
+//
+// The result is identical to `scan`. Inputs with errors are scanned again
+// serially so diagnostics are reported exactly as `scan` reports them.
+//
+typedef struct {
+    char *from;
+    const char *to;  // one past a newline, or the end of the buffer
+    Scanner scanner; // speculative; tokens have offsets relative to the buffer
+    int first;       // index of the chunk's first token in the stitched stream
+    int first_number;
+} ScanChunk;
+
+typedef struct {
+    Buffer *buffer;
+    ScanChunk *chunks; // arr
+    int num_ready;     // chunks that have been initialized
+    TokenStream *out;
+} ParallelScan;
+
+// Split the buffer into at most `num_chunks` chunks ending after a newline
+static void pscan_split(ParallelScan *ps, const int num_chunks)
+{
+    Buffer *b = ps->buffer;
+    char *from = b->head;
+    const char *end = b->head + b->len;
+    const int target = b->len / num_chunks;
+
+    arr_reset(ps->chunks);
+    for (int i = 1; from < end; ++i) {
+        const char *to = end;
+        if (i < num_chunks) {
+            const char *guess = b->head + (long) i * target;
+            if (guess < from) {
+                continue; // the previous chunk already extends past this guess
+            }
+            const char *nl = memchr(guess, '\n', end - guess);
+            to = nl ? nl + 1 : end;
+        }
+        ScanChunk *c = arr_add(ps->chunks, 1);
+        if (arr_count(ps->chunks) > ps->num_ready) {
+            memset(c, 0, sizeof(*c)); // new; reused chunks keep their token arrays
+            ps->num_ready++;
+        }
+        c->from = from;
+        c->to = to;
+        c->scanner.speculative = true;
+        from = (char *) to;
+    }
+}
+
+static void pscan_chunk(void *ctx, int i)
+{
+    ParallelScan *ps = ctx;
+    ScanChunk *c = &ps->chunks[i];
+    token_stream_reset(&c->scanner.tokens, ps->buffer->head);
+    scan_range(&c->scanner, ps->buffer, c->from, c->to);
+}
+
+// Lex chunk `c` again, knowing that it begins inside the string that opens
+// at `open`. Returns the string still open at the end of the chunk, if any.
+static const char *pscan_fix_up(ParallelScan *ps, ScanChunk *c, const char *open)
+{
+    Scanner *s = &c->scanner;
+    Buffer *b = ps->buffer;
+    token_stream_reset(&s->tokens, b->head);
+
+    char *close = memchr(c->from, '"', c->to - c->from);
+    if (!close) {
+        s->failed = false;
+        return open; // the whole chunk is inside the string
+    }
+    // The string excludes its quotes, as in `scan_string`
+    token_stream_push(&s->tokens, TOKEN_STRING, open + 1 - b->head, close - open - 1);
+    scan_range(s, b, close + 1, c->to);
+    return s->open_string;
+}
+
+static void pscan_stitch(void *ctx, int i)
+{
+    ParallelScan *ps = ctx;
+    const ScanChunk *c = &ps->chunks[i];
+    const TokenStream *from = &c->scanner.tokens;
+    const int n = token_stream_count(from);
+    const int num_numbers = arr_count(from->numbers);
+    if (n) {
+        memcpy(ps->out->types + c->first, from->types, n * sizeof(*from->types));
+        memcpy(ps->out->offsets + c->first, from->offsets, n * sizeof(*from->offsets));
+        memcpy(ps->out->lens + c->first, from->lens, n * sizeof(*from->lens));
+    }
+    if (num_numbers) {
+        memcpy(ps->out->numbers + c->first_number, from->numbers,
+                num_numbers * sizeof(*from->numbers));
+    }
+}
+
+// Returns the tokens, ending with TOKEN_EOF, or NULL if there were errors
+static const TokenStream *scan_parallel(Scanner *restrict s, Buffer *restrict b,
+        ThreadPool *restrict pool)
+{
+    static ParallelScan ps;
+    const int num_chunks = min(pool_num_threads(pool) * PSCAN_CHUNKS_PER_THREAD,
+            b->len / PSCAN_MIN_CHUNK_LEN);
+    if (num_chunks < 2 || pool_num_threads(pool) < 2 || log_enabled(LOG_LVL_TRACE)) {
+        return scan(s, b); // tracing is serial; its ring buffer is not shared
+    }
+    // Speculative pass
+    ps.buffer = b;
+    pscan_split(&ps, num_chunks);
+    pool_run(pool, arr_count(ps.chunks), pscan_chunk, &ps);
+
+    // Fix-up pass, in order: follow the strings that cross chunk boundaries
+    const char *open = NULL;
+    int count = 0;
+    int num_numbers = 0;
+    for (int i = 0; i < arr_count(ps.chunks); ++i) {
+        ScanChunk *c = &ps.chunks[i];
+        open = open ? pscan_fix_up(&ps, c, open) : c->scanner.open_string;
+        if (c->scanner.failed) {
+            return scan(s, b); // report the unexpected character, or stop at the NUL
+        }
+        c->first = count;
+        c->first_number = num_numbers;
+        count += token_stream_count(&c->scanner.tokens);
+        num_numbers += arr_count(c->scanner.tokens.numbers);
+    }
+    if (open) {
+        return scan(s, b); // report the unterminated string
+    }
+
+    // Stitch the chunks together and finish like `scan`
+    token_stream_reset(&s->tokens, b->head);
+    (void) arr_add(s->tokens.types, count);
+    (void) arr_add(s->tokens.offsets, count);
+    (void) arr_add(s->tokens.lens, count);
+    (void) arr_add(s->tokens.numbers, num_numbers);
+    ps.out = &s->tokens;
+    pool_run(pool, arr_count(ps.chunks), pscan_stitch, &ps);
+
+    s->buffer = b;
+    s->end = b->head + b->len;
+    s->cursor = s->token = (char *) s->end;
+    s->eof = true;
+    line_index_reset(&s->lines, b);
+    add_token(s, TOKEN_EOF);
+    log_flush();
+    return had_error ? NULL : &s->tokens;
+}
@@ -0,0 +1,236 @@
+#define RESOLVER_C
+
+#ifndef COMMON_H
+#include "common.h"
+#endif
+#ifndef ERROR_C
+#include "error.c"
+#endif
+#ifndef EXPR_C
+#include "expr.c"
+#endif
+#ifndef INTERN_C
+#include "intern.c"
+#endif
+#ifndef TOKEN_C
+#include "token.c"
+#endif
+
+#define RESOLVER_MAX_LOCALS  256       // per function; the VM addresses them with a byte
+#define RESOLVER_MAX_GLOBALS (1 << 24) // and globals with three
+#define RESOLVER_NO_NAME     ((Intern) -1) // of a local no name means
+
+//
+// Static resolution of names to variables, in one pass over a parsed program.
+//
+// Each local gets a (depth, slot) pair: the depth of the block that declares
+// it, which says when it goes out of scope, and its slot in the running
+// frame, which is where it lives at runtime. Locals are numbered in order of
+// declaration and a block's are dropped at its end, so the slots are exactly
+// the stack positions the engines keep them at. A name means the innermost
+// local by that name in scope, else the global by that name.
+//
+// A function's body is a scope whose frame starts at the function itself, in
+// slot 0, and its parameters after it. There are no closures: a function
+// can't use the locals of the functions around it, which is an error. But in
+// the body of a local function its own name means slot 0, so it can call
+// itself; a global one's means the global, as anywhere else. A method's
+// first parameter is `this` (see expr.c), so `this` is any other name there
+// and an error outside methods.
+//
+// Globals are slots of the heap's `globals` array. Their names are indexed
+// here and kept across runs, so REPL lines share them; a global's slot holds
+// VALUE_UNDEFINED until its definition runs, which the engines check.
+//
+// The resolver rewrites each name node in place to say which kind of
+// variable it is, with the slot in its args (see expr.c), so at runtime a
+// variable is an array index and never a lookup by name. A local is in scope
+// from the statement after its declaration, so `var a = a;` in a block
+// initializes it from the `a` outside.
+//
+typedef struct {
+    Intern name;
+    int depth; // of the block that declares it
+} Local;
+
+typedef struct {
+    const TokenStream *tokens;
+    LineIndex *lines;     // for the locations of errors
+    const char *filename;
+    int start;            // the node to start from; the REPL's lines before it are resolved
+    Local *locals;        // arr; in scope, innermost last
+    int function;         // index in `locals` of the current function's first
+    int *enclosing;       // arr; `function` of the functions around it
+    int depth;            // of the blocks around the current node
+    Intern *globals;      // arr of names, by slot
+    uint32_t *index;      // open addressing over `globals`; slot + 1, or 0 if empty
+    uint32_t index_cap;   // a power of two
+} Resolver;
+
+static bool resolver_error(const Resolver *restrict r, const int token, const char *restrict message)
+{
+    error(token_stream_loc(r->tokens, r->lines, r->filename, token), message);
+    return false;
+}
+
+static void resolver_grow_index(Resolver *r)
+{
+    const uint32_t cap = r->index_cap ? 2 * r->index_cap : 64;
+    uint32_t *index = calloc(cap, sizeof(*index));
+    for (int i = 0; i < arr_count(r->globals); ++i) {
+        uint32_t slot = intern_hash(r->globals[i]);
+        while (index[slot & (cap - 1)]) slot++;
+        index[slot & (cap - 1)] = i + 1;
+    }
+    free(r->index);
+    r->index = index;
+    r->index_cap = cap;
+}
+
+// The slot of the global `name`, adding it if it is new; -1 if there is no room
+static int resolver_global(Resolver *r, const Intern name)
+{
+    if (2 * (arr_count(r->globals) + 1) > (int) r->index_cap) {
+        resolver_grow_index(r);
+    }
+    const uint32_t mask = r->index_cap - 1;
+    uint32_t slot = intern_hash(name);
+    uint32_t i;
+    for (; (i = r->index[slot & mask]); slot++) {
+        if (r->globals[i - 1] == name) {
+            return i - 1;
+        }
+    }
+    if (arr_count(r->globals) == RESOLVER_MAX_GLOBALS) {
+        return -1;
+    }
+    arr_push(r->globals, name);
+    r->index[slot & mask] = arr_count(r->globals);
+    return arr_count(r->globals) - 1;
+}
+
+// The index in `locals` of the innermost local `name`, or -1 if there is none
+static int resolver_local(const Resolver *r, const Intern name)
+{
+    for (int i = arr_count(r->locals) - 1; i >= 0; --i) {
+        if (r->locals[i].name == name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Resolves the names in `ast`; returns false (after reporting them) on errors.
+// Running out of slots ends the pass, as every later variable would fail too
+bool resolve(Resolver *restrict r, Ast *restrict ast)
+{
+    uint8_t *types = ast->types;
+    uint32_t *args = ast->args;
+    bool ok = true;
+    arr_reset(r->locals);
+    arr_reset(r->enclosing);
+    r->function = 0;
+    r->depth = 0;
+    for (int i = r->start; i < ast->count; ++i) {
+        switch ((ExprType) types[i]) {
+            case EXPR_VARIABLE:
+            case EXPR_ASSIGN: {
+                const bool get = types[i] == EXPR_VARIABLE;
+                const int local = resolver_local(r, args[i]);
+                if (local >= r->function) {
+                    types[i] = get ? EXPR_GET_LOCAL : EXPR_SET_LOCAL;
+                    args[i] = local - r->function;
+                    break;
+                }
+                if (local != -1) {
+                    ok = resolver_error(r, ast->tokens[i], "Can't use a local variable of an enclosing function.");
+                    break;
+                }
+                if (r->tokens->types[ast->tokens[i]] == TOKEN_THIS) { // a method's first parameter
+                    ok = resolver_error(r, ast->tokens[i], "Can't use 'this' outside of a class.");
+                    break;
+                }
+                const int global = resolver_global(r, args[i]);
+                if (global == -1) {
+                    return resolver_error(r, ast->tokens[i], "Too many global variables.");
+                }
+                types[i] = get ? EXPR_GET_GLOBAL : EXPR_SET_GLOBAL;
+                args[i] = global;
+                break;
+            }
+
+            case STMT_VAR:
+            case STMT_PARAM: {
+                const Intern name = args[i];
+                if (r->depth == 0) {
+                    const int global = resolver_global(r, name);
+                    if (global == -1) {
+                        return resolver_error(r, ast->tokens[i], "Too many global variables.");
+                    }
+                    types[i] = STMT_DEFINE_GLOBAL;
+                    args[i] = global;
+                    break;
+                }
+                for (int k = arr_count(r->locals) - 1; k >= 0 && r->locals[k].depth == r->depth; --k) {
+                    if (r->locals[k].name == name) {
+                        ok = resolver_error(r, ast->tokens[i], "Already a variable with this name in this scope.");
+                        break;
+                    }
+                }
+                if (arr_count(r->locals) - r->function == RESOLVER_MAX_LOCALS) {
+                    return resolver_error(r, ast->tokens[i], "Too many local variables in function.");
+                }
+                arr_push(r->locals, ((Local) {name, r->depth}));
+                if (types[i] == STMT_VAR) {
+                    types[i] = STMT_DEFINE_LOCAL;
+                }
+                args[i] = arr_count(r->locals) - 1 - r->function;
+                break;
+            }
+
+            case STMT_FUNCTION: {
+                // Declared by the STMT_VAR after its EXPR_FUNCTION, unless a method
+                const int definition = args[i] + 1;
+                const bool local = r->depth > 0 && types[definition] == STMT_VAR;
+                arr_push(r->enclosing, r->function);
+                r->function = arr_count(r->locals);
+                // In the scope around the parameters, which may shadow it
+                arr_push(r->locals, ((Local) {local ? args[definition] : RESOLVER_NO_NAME, r->depth}));
+                r->depth++;
+                break;
+            }
+
+            case EXPR_FUNCTION:
+                while (arr_count(r->locals) > r->function) (void) arr_pop(r->locals);
+                r->function = arr_pop(r->enclosing);
+                r->depth--;
+                break;
+
+            case STMT_BLOCK_BEGIN:
+                r->depth++;
+                break;
+
+            case STMT_BLOCK_END: {
+                const int n = arr_count(r->locals);
+                while (!arr_empty(r->locals) && arr_last(r->locals).depth == r->depth) (void) arr_pop(r->locals);
+                args[i] = n - arr_count(r->locals); // to drop
+                r->depth--;
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+    return ok;
+}
+
+void resolver_free(Resolver *r)
+{
+    arr_free(r->locals);
+    arr_free(r->enclosing);
+    arr_free(r->globals);
+    free(r->index);
+    r->index = NULL;
+    r->index_cap = 0;
+}
@@ -6,6 +6,12 @@
 #ifndef ERROR_C
 #include "error.c"
 #endif
+#ifndef DFA_C
+#include "dfa.c"
+#endif
+#ifndef NUMBER_C
+#include "number.c"
+#endif
 #ifndef TOKEN_C
 #include "token.c"
 #endif
@@ -14,43 +20,40 @@ typedef struct {
     Buffer *restrict buffer;
     char *cursor;
     char *token;
+    const char *end; // one past the last char of the buffer
     bool eof;
-    Token *tokens;
-
-    // Loc *current;
-    int line; // DELETE?
-    int col;  // DELETE?
+    TokenStream tokens;
+    LineIndex lines; // only consulted when reporting
+
+    // Speculative scanners lex one chunk of a larger buffer (see pscan.c) and
+    // leave errors to the caller instead of reporting them
+    bool speculative;
+    bool failed;             // hit an unexpected character or a NUL byte
+    const char *open_string; // a string opened here is still open at `end`
 } Scanner;
 
 void scanner_pp(const Scanner *s)
 {
     printf("[Expr %p:%s] token:\"%s\" cursor:\"%s\"\n",
             (void *) s, bool_str(s->eof), unescaped(s->token), unescaped(s->cursor));
-    printf("  Token: "); token_pp(&s->tokens[-1]);
-}
-
-bool is_alpha(const char c)
-{
-    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
-}
-
-bool is_digit(const char c)
-{
-    return c >= '0' && c <= '9';
+    int n = token_stream_count(&s->tokens);
+    if (n) {
+        Token t = token_stream_get(&s->tokens, n-1);
+        printf("  Token: "); token_pp(&t);
+    }
 }
 
-bool is_alphanumeric(const char c)
+int scanner_offset(const Scanner *s, const char *c)
 {
-    return is_alpha(c) || is_digit(c);
+    return c - s->buffer->head;
 }
 
-int scanner_find_token_line_index(const Scanner *s)
+int scanner_find_token_line_index(Scanner *s)
 {
-    int line_index = buffer_find_line(s->buffer, s->token);
+    int line_index = line_index_find(&s->lines, scanner_offset(s, s->token));
     if (line_index == -1) {
-        fprintf(stderr, "Could not find token in scanner buffer; char %ld (%d lines)\n",
-                s->token - s->buffer->head,
-                s->buffer->num_lines);
+        fprintf(stderr, "Could not find token in scanner buffer; char %d (%d bytes)\n",
+                scanner_offset(s, s->token), s->buffer->len);
         exit(ERR_SCANNER);
     }
     return line_index;
@@ -58,7 +61,7 @@ int scanner_find_token_line_index(const Scanner *s)
 
 str scanner_buffer_line(const Scanner *s, int line_index)
 {
-    return buffer_get_line(s->buffer, line_index);
+    return line_index_get_line(&s->lines, line_index);
 }
 
 str scanner_token_range(const Scanner *s, str line)
@@ -69,164 +72,154 @@ str scanner_token_range(const Scanner *s, str line)
 
 }
 
-void scanner_error(const Scanner *restrict s, const char *restrict message)
+LogLoc scanner_loc(Scanner *s)
 {
     int line_index = scanner_find_token_line_index(s);
     str line = scanner_buffer_line(s, line_index);
-    str range = scanner_token_range(s, line);
-    error(line_index+1, line, range, message);
+    return (LogLoc) {
+        .filename = s->buffer->name ? s->buffer->name : "unknown",
+        .line_num = line_index+1,
+        .line = line,
+        .substr = scanner_token_range(s, line),
+    };
 }
 
-void scanner_info(const Scanner *restrict s, const char *restrict message)
+void scanner_error(Scanner *restrict s, const char *restrict message)
 {
-    int line_index = scanner_find_token_line_index(s);
-    str line = scanner_buffer_line(s, line_index);
-    str range = scanner_token_range(s, line);
-    info(line_index+1, line, range, token_type_name(s->tokens-1));
-}
-
-Token *add_token_span(Scanner *restrict s, const TokenType type,
-        const char *restrict from, const char *restrict to)
-{
-    Token *t = s->tokens++;
-    t->type = type;
-    t->lexeme = str_new_s(from, to-from);
-    scanner_info(s, token_type_name(t));
-    return t;
+    error(scanner_loc(s), message);
 }
 
-Token *add_token(Scanner *s, const TokenType type)
+void scanner_info(Scanner *restrict s, const char *restrict message)
 {
-    return add_token_span(s, type, s->token, s->cursor);
-}
-
-char advance(Scanner *s)
-{
-    char c = *s->cursor;
-    s->cursor++;
-    s->eof = (*s->cursor == '\0');
-    if (c == '\n') {
-        // Or call a registered callback fn, e.g. s->newline_cb (take a char *)
-        buffer_add_line(s->buffer, s->cursor);
+    if (log_enabled(LOG_LVL_INFO)) {
+        info(scanner_loc(s), message);
     }
-    return c;
 }
 
-bool scanner_match(Scanner *restrict s, const char expected)
-{
-    if (s->eof || *s->cursor != expected) {
-        return false;
-    }
-    s->cursor++;
-    return true;
-}
-
-Token *add_token_for(Scanner *s, const char c,
-        const TokenType matched, const TokenType unmatched)
-{
-    return add_token(s, scanner_match(s, c) ? matched : unmatched);
-}
-
-void scan_until(Scanner *s, const char until)
+// Returns the index of the new token in `s->tokens`
+int add_token_span(Scanner *restrict s, const TokenType type,
+        const char *restrict from, const char *restrict to)
 {
-    char c;
-    for (c = *s->cursor; c != until && !s->eof; c = *s->cursor) {
-        advance(s);
-    }
+    trace_span(&s->lines, scanner_offset(s, from), to-from, token_type_names[type]);
+    return token_stream_push(&s->tokens, type, scanner_offset(s, from), to-from);
 }
 
-Token *scan_comment(Scanner *s)
+int add_token(Scanner *s, const TokenType type)
 {
-    scan_until(s, '\n');
-    return add_token(s, TOKEN_COMMENT);
+    return add_token_span(s, type, s->token, s->cursor);
 }
 
-Token *scan_identifier(Scanner *s)
+// Report an error at the token that starts at `token` and ends at `to`
+static void scanner_error_at(Scanner *restrict s, const char *restrict token,
+        const char *restrict to, const char *restrict message)
 {
-    while (is_alphanumeric(*s->cursor)) {
-        advance(s);
-    }
-    Keyword *k = find_keyword(str_new_s(s->token, s->cursor - s->token));
-    return add_token(s, k ? k->type : TOKEN_IDENTIFIER);
+    s->token = (char *) token;
+    s->cursor = (char *) to;
+    scanner_error(s, message);
 }
 
-Token *scan_number(Scanner *s)
+// Scan [from, to) of `b`, appending to `s->tokens`; token offsets are
+// relative to the start of `b`. `to` must be the end of `b` (followed by a
+// NUL) or follow a newline.
+static void scan_range(Scanner *s, Buffer *b, char *from, const char *to)
 {
-    while (is_digit(*s->cursor)) {
-        advance(s);
-    }
-    if (*s->cursor == '.' && is_digit(s->cursor[1]))  {
-        advance(s); // consume the `.`
-        while (is_digit(*s->cursor)) {
-            advance(s);
+    s->buffer = b;
+    s->end    = to;
+    s->failed = false;
+    s->open_string = NULL;
+
+    const ScanKernels *k = scan_kernels ? scan_kernels : scan_kernels_get(SCAN_KERNEL_AUTO);
+    const char *end = to;
+    const char *p = from;
+    for (;;) {
+        p = k->skip_whitespace(p, end);
+        if (p >= end) {
+            break;
         }
-    }
-    return add_token(s, TOKEN_NUMBER);
-}
 
-Token *scan_string(Scanner *s)
-{
-    scan_until(s, '"');
-    if (s->eof) {
-        scanner_error(s, "Unterminated string.");
-        // exit(1);
-        return &TokenNone;
+        const char *token = p;
+        DfaState state = S_START, last;
+        p = dfa_run(k, &state, &last, p, end);
+        const TokenType type = dfa_token(state, token, &p);
+        switch (type) {
+            case TOKEN_NUMBER:
+                add_token_span(s, TOKEN_NUMBER, token, p);
+                token_stream_push_number(&s->tokens, number_parse(token, p - token));
+                break;
+            case TOKEN_STRING: // exclude quotes
+                add_token_span(s, TOKEN_STRING, token + 1, p - 1);
+                break;
+            case TOKEN_NONE: // the input ended inside the string
+                if (s->speculative) {
+                    s->open_string = token; // may be closed in a later chunk
+                } else {
+                    scanner_error_at(s, token, end, "Unterminated string.");
+                }
+                p = end;
+                break;
+            case TOKEN_EOF: // a NUL byte in the input ends it, as it does the parser
+                if (p <= end) {
+                    if (s->speculative) {
+                        s->failed = true;
+                    } else {
+                        add_token_span(s, TOKEN_EOF, token, p);
+                    }
+                    p = end;
+                }
+                break;
+            case TOKEN_ERROR:
+                if (s->speculative) {
+                    s->failed = true;
+                    p = end;
+                    break;
+                }
+                scanner_error_at(s, token, p, "Unexpected character.");
+                p = end; // the rest of the input is not scanned
+                break;
+            default:
+                add_token_span(s, type, token, p);
+                break;
+        }
     }
-    // Consume the closing double-quote and return string excluding quotes
-    advance(s);
-    return add_token_span(s, TOKEN_STRING, s->token+1, s->cursor-1);
+    s->cursor = (char *) end;
+    s->token  = (char *) end;
+    s->eof    = true;
 }
 
-Token *scan_token(Scanner *s)
+// Returns the tokens, ending with TOKEN_EOF, or NULL if there were errors
+static const TokenStream *scan(Scanner *s, Buffer *b)
 {
+    line_index_reset(&s->lines, b);
+    token_stream_reset(&s->tokens, b->head);
+    scan_range(s, b, b->head, b->head + b->len);
     s->token = s->cursor;
-    char c = advance(s);
-
-    switch (c) {
-        case ' ':  break;
-        case '\t': break;
-        case '\n': break;
-        case '(':  return add_token(s, TOKEN_LEFT_PAREN);
-        case ')':  return add_token(s, TOKEN_RIGHT_PAREN);
-        case '{':  return add_token(s, TOKEN_LEFT_BRACE);
-        case '}':  return add_token(s, TOKEN_RIGHT_BRACE);
-        case ';':  return add_token(s, TOKEN_SEMICOLON);
-        case ',':  return add_token(s, TOKEN_COMMA);
-        case '.':  return add_token(s, TOKEN_DOT);
-        case '-':  return add_token(s, TOKEN_MINUS);
-        case '+':  return add_token(s, TOKEN_PLUS);
-        case '*':  return add_token(s, TOKEN_STAR);
-        case '!':  return add_token_for(s, '=', TOKEN_BANG_EQUAL, TOKEN_BANG);
-        case '=':  return add_token_for(s, '=', TOKEN_EQUAL_EQUAL, TOKEN_EQUAL);
-        case '<':  return add_token_for(s, '=', TOKEN_LESS_EQUAL, TOKEN_LESS);
-        case '>':  return add_token_for(s, '=', TOKEN_GREATER_EQUAL, TOKEN_GREATER);
-        case '"':  return scan_string(s);
-        case '/':  return (scanner_match(s, '/')) ? scan_comment(s) : add_token(s, TOKEN_SLASH);
-        case '\r': break;
-        case '\0': return add_token(s, TOKEN_EOF);
-        default:
-                   if (is_digit(c)) {
-                       return scan_number(s);
-                   } else if (is_alpha(c)) {
-                       return scan_identifier(s);
-                   } else {
-                       scanner_error(s, "Unexpected character.");
-                       exit(1);
-                   }
-    }
-    return &TokenNone;
+    add_token(s, TOKEN_EOF);
+    log_flush();
+    return had_error ? NULL : &s->tokens;
 }
 
-static Token *scan(Scanner *s, Buffer *b, Token *tokens)
+//
+// Scan the end of `b` from offset `from` on, after the first `first` tokens
+// of an earlier scan of `b`'s beginning (the lines of a REPL session before
+// the new one); their TOKEN_EOF and any tokens after them are dropped. `b`
+// may have moved since.
+//
+static const TokenStream *scan_more(Scanner *s, Buffer *b, const int from, const int first)
 {
-    s->buffer = b;
-    s->cursor = b->head;
-    s->token  = b->head;
-    s->tokens = tokens;
-    *s->tokens = TokenNone;
-    s->eof = false;
-    while (!s->eof) {
-        scan_token(s);
+    if (!first) {
+        return scan(s, b);
     }
-    return tokens;
+    TokenStream *ts = &s->tokens;
+    while (token_stream_count(ts) > first) {
+        if (arr_pop(ts->types) == TOKEN_NUMBER) (void) arr_pop(ts->numbers);
+        (void) arr_pop(ts->offsets);
+        (void) arr_pop(ts->lens);
+    }
+    ts->src = b->head;
+    line_index_truncate(&s->lines, from);
+    scan_range(s, b, b->head + from, b->head + b->len);
+    s->token = s->cursor;
+    add_token(s, TOKEN_EOF);
+    log_flush();
+    return had_error ? NULL : ts;
 }
@@ -0,0 +1,120 @@
+#define SHAPE_C
+
+#ifndef COMMON_H
+#include "common.h"
+#endif
+#ifndef INTERN_C
+#include "intern.c"
+#endif
+#ifndef VALUE_C
+#include "value.c"
+#endif
+
+// Shapes an inline cache remembers before it stops caching
+#define PROPERTY_CACHE_WAYS 4
+
+//
+// Shapes (hidden classes) of instances.
+//
+// A shape says which fields an instance has and the slot of each in its flat
+// `fields` array. Instances that got the same fields in the same order share
+// a shape: each class has a root shape with no fields, and adding field `x`
+// to an instance moves it along the transition from its shape to the one with
+// `x` in the next slot, which is made the first time and reused after. So the
+// shapes of a class form a tree, which the class owns and frees with itself.
+//
+// A shape only records the field it adds; finding any other walks up to the
+// root. That is the slow path: each site that reads or writes a property
+// keeps an inline cache of the shapes it has seen there and the slot (or, for
+// a store that adds the field, the transition) each one means. Up to
+// PROPERTY_CACHE_WAYS shapes are kept, the first in the first way, so a site
+// that sees one shape costs a compare and an indexed load; a site that sees
+// more than that (megamorphic) takes the slow path for the rest.
+//
+// Caches hold shapes without keeping them alive, so the heap clears them
+// whenever it frees a class (see gc.c), before an address could be reused.
+//
+struct Shape {
+    const Shape *parent; // without the last field; NULL for a root
+    Intern name;         // of the last field, in slot `count - 1`
+    int count;           // fields
+    Shape **transitions; // arr; the shapes with one more field
+};
+
+typedef struct {
+    const Shape *shapes[PROPERTY_CACHE_WAYS];
+    Shape *next[PROPERTY_CACHE_WAYS]; // for a store that adds the field, the shape after
+    int slots[PROPERTY_CACHE_WAYS];
+    int count;                        // ways in use
+} PropertyCache;
+
+static Shape *shape_new(ObjClass *klass, const Shape *parent, const Intern name)
+{
+    Shape *s = malloc(sizeof(*s));
+    *s = (Shape) {parent, name, parent ? parent->count + 1 : 0, NULL};
+    arr_push(klass->shapes, s);
+    return s;
+}
+
+// Give `klass` its root shape
+void shape_init(ObjClass *klass)
+{
+    klass->shapes = NULL;
+    klass->shape = shape_new(klass, NULL, 0);
+}
+
+// The slot of field `name` in `s`, or -1 if it has none
+static int shape_lookup(const Shape *s, const Intern name)
+{
+    for (; s->parent; s = s->parent) {
+        if (s->name == name) {
+            return s->count - 1;
+        }
+    }
+    return -1;
+}
+
+// The shape of `klass` with the fields of `s` and then `name`
+static Shape *shape_transition(ObjClass *klass, Shape *s, const Intern name)
+{
+    for (int i = 0; i < arr_count(s->transitions); ++i) {
+        if (s->transitions[i]->name == name) {
+            return s->transitions[i];
+        }
+    }
+    Shape *next = shape_new(klass, s, name);
+    arr_push(s->transitions, next);
+    return next;
+}
+
+// Free the shapes of `klass`
+void shape_free(ObjClass *klass)
+{
+    for (int i = 0; i < arr_count(klass->shapes); ++i) {
+        arr_free(klass->shapes[i]->transitions);
+        free(klass->shapes[i]);
+    }
+    arr_free(klass->shapes);
+}
+
+// The way of `c` for `s`, or -1 if it has none
+static inline int property_cache_find(const PropertyCache *c, const Shape *s)
+{
+    for (int k = 0; k < c->count; ++k) {
+        if (c->shapes[k] == s) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+// Remember in `c` that `s` means `slot` (and `next`, if not NULL), unless it is full
+static void property_cache_add(PropertyCache *c, const Shape *s, Shape *next, const int slot)
+{
+    if (c->count < PROPERTY_CACHE_WAYS) {
+        c->shapes[c->count] = s;
+        c->next[c->count] = next;
+        c->slots[c->count] = slot;
+        c->count++;
+    }
+}
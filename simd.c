@@ -0,0 +1,224 @@
+#define SIMD_C
+
+#ifndef COMMON_H
+#include "common.h"
+#endif
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_X86 1
+#include <immintrin.h>
+#else
+#define SIMD_X86 0
+#endif
+
+//
+// Character-class kernels used by the scanner to skip runs of bytes.
+//
+// Every kernel scans [p, end) and returns a pointer to the first byte that
+// does not belong to its class (or `end`). Vector kernels only load whole
+// 16/32-byte blocks that lie inside [p, end) and finish the tail with the
+// scalar kernel, so they never read past the end of the buffer.
+//
+typedef const char *(*ScanKernel)(const char *p, const char *end);
+
+typedef struct {
+    const char *name;
+    ScanKernel skip_whitespace;   // ' ', '\t', '\r', '\n'
+    ScanKernel skip_alphanumeric; // [A-Za-z0-9_]
+    ScanKernel skip_digits;       // [0-9]
+    ScanKernel skip_line;         // stops at '\n'
+    ScanKernel skip_string;       // stops at '"'
+} ScanKernels;
+
+typedef enum {
+    SCAN_KERNEL_AUTO,
+    SCAN_KERNEL_SCALAR,
+    SCAN_KERNEL_SSE2,
+    SCAN_KERNEL_AVX2,
+} ScanKernelKind;
+
+//
+// Scalar
+//
+static const char *skip_whitespace_scalar(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+    return p;
+}
+
+static const char *skip_alphanumeric_scalar(const char *p, const char *end)
+{
+    while (p < end && ((unsigned char) ((*p | 0x20) - 'a') < 26
+                || (unsigned char) (*p - '0') < 10 || *p == '_')) p++;
+    return p;
+}
+
+static const char *skip_digits_scalar(const char *p, const char *end)
+{
+    while (p < end && (unsigned char) (*p - '0') < 10) p++;
+    return p;
+}
+
+static const char *skip_line_scalar(const char *p, const char *end)
+{
+    while (p < end && *p != '\n') p++;
+    return p;
+}
+
+static const char *skip_string_scalar(const char *p, const char *end)
+{
+    while (p < end && *p != '"') p++;
+    return p;
+}
+
+static const ScanKernels scan_kernels_scalar = {
+    "scalar",
+    skip_whitespace_scalar,
+    skip_alphanumeric_scalar,
+    skip_digits_scalar,
+    skip_line_scalar,
+    skip_string_scalar,
+};
+
+#if SIMD_X86
+//
+// SSE2 (16 bytes per step)
+//
+// `in_range` is an unsigned `lo <= c && c <= hi` on every lane: subtract `lo`
+// (wrapping) and check the result is no greater than `hi - lo`.
+//
+#define SSE2 __attribute__((target("sse2")))
+
+SSE2 static inline __m128i in_range_sse2(__m128i v, char lo, char hi)
+{
+    __m128i t = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(hi - lo)), t);
+}
+
+SSE2 static inline __m128i eq_sse2(__m128i v, char c)
+{
+    return _mm_cmpeq_epi8(v, _mm_set1_epi8(c));
+}
+
+// Index of the first lane where `in_class` is false, or 16
+SSE2 static inline int first_miss_sse2(__m128i in_class)
+{
+    unsigned mask = ~(unsigned) _mm_movemask_epi8(in_class) & 0xFFFF;
+    return mask ? __builtin_ctz(mask) : 16;
+}
+
+#define SSE2_SKIP_KERNEL(name, v, in_class)                                 \
+    SSE2 static const char *name##_sse2(const char *p, const char *end)    \
+    {                                                                       \
+        for (; end - p >= 16; p += 16) {                                    \
+            __m128i v = _mm_loadu_si128((const __m128i *) p);               \
+            int i = first_miss_sse2(in_class);                              \
+            if (i < 16) return p + i;                                       \
+        }                                                                   \
+        return name##_scalar(p, end);                                       \
+    }
+
+SSE2_SKIP_KERNEL(skip_whitespace, v,
+        _mm_or_si128(_mm_or_si128(eq_sse2(v, ' '), eq_sse2(v, '\t')),
+                     _mm_or_si128(eq_sse2(v, '\r'), eq_sse2(v, '\n'))))
+SSE2_SKIP_KERNEL(skip_alphanumeric, v,
+        _mm_or_si128(_mm_or_si128(in_range_sse2(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z'),
+                                  in_range_sse2(v, '0', '9')),
+                     eq_sse2(v, '_')))
+SSE2_SKIP_KERNEL(skip_digits, v, in_range_sse2(v, '0', '9'))
+SSE2_SKIP_KERNEL(skip_line, v, _mm_xor_si128(eq_sse2(v, '\n'), _mm_set1_epi8(-1)))
+SSE2_SKIP_KERNEL(skip_string, v, _mm_xor_si128(eq_sse2(v, '"'), _mm_set1_epi8(-1)))
+
+static const ScanKernels scan_kernels_sse2 = {
+    "sse2",
+    skip_whitespace_sse2,
+    skip_alphanumeric_sse2,
+    skip_digits_sse2,
+    skip_line_sse2,
+    skip_string_sse2,
+};
+
+//
+// AVX2 (32 bytes per step)
+//
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i in_range_avx2(__m256i v, char lo, char hi)
+{
+    __m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(hi - lo)), t);
+}
+
+AVX2 static inline __m256i eq_avx2(__m256i v, char c)
+{
+    return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c));
+}
+
+// Index of the first lane where `in_class` is false, or 32
+AVX2 static inline int first_miss_avx2(__m256i in_class)
+{
+    unsigned mask = ~(unsigned) _mm256_movemask_epi8(in_class);
+    return mask ? __builtin_ctz(mask) : 32;
+}
+
+#define AVX2_SKIP_KERNEL(name, v, in_class)                                 \
+    AVX2 static const char *name##_avx2(const char *p, const char *end)    \
+    {                                                                       \
+        for (; end - p >= 32; p += 32) {                                    \
+            __m256i v = _mm256_loadu_si256((const __m256i *) p);            \
+            int i = first_miss_avx2(in_class);                              \
+            if (i < 32) return p + i;                                       \
+        }                                                                   \
+        return name##_sse2(p, end);                                         \
+    }
+
+AVX2_SKIP_KERNEL(skip_whitespace, v,
+        _mm256_or_si256(_mm256_or_si256(eq_avx2(v, ' '), eq_avx2(v, '\t')),
+                        _mm256_or_si256(eq_avx2(v, '\r'), eq_avx2(v, '\n'))))
+AVX2_SKIP_KERNEL(skip_alphanumeric, v,
+        _mm256_or_si256(_mm256_or_si256(in_range_avx2(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z'),
+                                        in_range_avx2(v, '0', '9')),
+                        eq_avx2(v, '_')))
+AVX2_SKIP_KERNEL(skip_digits, v, in_range_avx2(v, '0', '9'))
+AVX2_SKIP_KERNEL(skip_line, v, _mm256_xor_si256(eq_avx2(v, '\n'), _mm256_set1_epi8(-1)))
+AVX2_SKIP_KERNEL(skip_string, v, _mm256_xor_si256(eq_avx2(v, '"'), _mm256_set1_epi8(-1)))
+
+static const ScanKernels scan_kernels_avx2 = {
+    "avx2",
+    skip_whitespace_avx2,
+    skip_alphanumeric_avx2,
+    skip_digits_avx2,
+    skip_line_avx2,
+    skip_string_avx2,
+};
+#endif
+
+//
+// Dispatch
+//
+// Returns NULL if the requested kernels are not supported by this CPU/build.
+const ScanKernels *scan_kernels_get(const ScanKernelKind kind)
+{
+    switch (kind) {
+        case SCAN_KERNEL_SCALAR: return &scan_kernels_scalar;
+#if SIMD_X86
+        case SCAN_KERNEL_SSE2: return &scan_kernels_sse2; // baseline on x86-64
+        case SCAN_KERNEL_AVX2:
+            return __builtin_cpu_supports("avx2") ? &scan_kernels_avx2 : NULL;
+        case SCAN_KERNEL_AUTO:
+            return __builtin_cpu_supports("avx2") ? &scan_kernels_avx2 : &scan_kernels_sse2;
+#else
+        case SCAN_KERNEL_AUTO: return &scan_kernels_scalar;
+#endif
+        default: return NULL;
+    }
+}
+
+static const ScanKernels *scan_kernels;
+
+const ScanKernels *scan_kernels_use(const ScanKernelKind kind)
+{
+    const ScanKernels *k = scan_kernels_get(kind);
+    if (k) scan_kernels = k;
+    return k;
+}
@@ -3,7 +3,7 @@
 //
 typedef struct {
     const char *head;
-    const int len;
+    int len;
 } str;
 
 str str_new(const char *s) {
@@ -19,6 +19,10 @@ int str_ncmp(const str lhs, const str rhs, const int count) {
     return strncmp(lhs.head, rhs.head, count);
 }
 
+bool str_eq(const str lhs, const str rhs) {
+    return lhs.len == rhs.len && memcmp(lhs.head, rhs.head, lhs.len) == 0;
+}
+
 str str_slice(const str s, const int from, const int to) {
     // TODO bounds check `from` and `to`
     // TODO handle negative `from` (count from end)
@@ -26,15 +30,6 @@ str str_slice(const str s, const int from, const int to) {
     return (str) { .head = s.head+from, .len = to-from };
 }
 
-char *str_to_char(const str s) {
-    static char str_to_char_buffer[65536];
-    static char *cursor = str_to_char_buffer;
-    char *dest = strncpy(cursor, s.head, s.len);
-    cursor[s.len] = '\0';
-    cursor += s.len + 2;
-    return dest;
-}
-
 void str_pp(const str s) {
     printf("[str %p:%d] \"%.*s\"\n", (void *) s.head, s.len, s.len, s.head);
 }
@@ -0,0 +1,241 @@
+#define STREAM_C
+
+#ifndef COMMON_H
+#include "common.h"
+#endif
+#ifndef DFA_C
+#include "dfa.c"
+#endif
+#ifndef ERROR_C
+#include "error.c"
+#endif
+#ifndef SIMD_C
+#include "simd.c"
+#endif
+#ifndef TOKEN_C
+#include "token.c"
+#endif
+
+#define STREAM_CHUNK_LEN 65536
+#define STREAM_PREFIX_LEN 256 // bytes of a line kept from earlier chunks, for diagnostics
+
+//
+// Resumable scanner for input that arrives in chunks (pipes, huge files).
+//
+// It runs the same DFA as `scan` (see dfa.c), so both see the same tokens.
+// Each chunk is appended to `buf` behind the bytes of the token the last
+// chunk ended in, and scanned up to the NUL after it. A token that runs into
+// that NUL may go on in the next chunk: only its bytes stay in `buf`, and the
+// DFA resumes from the state it was in (`state`) where it stopped. Tokens are
+// handed to `sink` as soon as they are complete; a lexeme points into `buf`
+// and is only valid during the call.
+//
+// The rest of a chunk is dropped once it is scanned. Diagnostics locate an
+// error by counting the lines and the bytes of the current line dropped so
+// far, and show the part of its line still in `buf`, after the last
+// STREAM_PREFIX_LEN bytes of it that were dropped (`prefix`).
+//
+// As with `scan`, a NUL byte in the input ends it, and so does an
+// unexpected character (after reporting it).
+//
+// Memory use is one chunk plus the longest token that spans a chunk
+// boundary, however long the input or its lines are.
+//
+typedef void (*TokenSink)(void *ctx, const Token *t);
+
+typedef struct {
+    char *buf;        // arr; the carried token, then the current chunk, then a NUL
+    int carried;      // bytes of `buf` kept from earlier chunks: the token
+    DfaState state;   // where the DFA stopped in the token
+    const char *name; // for reporting
+    int line;         // newlines before `buf`
+    long column;      // bytes of the current line before `buf`
+    char prefix[STREAM_PREFIX_LEN]; // the last of those
+    int prefix_len;
+    long num_tokens;
+    bool had_error;
+    bool done;        // reached a NUL byte or an error; the rest is ignored
+    const ScanKernels *kernels;
+    TokenSink sink;
+    void *ctx;
+} StreamScanner;
+
+void stream_init(StreamScanner *restrict ss, const char *restrict name,
+        TokenSink sink, void *restrict ctx)
+{
+    arr_reset(ss->buf);
+    ss->carried = 0;
+    ss->state = S_START;
+    ss->name = name;
+    ss->line = 0;
+    ss->column = 0;
+    ss->prefix_len = 0;
+    ss->num_tokens = 0;
+    ss->had_error = false;
+    ss->done = false;
+    ss->kernels = scan_kernels ? scan_kernels : scan_kernels_get(SCAN_KERNEL_AUTO);
+    ss->sink = sink;
+    ss->ctx = ctx;
+}
+
+static void stream_emit(StreamScanner *ss, const TokenType type, const char *from, const char *to)
+{
+    Token t = { .type = type, .lexeme = str_new_s(from, to - from) };
+    ss->num_tokens++;
+    ss->sink(ss->ctx, &t);
+}
+
+// Report an error at [from, to), where `to` is at most the end of its line
+static void stream_error(StreamScanner *ss, const char *from, const char *to, const char *message)
+{
+    const char *end = ss->buf + arr_count(ss->buf) - 1;
+    const char *line_head = from;
+    while (line_head > ss->buf && line_head[-1] != '\n') line_head--;
+    const char *line_end = memchr(from, '\n', end - from);
+    if (!line_end) line_end = end;
+
+    int line_num = ss->line + 1;
+    for (const char *c = ss->buf; (c = memchr(c, '\n', line_head - c)); ++c) line_num++;
+
+    // A line that began in an earlier chunk is shown from its prefix on
+    char *text = NULL; // arr
+    long skipped = 0;
+    if (line_head == ss->buf) {
+        arr_concat(text, ss->prefix, ss->prefix_len);
+        skipped = ss->column - ss->prefix_len;
+    }
+    const int at = arr_count(text) + (int) (from - line_head);
+    arr_concat(text, line_head, (int) (line_end - line_head));
+    const str line = str_new_s(text, arr_count(text));
+    error((LogLoc) {ss->name, line_num, line, str_new_s(text + at, min(to, line_end) - from), skipped}, message);
+    arr_free(text);
+    ss->had_error = true;
+    ss->done = true;
+}
+
+// Count the lines and columns of [buf, to), which is dropped, keeping the
+// end of its last line in `prefix`
+static void stream_drop(StreamScanner *ss, const char *to)
+{
+    const char *line_head = ss->buf;
+    for (const char *nl = ss->buf; (nl = memchr(nl, '\n', to - nl)); line_head = ++nl) {
+        ss->line++;
+    }
+    if (line_head > ss->buf) { // a new line
+        ss->column = 0;
+        ss->prefix_len = 0;
+    }
+    const int len = (int) (to - line_head);
+    ss->column += len;
+    const int keep = min(ss->prefix_len, STREAM_PREFIX_LEN - min(len, STREAM_PREFIX_LEN));
+    memmove(ss->prefix, ss->prefix + ss->prefix_len - keep, keep);
+    const int add = min(len, STREAM_PREFIX_LEN);
+    memcpy(ss->prefix + keep, to - add, add);
+    ss->prefix_len = keep + add;
+}
+
+//
+// Scan `buf`, which ends with a NUL. Unless `last`, a token that runs into
+// it is to be kept, with the state to resume it from. Returns where the
+// bytes to keep (if any) begin.
+//
+static const char *stream_scan(StreamScanner *ss, const bool last)
+{
+    const char *p = ss->buf;
+    const char *end = ss->buf + arr_count(ss->buf) - 1;
+    const ScanKernels *k = ss->kernels;
+    while (!ss->done) {
+        const char *token = p;
+        DfaState state = S_START, before;
+        if (ss->carried) {
+            p += ss->carried;
+            state = ss->state;
+            ss->carried = 0;
+        } else {
+            token = p = k->skip_whitespace(p, end);
+            if (p >= end) {
+                return end;
+            }
+        }
+        p = dfa_run(k, &state, &before, p, end);
+        if (p > end && !last) {
+            ss->carried = end - token;
+            ss->state = before;
+            return token;
+        }
+        const TokenType type = dfa_token(state, token, &p);
+        switch (type) {
+            case TOKEN_STRING: // exclude quotes
+                stream_emit(ss, TOKEN_STRING, token + 1, p - 1);
+                break;
+            case TOKEN_NONE: // the input ended inside the string
+                stream_error(ss, token, end, "Unterminated string.");
+                break;
+            case TOKEN_EOF: // a NUL byte in the input
+                if (p <= end) {
+                    stream_emit(ss, TOKEN_EOF, token, p);
+                    ss->done = true;
+                }
+                return end;
+            case TOKEN_ERROR:
+                stream_error(ss, token, p, "Unexpected character.");
+                break;
+            default:
+                stream_emit(ss, type, token, p);
+                break;
+        }
+    }
+    return end;
+}
+
+void stream_feed(StreamScanner *restrict ss, const char *restrict chunk, const int len)
+{
+    if (ss->done) {
+        return;
+    }
+    if (!arr_empty(ss->buf)) {
+        (void) arr_pop(ss->buf); // the NUL after the carried token
+    }
+    arr_concat(ss->buf, chunk, len);
+    arr_push(ss->buf, '\0');
+
+    // Keep the carried token, if any, and drop the rest
+    const char *keep = stream_scan(ss, false);
+    stream_drop(ss, keep);
+    const int kept = ss->carried;
+    memmove(ss->buf, keep, kept);
+    while (arr_count(ss->buf) > kept) (void) arr_pop(ss->buf);
+    arr_push(ss->buf, '\0');
+}
+
+// End of input: finish the carried token, if any, and emit TOKEN_EOF
+void stream_finish(StreamScanner *ss)
+{
+    if (arr_empty(ss->buf)) {
+        arr_push(ss->buf, '\0');
+    }
+    stream_scan(ss, true);
+    if (!ss->done) {
+        const char *end = ss->buf + arr_count(ss->buf) - 1;
+        stream_emit(ss, TOKEN_EOF, end, end);
+    }
+}
+
+// Scan `file` STREAM_CHUNK_LEN bytes at a time. Returns false on scan errors.
+bool stream_scan_file(FILE *restrict file, const char *restrict name,
+        TokenSink sink, void *restrict ctx)
+{
+    static char *chunk = NULL;
+    static StreamScanner ss;
+    if (!chunk) {
+        chunk = malloc(STREAM_CHUNK_LEN);
+    }
+
+    stream_init(&ss, name, sink, ctx);
+    size_t n;
+    while ((n = fread(chunk, sizeof(char), STREAM_CHUNK_LEN, file)) > 0) {
+        stream_feed(&ss, chunk, (int) n);
+    }
+    stream_finish(&ss);
+    return !ss.had_error && !ferror(file);
+}
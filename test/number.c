@@ -0,0 +1,115 @@
+//
+// `number_parse` against `strtod`: every literal must parse to the very same
+// double. Checks hand-picked edge cases (long literals, subnormals, overflow,
+// halfway cases between two doubles), then random literals of every length
+// on both sides of the fast path's limits.
+//
+// Usage: number [count] [seed]
+//
+#include "../number.c"
+
+static unsigned rng_state = 12345;
+
+static unsigned rng(void)
+{
+    rng_state = rng_state * 1103515245 + 12345;
+    return (rng_state >> 16) & 0x7FFF;
+}
+
+static int checked = 0;
+static int failures = 0;
+
+static void check(const char *literal, const int len)
+{
+    char *buf = malloc(len + 1);
+    memcpy(buf, literal, len);
+    buf[len] = '\0';
+    const double expected = strtod(buf, NULL);
+    const double actual = number_parse(literal, len);
+    checked++;
+    if (memcmp(&expected, &actual, sizeof(double)) != 0) {
+        if (failures < 20) {
+            printf("number_parse(\"%s\") = %.17g, strtod: %.17g\n", buf, actual, expected);
+        }
+        failures++;
+    }
+    free(buf);
+}
+
+// `digits` random digits (the first one not a 0 unless `zeros`)
+static char *append_digits(char *p, const int digits, const bool zeros)
+{
+    for (int i = 0; i < digits; ++i) {
+        *p++ = (char) ('0' + (i == 0 && !zeros ? 1 + rng() % 9 : rng() % 10));
+    }
+    return p;
+}
+
+int main(int argc, const char *argv[])
+{
+    const int count = argc > 1 ? atoi(argv[1]) : 200000;
+    if (argc > 2) {
+        rng_state = (unsigned) atoi(argv[2]);
+    }
+
+    static const char *cases[] = {
+        "0", "0.0", "000", "000.000", "1", "1.0", "0.1", "0.5", "3.14159", "10", "100.001",
+        "9007199254740991", "9007199254740992", "9007199254740993", "9007199254740995",
+        "18446744073709551615", "18446744073709551616", "123456789012345678901234567890",
+        "0.30000000000000004", "1.7976931348623157", "4.9406564584124654",
+        "0.1000000000000000055511151231257827021181583404541015625",
+        "2.2250738585072011", "2.2250738585072014",
+        "179769313486231580793728971405303415079934132710037826936173778980444968292764750946649"
+        "017977587207096330286416692887910946555547851940402630657488671505820681908902000708383"
+        "676273854845817711531764475730270069855571366959622842914819860834936475292719074168444"
+        "365510704342711559699508093042880177904174497792",
+        "179769313486231580793728971405303415079934132710037826936173778980444968292764750946649"
+        "017977587207096330286416692887910946555547851940402630657488671505820681908902000708383"
+        "676273854845817711531764475730270069855571366959622842914819860834936475292719074168444"
+        "365510704342711559699508093042880177904174497791",
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        check(cases[i], (int) strlen(cases[i]));
+    }
+
+    // 1e-k, 1e+k, 2^-k written out in full: subnormals, underflow to 0 and
+    // overflow to inf
+    char buf[2048];
+    for (int k = 1; k <= 340; ++k) {
+        int n = sprintf(buf, "0.");
+        memset(buf + n, '0', k - 1);
+        n += k - 1;
+        buf[n++] = '1';
+        check(buf, n);
+        buf[0] = '1';
+        memset(buf + 1, '0', k);
+        check(buf, k + 1);
+    }
+    for (int k = 1; k <= 1074; k += 7) {
+        const int n = snprintf(buf, sizeof(buf), "%.1100f", ldexp(1.0, -k));
+        check(buf, n);
+    }
+
+    // Random literals: an integer part of 0-30 digits, then perhaps a
+    // fraction of 1-30, some with leading zeros on either side
+    for (int i = 0; i < count; ++i) {
+        char *p = buf;
+        const int int_digits = rng() % 31;
+        if (int_digits == 0) {
+            *p++ = '0';
+        } else {
+            p = append_digits(p, int_digits, rng() % 8 == 0);
+        }
+        if (rng() % 4) {
+            *p++ = '.';
+            if (rng() % 4 == 0) {
+                for (int z = rng() % 300; z > 0; --z) *p++ = '0';
+            }
+            p = append_digits(p, 1 + rng() % 30, true);
+        }
+        check(buf, p - buf);
+    }
+
+    printf("number_parse: %d of %d literals differ from strtod\n", failures, checked);
+    return failures != 0;
+}
@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# Runs every test/*.loxy program on each engine, then again with the
+# collector running at every allocation, and compares what it prints with
+# its .out file: the program's output and, if it fails, its exit code and
+# diagnostics. All engines must print exactly the same.
+#
+# Usage: test/run.sh [--update] [loxy]   (./loxy)
+#   --update rewrites the .out files from the tree-walker's output
+#
+update=false
+if [ "$1" = "--update" ]; then
+    update=true
+    shift
+fi
+loxy=${1:-./loxy}
+case $loxy in
+    /*) ;;
+    *) loxy=$PWD/$loxy ;;
+esac
+cd "$(dirname "$0")" || exit 1 # diagnostics name the files relative to it
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# loxy leaves freeing to the OS at exit
+export ASAN_OPTIONS=detect_leaks=0
+
+run() {
+    # $1: file, the rest: flags
+    file=$1
+    shift
+    "$loxy" "$@" "$file" > "$tmp/stdout" 2> "$tmp/stderr"
+    code=$?
+    cat "$tmp/stdout"
+    if [ $code -ne 0 ]; then
+        echo "exit $code"
+        cat "$tmp/stderr"
+    fi
+}
+
+failed=0
+total=0
+for file in *.loxy; do
+    expected=${file%.loxy}.out
+    if $update; then
+        run "$file" > "$expected"
+        continue
+    fi
+    for flags in "" "--fold" "--jit" "--vm" "--vm --fold" "--gc-stress" "--vm --gc-stress"; do
+        total=$((total + 1))
+        # shellcheck disable=SC2086 # flags are split on purpose
+        run "$file" $flags > "$tmp/actual"
+        if ! diff -u "$expected" "$tmp/actual" > "$tmp/diff"; then
+            echo "FAIL: $file ${flags:-(tree)}"
+            cat "$tmp/diff"
+            failed=$((failed + 1))
+        fi
+    done
+done
+if $update; then
+    exit 0
+fi
+echo "programs: $((total - failed))/$total passed"
+[ $failed -eq 0 ]
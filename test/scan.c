@@ -0,0 +1,316 @@
+//
+// The DFA scanner against a reference scanner written straight from the
+// grammar, one char at a time, on random inputs: `scan` with every kernel
+// set, and the streaming scanner with chunks of a few sizes, must find the
+// same tokens (types, offsets and lengths) and the same errors.
+//
+// The inputs are made of tokens and near-tokens (`1.`, `.5`, `//` at the end
+// of the input, strings with newlines) with runs long enough to cross the
+// SIMD kernels' blocks, and now and then an unexpected character, a NUL or
+// an unterminated string.
+//
+// Usage: scan [count] [seed]
+//
+#include "../scanner.c"
+#include "../stream.c"
+
+static unsigned rng_state = 12345;
+
+static unsigned rng(void)
+{
+    rng_state = rng_state * 1103515245 + 12345;
+    return (rng_state >> 16) & 0x7FFF;
+}
+
+typedef struct {
+    TokenType type;
+    int offset;
+    int len;
+} RefToken;
+
+typedef enum {
+    REF_OK,
+    REF_NUL,   // ended at a NUL byte
+    REF_ERROR, // ended at an unexpected character or an unterminated string
+} RefEnd;
+
+static bool ref_is_digit(const char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static bool ref_is_alpha(const char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static TokenType ref_keyword(const char *p, const int len)
+{
+#define REF_KEYWORD(t, ...) \
+    if (len == KEYWORD_LEN(__VA_ARGS__) && memcmp(p, KEYWORD_CHARS(__VA_ARGS__), len) == 0) return t;
+    KEYWORDS(REF_KEYWORD)
+#undef REF_KEYWORD
+    return TOKEN_IDENTIFIER;
+}
+
+// The tokens of [src, src+len), which is followed by a NUL, ending with TOKEN_EOF
+static RefEnd reference_scan(const char *src, const int len, RefToken **tokens)
+{
+    arr_reset(*tokens);
+    RefEnd how = REF_OK;
+    const char *p = src, *end = src + len;
+    while (p < end) {
+        const char *start = p;
+        TokenType type;
+        switch (*p++) {
+            case ' ': case '\t': case '\r': case '\n': continue;
+            case '(': type = TOKEN_LEFT_PAREN; break;
+            case ')': type = TOKEN_RIGHT_PAREN; break;
+            case '{': type = TOKEN_LEFT_BRACE; break;
+            case '}': type = TOKEN_RIGHT_BRACE; break;
+            case ';': type = TOKEN_SEMICOLON; break;
+            case ',': type = TOKEN_COMMA; break;
+            case '.': type = TOKEN_DOT; break;
+            case '-': type = TOKEN_MINUS; break;
+            case '+': type = TOKEN_PLUS; break;
+            case '*': type = TOKEN_STAR; break;
+            case '!': type = *p == '=' ? (p++, TOKEN_BANG_EQUAL) : TOKEN_BANG; break;
+            case '=': type = *p == '=' ? (p++, TOKEN_EQUAL_EQUAL) : TOKEN_EQUAL; break;
+            case '<': type = *p == '=' ? (p++, TOKEN_LESS_EQUAL) : TOKEN_LESS; break;
+            case '>': type = *p == '=' ? (p++, TOKEN_GREATER_EQUAL) : TOKEN_GREATER; break;
+            case '/':
+                type = TOKEN_SLASH;
+                if (*p == '/') {
+                    while (p < end && *p != '\n') p++;
+                    type = TOKEN_COMMENT;
+                }
+                break;
+            case '"':
+                while (p < end && *p != '"') p++;
+                if (p == end) {
+                    how = REF_ERROR;
+                    goto done;
+                }
+                p++;
+                arr_push(*tokens, ((RefToken) {TOKEN_STRING, start + 1 - src, p - start - 2}));
+                continue;
+            case '\0':
+                arr_push(*tokens, ((RefToken) {TOKEN_EOF, start - src, 1}));
+                how = REF_NUL;
+                goto done;
+            default:
+                if (ref_is_digit(*start)) {
+                    while (ref_is_digit(*p)) p++;
+                    if (*p == '.' && ref_is_digit(p[1])) {
+                        p++;
+                        while (ref_is_digit(*p)) p++;
+                    }
+                    type = TOKEN_NUMBER;
+                } else if (ref_is_alpha(*start)) {
+                    while (ref_is_alpha(*p) || ref_is_digit(*p)) p++;
+                    type = ref_keyword(start, p - start);
+                } else {
+                    how = REF_ERROR;
+                    goto done;
+                }
+        }
+        arr_push(*tokens, ((RefToken) {type, start - src, p - start}));
+    }
+done:
+    arr_push(*tokens, ((RefToken) {TOKEN_EOF, len, 0}));
+    return how;
+}
+
+static void emit(char **src, const char *s)
+{
+    arr_concat(*src, s, (int) strlen(s));
+}
+
+static void emit_run(char **src, const char *chars, int n)
+{
+    const int len = (int) strlen(chars);
+    while (n-- > 0) arr_push(*src, chars[rng() % len]);
+}
+
+// A random input of about `size` bytes, with an error one time in `errors`
+static void generate(char **src, const int size, const int errors)
+{
+    static const char *fragments[] = {
+        "(", ")", "{", "}", ";", ",", ".", "-", "+", "*", "/", "!", "!=", "=", "==", "<",
+        "<=", ">", ">=", "and", "class", "else", "false", "for", "fn", "if", "nil", "or",
+        "print", "return", "super", "this", "true", "var", "while", "fo", "classy", "_",
+        "1.", ".5", "1..2", "007", "//", "/ /", "\"\"", "\"//\"", "a.b", "x1", "9x",
+    };
+    static const char *alnum = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789";
+    static const char *text = "abc XYZ 019 ;.(){}=!<>/*+- \t";
+    arr_reset(*src);
+    while (arr_count(*src) < size) {
+        switch (rng() % 10) {
+            case 0: case 1: case 2:
+                emit(src, fragments[rng() % (sizeof(fragments) / sizeof(fragments[0]))]);
+                break;
+            case 3: // identifier
+                arr_push(*src, alnum[rng() % 53]);
+                emit_run(src, alnum, rng() % 8 ? rng() % 8 : rng() % 100);
+                break;
+            case 4: // number
+                emit_run(src, "0123456789", 1 + (rng() % 8 ? rng() % 4 : rng() % 70));
+                if (rng() % 2) {
+                    arr_push(*src, '.');
+                    emit_run(src, "0123456789", rng() % 8 ? rng() % 4 : rng() % 70);
+                }
+                break;
+            case 5: // string
+                arr_push(*src, '"');
+                emit_run(src, text, rng() % 8 ? rng() % 10 : rng() % 200);
+                if (rng() % 4 == 0) arr_push(*src, '\n');
+                arr_push(*src, '"');
+                break;
+            case 6: // comment
+                emit(src, "//");
+                emit_run(src, text, rng() % 8 ? rng() % 10 : rng() % 200);
+                break;
+            default: // whitespace
+                emit_run(src, " \t\r\n", 1 + (rng() % 8 ? 0 : rng() % 70));
+                break;
+        }
+        if (rng() % 10 == 0) {
+            arr_push(*src, rng() % 3 ? ' ' : '\n');
+        }
+        if (errors && rng() % (unsigned) errors == 0) {
+            switch (rng() % 4) {
+                case 0: arr_push(*src, '@'); break;
+                case 1: arr_push(*src, (char) 0x80 + rng() % 128); break;
+                case 2: arr_push(*src, '\0'); break;
+                case 3: arr_push(*src, '"'); break; // unterminated, unless another one follows
+            }
+        }
+    }
+    if (rng() % 4 == 0) {
+        emit(src, rng() % 2 ? "//" : "1.");
+    }
+}
+
+static int failures = 0;
+
+static void fail(const char *what, const char *src, const int len, const int token)
+{
+    if (failures++ < 10) {
+        printf("%s differs at token %d of input:\n%.*s\n---\n", what, token, len, src);
+    }
+}
+
+static void compare_scan(const char *what, Buffer *b, const RefToken *ref, const RefEnd how)
+{
+    Scanner s = {0};
+    had_error = false;
+    const TokenStream *tokens = scan(&s, b);
+    if (!tokens != (how == REF_ERROR)) {
+        fail(what, b->head, b->len, -1);
+    } else {
+        const int n = token_stream_count(&s.tokens);
+        for (int i = 0; i < max(n, arr_count(ref)); ++i) {
+            if (i >= n || i >= arr_count(ref) || s.tokens.types[i] != ref[i].type
+                    || (int) s.tokens.offsets[i] != ref[i].offset || (int) s.tokens.lens[i] != ref[i].len) {
+                fail(what, b->head, b->len, i);
+                break;
+            }
+        }
+    }
+    token_stream_reset(&s.tokens, NULL);
+    arr_free(s.tokens.types);
+    arr_free(s.tokens.offsets);
+    arr_free(s.tokens.lens);
+    arr_free(s.tokens.numbers);
+    arr_free(s.lines.starts);
+}
+
+typedef struct {
+    TokenType *types; // arr
+    int *lens;        // arr
+    char *lexemes;    // arr; every lexeme, one after the other
+} Streamed;
+
+static void collect(void *ctx, const Token *t)
+{
+    Streamed *st = ctx;
+    arr_push(st->types, t->type);
+    arr_push(st->lens, t->lexeme.len);
+    arr_concat(st->lexemes, t->lexeme.head, t->lexeme.len);
+}
+
+// The streaming scanner stops at an error or a NUL without a final TOKEN_EOF
+static void compare_stream(const int chunk, Buffer *b, const RefToken *ref, const RefEnd how)
+{
+    static Streamed st;
+    static StreamScanner ss;
+    arr_reset(st.types);
+    arr_reset(st.lens);
+    arr_reset(st.lexemes);
+    had_error = false;
+    stream_init(&ss, "generated", collect, &st);
+    int longest = 0; // token, with a string's quotes or a number's lookahead
+    for (int i = 0; i < arr_count(ref); ++i) {
+        longest = max(longest, ref[i].len + 2);
+    }
+    for (int at = 0; at < b->len; at += chunk) {
+        stream_feed(&ss, b->head + at, min(chunk, b->len - at));
+        if (how != REF_ERROR && ss.carried > longest) { // only the unfinished token is kept
+            fail("stream carry", b->head, b->len, -1);
+            return;
+        }
+    }
+    stream_finish(&ss);
+
+    const int expected = arr_count(ref) - (how != REF_OK);
+    if (ss.had_error != (how == REF_ERROR) || arr_count(st.types) != expected) {
+        fail("stream", b->head, b->len, -1);
+        return;
+    }
+    const char *lexeme = st.lexemes;
+    for (int i = 0; i < expected; ++i) {
+        const int len = st.lens[i];
+        if (st.types[i] != ref[i].type || (ref[i].type != TOKEN_EOF
+                    && (len != ref[i].len || memcmp(lexeme, b->head + ref[i].offset, len) != 0))) {
+            fail("stream", b->head, b->len, i);
+            return;
+        }
+        lexeme += len;
+    }
+}
+
+int main(int argc, const char *argv[])
+{
+    const int count = argc > 1 ? atoi(argv[1]) : 3000;
+    if (argc > 2) {
+        rng_state = (unsigned) atoi(argv[2]);
+    }
+    log_file = fopen("/dev/null", "w"); // the errors are expected
+
+    static const ScanKernelKind kinds[] = {SCAN_KERNEL_SCALAR, SCAN_KERNEL_SSE2, SCAN_KERNEL_AVX2};
+    static const int chunks[] = {1, 3, 64, 4096};
+    char *src = NULL; // arr
+    RefToken *ref = NULL; // arr
+    for (int i = 0; i < count; ++i) {
+        generate(&src, 1 + rng() % (i % 10 ? 300 : 5000), i % 3 ? 0 : 200);
+        arr_push(src, '\0');
+        Buffer b = {.name = "generated", .head = src, .len = arr_count(src) - 1};
+        const RefEnd how = reference_scan(b.head, b.len, &ref);
+
+        for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); ++k) {
+            const ScanKernels *kernels = scan_kernels_use(kinds[k]);
+            if (kernels) {
+                compare_scan(kernels->name, &b, ref, how);
+            }
+        }
+        scan_kernels_use(SCAN_KERNEL_AUTO);
+        for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c) {
+            compare_stream(chunks[c], &b, ref, how);
+        }
+        (void) arr_pop(src);
+    }
+    arr_free(src);
+    arr_free(ref);
+    printf("scanner: %d mismatches with the reference in %d inputs\n", failures, count);
+    return failures != 0;
+}
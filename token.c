@@ -3,6 +3,43 @@
 #ifndef COMMON_H
 #include "common.h"
 #endif
+#ifndef ERROR_C
+#include "error.c"
+#endif
+
+// X(token type, chars of the lexeme...)
+//
+// The lexeme is spelled out as chars so that KEYWORD_HASH can place each
+// keyword in the `keywords` table at compile time: a char of a string
+// literal is not a constant expression in C, but these are, and the first
+// two and the length all come from the one list.
+#define KEYWORDS(X) \
+    X(TOKEN_AND,    'a', 'n', 'd') \
+    X(TOKEN_CLASS,  'c', 'l', 'a', 's', 's') \
+    X(TOKEN_ELSE,   'e', 'l', 's', 'e') \
+    X(TOKEN_FALSE,  'f', 'a', 'l', 's', 'e') \
+    X(TOKEN_FOR,    'f', 'o', 'r') \
+    X(TOKEN_FN,     'f', 'n') \
+    X(TOKEN_IF,     'i', 'f') \
+    X(TOKEN_NIL,    'n', 'i', 'l') \
+    X(TOKEN_OR,     'o', 'r') \
+    X(TOKEN_PRINT,  'p', 'r', 'i', 'n', 't') \
+    X(TOKEN_RETURN, 'r', 'e', 't', 'u', 'r', 'n') \
+    X(TOKEN_SUPER,  's', 'u', 'p', 'e', 'r') \
+    X(TOKEN_THIS,   't', 'h', 'i', 's') \
+    X(TOKEN_TRUE,   't', 'r', 'u', 'e') \
+    X(TOKEN_VAR,    'v', 'a', 'r') \
+    X(TOKEN_WHILE,  'w', 'h', 'i', 'l', 'e')
+
+// The lexeme (not NUL-terminated), its length and its first two chars
+#define KEYWORD_CHARS(...) ((const char[]) {__VA_ARGS__})
+#define KEYWORD_LEN(...) ((int) sizeof(KEYWORD_CHARS(__VA_ARGS__)))
+#define KEYWORD_C0(c0, ...) (c0)
+#define KEYWORD_C1(...) KEYWORD_C1_(__VA_ARGS__, 0)
+#define KEYWORD_C1_(c0, c1, ...) (c1)
+
+#define KEYWORD_TOKEN_TYPE(t, ...) t,
+#define KEYWORD_TOKEN_NAME(t, ...) #t,
 
 typedef enum {
     TOKEN_NONE,
@@ -33,22 +70,7 @@ typedef enum {
     TOKEN_NUMBER,
 
     // Keywords
-    TOKEN_AND,
-    TOKEN_CLASS,
-    TOKEN_ELSE,
-    TOKEN_FALSE,
-    TOKEN_FOR,
-    TOKEN_FN,
-    TOKEN_IF,
-    TOKEN_NIL,
-    TOKEN_OR,
-    TOKEN_PRINT,
-    TOKEN_RETURN,
-    TOKEN_SUPER,
-    TOKEN_THIS,
-    TOKEN_TRUE,
-    TOKEN_VAR,
-    TOKEN_WHILE,
+    KEYWORDS(KEYWORD_TOKEN_TYPE)
 
     TOKEN_COMMENT,
     TOKEN_ERROR,
@@ -84,22 +106,7 @@ static const char *token_type_names[] = {
     "TOKEN_NUMBER",
 
     // Keywords
-    "TOKEN_AND",
-    "TOKEN_CLASS",
-    "TOKEN_ELSE",
-    "TOKEN_FALSE",
-    "TOKEN_FOR",
-    "TOKEN_FN",
-    "TOKEN_IF",
-    "TOKEN_NIL",
-    "TOKEN_OR",
-    "TOKEN_PRINT",
-    "TOKEN_RETURN",
-    "TOKEN_SUPER",
-    "TOKEN_THIS",
-    "TOKEN_TRUE",
-    "TOKEN_VAR",
-    "TOKEN_WHILE",
+    KEYWORDS(KEYWORD_TOKEN_NAME)
 
     "TOKEN_COMMENT",
     "TOKEN_ERROR",
@@ -118,53 +125,127 @@ typedef struct {
 
 typedef struct {
     TokenType type;
-    const str name;
+    str name;
 } Keyword;
 
-static Token TokenNone = (Token) {0};
 
 #define KEYWORD_MIN_LEN 2
 #define KEYWORD_MAX_LEN 6
-#define NUM_KEYWORDS 18
-static Keyword keywords[NUM_KEYWORDS] = {
-    {TOKEN_NONE,   {0}},
-    {TOKEN_AND,    (str) {"and",    3}},
-    {TOKEN_CLASS,  (str) {"class",  5}},
-    {TOKEN_ELSE,   (str) {"else",   4}},
-    {TOKEN_FALSE,  (str) {"false",  5}},
-    {TOKEN_FOR,    (str) {"for",    3}},
-    {TOKEN_FN,     (str) {"fn",     2}},
-    {TOKEN_IF,     (str) {"if",     2}},
-    {TOKEN_NIL,    (str) {"nil",    3}},
-    {TOKEN_OR,     (str) {"or",     2}},
-    {TOKEN_PRINT,  (str) {"print",  5}},
-    {TOKEN_RETURN, (str) {"return", 6}},
-    {TOKEN_SUPER,  (str) {"super" , 5}},
-    {TOKEN_THIS,   (str) {"this",   4}},
-    {TOKEN_TRUE,   (str) {"true",   4}},
-    {TOKEN_VAR,    (str) {"var",    3}},
-    {TOKEN_WHILE,  (str) {"while",  5}},
-    {TOKEN_EOF,    {0}}
+
+//
+// Perfect hash of a keyword's length and first two chars. The multipliers
+// were picked so that every keyword lands in its own slot; the static
+// assert below fails to compile if a new keyword collides.
+//
+#define KEYWORD_HASH_SIZE 32
+#define KEYWORD_HASH(len, c0, c1) (((c0) * 4 + (c1) * 3 + (len)) & (KEYWORD_HASH_SIZE - 1))
+#define KEYWORD_SLOT(t, ...) \
+    KEYWORD_HASH(KEYWORD_LEN(__VA_ARGS__), KEYWORD_C0(__VA_ARGS__), KEYWORD_C1(__VA_ARGS__))
+#define KEYWORD_ENTRY(t, ...) \
+    [KEYWORD_SLOT(t, __VA_ARGS__)] = {t, {KEYWORD_CHARS(__VA_ARGS__), KEYWORD_LEN(__VA_ARGS__)}},
+#define KEYWORD_BIT_OR(t, ...) | (1ull << KEYWORD_SLOT(t, __VA_ARGS__))
+#define KEYWORD_BIT_SUM(t, ...) + (1ull << KEYWORD_SLOT(t, __VA_ARGS__))
+
+_Static_assert((0 KEYWORDS(KEYWORD_BIT_OR)) == (0 KEYWORDS(KEYWORD_BIT_SUM)),
+        "KEYWORD_HASH is not collision-free; pick new multipliers");
+
+static const Keyword keywords[KEYWORD_HASH_SIZE] = {
+    KEYWORDS(KEYWORD_ENTRY)
 };
 
 const char *token_type_name(const Token *t) {
     return token_type_names[t->type];
 }
 
+//
+// Compact, struct-of-arrays token stream: 9 bytes per token instead of a
+// 24-byte Token. The parser only walks the dense `types` array; lexemes
+// (and through them, locations) are recovered from offsets on demand.
+//
+typedef struct {
+    const char *src;   // what `offsets` are relative to
+    uint8_t *types;    // arr of TokenType
+    uint32_t *offsets; // arr
+    uint32_t *lens;    // arr
+    double *numbers;   // arr of the values of the TOKEN_NUMBERs, in order
+} TokenStream;
+
+_Static_assert(TOKEN_EOF <= UINT8_MAX, "TokenType does not fit in TokenStream.types");
+
+#define TOKEN_INDEX_NONE (-1) // no token was added/matched
+
+void token_stream_reset(TokenStream *restrict ts, const char *restrict src)
+{
+    ts->src = src;
+    arr_reset(ts->types);
+    arr_reset(ts->offsets);
+    arr_reset(ts->lens);
+    arr_reset(ts->numbers);
+}
+
+int token_stream_count(const TokenStream *ts)
+{
+    return arr_count(ts->types);
+}
+
+// Returns the index of the new token
+int token_stream_push(TokenStream *ts, const TokenType type, const int offset, const int len)
+{
+    arr_push(ts->types, (uint8_t) type);
+    arr_push(ts->offsets, (uint32_t) offset);
+    arr_push(ts->lens, (uint32_t) len);
+    return arr_count(ts->types) - 1;
+}
+
+void token_stream_push_number(TokenStream *ts, const double value)
+{
+    arr_push(ts->numbers, value);
+}
+
+TokenType token_stream_type(const TokenStream *ts, const int i)
+{
+    return (TokenType) ts->types[i];
+}
+
+str token_stream_lexeme(const TokenStream *ts, const int i)
+{
+    return str_new_s(ts->src + ts->offsets[i], ts->lens[i]);
+}
+
+// Where token `i` is, for diagnostics; a token spanning lines is cut at the
+// end of its first
+LogLoc token_stream_loc(const TokenStream *restrict ts, LineIndex *restrict lines,
+        const char *restrict filename, const int i)
+{
+    const int offset = ts->offsets[i];
+    const int line_index = line_index_find(lines, offset);
+    const str line = line_index_get_line(lines, line_index);
+    const int len = min((int) ts->lens[i], (int) (line.head + line.len - (ts->src + offset)));
+    return (LogLoc) {
+        .filename = filename ? filename : "unknown",
+        .line_num = line_index + 1,
+        .line = line,
+        .substr = str_new_s(ts->src + offset, len),
+    };
+}
+
+Token token_stream_get(const TokenStream *ts, const int i)
+{
+    return (Token) { token_stream_type(ts, i), token_stream_lexeme(ts, i) };
+}
+
 void token_pp(const Token *t) {
     printf("[Token %p:%s] \"%.*s\"\n", (void *) t, token_type_name(t),
             t->lexeme.len, t->lexeme.head);
 }
 
-Keyword *find_keyword(const str name) {
+// One probe and one compare; empty slots have a zero length and never match
+const Keyword *find_keyword(const str name) {
     int len = name.len;
     if (KEYWORD_MIN_LEN <= len && len <= KEYWORD_MAX_LEN) {
-        Keyword k;
-        for (int i = 1; i < NUM_KEYWORDS; ++i) {
-            k = keywords[i];
-            if (len == k.name.len && str_ncmp(name, k.name, len) == 0) {
-                return &keywords[i];
-            }
+        const Keyword *k = &keywords[KEYWORD_HASH(len, name.head[0], name.head[1])];
+        if (len == k->name.len && memcmp(name.head, k->name.head, len) == 0) {
+            return k;
         }
     }
     return NULL;
@@ -0,0 +1,301 @@
+#define VALUE_C
+
+#ifndef COMMON_H
+#include "common.h"
+#endif
+#ifndef INTERN_C
+#include "intern.c"
+#endif
+#ifndef NUMBER_C
+#include "number.c"
+#endif
+
+//
+// Runtime values, NaN-boxed into 64 bits.
+//
+// A number is stored as its double. Every other value is a quiet NaN with the
+// bits of VALUE_QNAN set, which no arithmetic on numbers produces (hardware
+// NaNs only set the top fraction bit), and its type in the payload:
+//
+//   nil, false, true   VALUE_QNAN | 1, 2, 3
+//   string             VALUE_QNAN | VALUE_STRING | intern handle
+//   object             VALUE_SIGN | VALUE_QNAN | pointer
+//
+// so nil, booleans, numbers and interned strings (e.g. literals) need no
+// allocation. Strings made at runtime are objects on the garbage-collected
+// heap (see gc.c); both kinds of string compare by their chars.
+//
+// A runtime string is flat, with its chars inline, or a rope: the
+// concatenation of two strings, which `+` makes in constant time without
+// copying either (short results are made flat instead; see gc_concat). A
+// rope gets its chars the first time they are needed, e.g. to print or
+// compare it, and keeps them, letting go of its two halves. Classes and
+// their instances are objects too; an instance keeps its fields in a flat
+// array laid out by its shape (see shape.c). Functions are objects that
+// say where their code is.
+//
+typedef uint64_t Value;
+
+typedef enum {
+    OBJ_STRING,
+    OBJ_CLASS,
+    OBJ_INSTANCE,
+    OBJ_FUNCTION,
+} ObjType;
+
+typedef struct Obj Obj;
+struct Obj {
+    Obj *next;    // every object on the heap, for sweeping
+    uint8_t type; // ObjType
+    bool marked;
+};
+
+typedef struct {
+    Obj obj;
+    int len;
+    const char *chars; // NUL-terminated; `flat`, or NULL for a rope until it is flattened
+    Value left;        // of a rope until it is flattened
+    Value right;
+    char flat[];       // of a flat string
+} ObjString;
+
+typedef struct Shape Shape;
+
+typedef struct {
+    Obj obj;
+    Intern name;
+    Shape *shape;   // of its instances before they have fields
+    Shape **shapes; // arr; every shape of its instances, which it owns
+    Value *methods; // arr of its methods' functions, each named by its function's name
+} ObjClass;
+
+typedef struct {
+    Obj obj;
+    ObjClass *klass;
+    Shape *shape;   // which field is in which slot
+    Value *fields;  // by slot
+    int capacity;   // of `fields`
+} ObjInstance;
+
+// Code the engine that made it can call: a node index for the tree-walker,
+// an offset in its chunk for the VM
+typedef struct {
+    Obj obj;
+    Intern name;
+    int arity;
+    int entry; // where its body starts
+    int stack; // values its frame can need, from the function itself
+} ObjFunction;
+
+#define VALUE_SIGN   ((uint64_t) 0x8000000000000000)
+#define VALUE_QNAN   ((uint64_t) 0x7ffc000000000000)
+#define VALUE_STRING ((uint64_t) 1 << 48)
+#define VALUE_TYPE   (VALUE_SIGN | VALUE_QNAN | (uint64_t) 3 << 48) // the bits that say which type
+#define VALUE_OBJ    (VALUE_SIGN | VALUE_QNAN)
+
+#define VALUE_NIL    (VALUE_QNAN | 1)
+#define VALUE_FALSE  (VALUE_QNAN | 2)
+#define VALUE_TRUE   (VALUE_QNAN | 3)
+
+// Not a value of the language: an unset global, or no result
+#define VALUE_UNDEFINED (VALUE_QNAN | 4)
+
+static inline bool value_is_number(const Value v)
+{
+    return (v & VALUE_QNAN) != VALUE_QNAN;
+}
+
+static inline bool value_is_intern(const Value v)
+{
+    return (v & VALUE_TYPE) == (VALUE_QNAN | VALUE_STRING);
+}
+
+static inline bool value_is_obj(const Value v)
+{
+    return (v & VALUE_OBJ) == VALUE_OBJ;
+}
+
+static inline Obj *value_as_obj(const Value v)
+{
+    return (Obj *) (uintptr_t) (v & ~VALUE_OBJ);
+}
+
+static inline Value value_obj(const Obj *o)
+{
+    return VALUE_OBJ | (uintptr_t) o;
+}
+
+static inline bool value_is_obj_type(const Value v, const ObjType type)
+{
+    return value_is_obj(v) && value_as_obj(v)->type == type;
+}
+
+static inline bool value_is_string(const Value v)
+{
+    return value_is_intern(v) || value_is_obj_type(v, OBJ_STRING);
+}
+
+static inline bool value_is_bool(const Value v)
+{
+    return (v | 1) == VALUE_TRUE;
+}
+
+static inline Value value_number(const double d)
+{
+    Value v;
+    memcpy(&v, &d, sizeof(v));
+    return v;
+}
+
+static inline double value_as_number(const Value v)
+{
+    double d;
+    memcpy(&d, &v, sizeof(d));
+    return d;
+}
+
+static inline Value value_bool(const bool b)
+{
+    return VALUE_FALSE | b;
+}
+
+static inline Value value_string(const Intern s)
+{
+    return VALUE_QNAN | VALUE_STRING | s;
+}
+
+static inline Intern value_as_intern(const Value v)
+{
+    return (Intern) v;
+}
+
+// Bytes of chars given to ropes since a heap last took them into account
+// (see gc.c); flattening happens where there is no heap at hand
+static _Thread_local size_t value_flattened_bytes = 0;
+
+static inline int value_string_len(const Value v)
+{
+    return value_is_intern(v) ? intern_get(value_as_intern(v)).len : ((const ObjString *) value_as_obj(v))->len;
+}
+
+// Give rope `s` its chars. The leaves are copied left to right through a
+// stack rather than by recursion, as a string built in a loop is a rope as
+// deep as the loop is long
+static void value_flatten(ObjString *s)
+{
+    static _Thread_local Value *pending = NULL; // arr; the next on top
+    char *chars = malloc(s->len + 1);
+    char *c = chars;
+    arr_reset(pending);
+    arr_push(pending, s->right);
+    arr_push(pending, s->left);
+    while (!arr_empty(pending)) {
+        const Value v = arr_pop(pending);
+        if (value_is_intern(v)) {
+            const str leaf = intern_get(value_as_intern(v));
+            memcpy(c, leaf.head, leaf.len);
+            c += leaf.len;
+            continue;
+        }
+        const ObjString *o = (const ObjString *) value_as_obj(v);
+        if (o->chars) {
+            memcpy(c, o->chars, o->len);
+            c += o->len;
+            continue;
+        }
+        arr_push(pending, o->right);
+        arr_push(pending, o->left);
+    }
+    *c = '\0';
+    s->chars = chars;
+    s->left = s->right = VALUE_NIL;
+    value_flattened_bytes += s->len + 1;
+}
+
+// The chars of a string of either kind, flattening a rope
+static inline str value_as_str(const Value v)
+{
+    if (value_is_intern(v)) {
+        return intern_get(value_as_intern(v));
+    }
+    ObjString *s = (ObjString *) value_as_obj(v);
+    if (!s->chars) {
+        value_flatten(s);
+    }
+    return str_new_s(s->chars, s->len);
+}
+
+// Only nil and false are false
+static inline bool value_is_truthy(const Value v)
+{
+    return v != VALUE_NIL && v != VALUE_FALSE;
+}
+
+// Numbers compare as doubles and strings by their chars; everything else is
+// equal only to itself
+static inline bool value_equal(const Value a, const Value b)
+{
+    if (value_is_number(a) && value_is_number(b)) {
+        return value_as_number(a) == value_as_number(b);
+    }
+    if (a == b) {
+        return true;
+    }
+    if (value_is_intern(a) && value_is_intern(b)) { // distinct interned strings
+        return false;
+    }
+    return value_is_string(a) && value_is_string(b) && value_string_len(a) == value_string_len(b)
+        && str_eq(value_as_str(a), value_as_str(b));
+}
+
+const char *value_type_name(const Value v)
+{
+    if (value_is_number(v)) return "number";
+    if (value_is_string(v)) return "string";
+    if (value_is_obj_type(v, OBJ_CLASS)) return "class";
+    if (value_is_obj_type(v, OBJ_INSTANCE)) return "instance";
+    if (value_is_obj_type(v, OBJ_FUNCTION)) return "function";
+    if (value_is_obj(v)) return "object";
+    if (value_is_bool(v)) return "bool";
+    return "nil";
+}
+
+// Append the text of `v`, as `print` shows it, to the arr `buf`
+char *value_sprint(char *buf, const Value v)
+{
+    if (value_is_number(v)) {
+        char number[32];
+        const int len = number_format(number, sizeof(number), value_as_number(v));
+        arr_concat(buf, number, len);
+    } else if (value_is_string(v)) {
+        const str s = value_as_str(v);
+        arr_concat(buf, s.head, s.len);
+    } else if (value_is_obj_type(v, OBJ_CLASS)) {
+        const str name = intern_get(((const ObjClass *) value_as_obj(v))->name);
+        arr_concat(buf, name.head, name.len);
+    } else if (value_is_obj_type(v, OBJ_INSTANCE)) {
+        const str name = intern_get(((const ObjInstance *) value_as_obj(v))->klass->name);
+        arr_concat(buf, name.head, name.len);
+        arr_concat(buf, " instance", 9);
+    } else if (value_is_obj_type(v, OBJ_FUNCTION)) {
+        const str name = intern_get(((const ObjFunction *) value_as_obj(v))->name);
+        arr_concat(buf, "<fn ", 4);
+        arr_concat(buf, name.head, name.len);
+        arr_push(buf, '>');
+    } else if (v == VALUE_NIL) {
+        arr_concat(buf, "nil", 3);
+    } else {
+        arr_concat(buf, v == VALUE_TRUE ? "true" : "false", v == VALUE_TRUE ? 4 : 5);
+    }
+    return buf;
+}
+
+// Print `v` and a newline
+void value_println(const Value v)
+{
+    static _Thread_local char *buf = NULL; // arr
+    arr_reset(buf);
+    buf = value_sprint(buf, v);
+    arr_push(buf, '\n');
+    fwrite(buf, 1, arr_count(buf), stdout);
+}
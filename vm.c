@@ -0,0 +1,432 @@
+#define VM_C
+
+#ifndef CHUNK_C
+#include "chunk.c"
+#endif
+#ifndef COMMON_H
+#include "common.h"
+#endif
+#ifndef ERROR_C
+#include "error.c"
+#endif
+#ifndef GC_C
+#include "gc.c"
+#endif
+#ifndef PROPERTY_C
+#include "property.c"
+#endif
+#ifndef TOKEN_C
+#include "token.c"
+#endif
+#ifndef VALUE_C
+#include "value.c"
+#endif
+
+// Dispatch through a table of label addresses (a GCC/Clang extension), which
+// gives each opcode its own indirect branch; else through a switch
+#ifndef VM_COMPUTED_GOTO
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+#endif
+
+//
+// Stack-based virtual machine for Chunks.
+//
+// The value stack is sized from the chunk's `max_stack` before running, and
+// a call checks there is room for its function's, so instructions never
+// check for overflow. Locals are its slots from the base of the running
+// frame, globals the heap's. Each property site of the chunk has its inline
+// cache in `caches`, which starts empty; the code a REPL line adds to the
+// chunk gets the caches of its sites, and the code before keeps its own.
+//
+// Calls work as in the tree-walker (see interp.c): the stack starts out as
+// deep as the top level needs (the chunk's max_stack) and grows, like the
+// frames, up to VM_MAX_STACK and VM_MAX_FRAMES, a callee's frame starts at
+// the function itself, and OP_TAIL_CALL reuses the caller's.
+// OP_INVOKE calls a method with its receiver as the first argument.
+//
+#define VM_MIN_FRAMES 64
+#define VM_MAX_FRAMES (1 << 16)
+#define VM_MAX_STACK  (1 << 22) // values, beyond what the top level needs
+
+typedef struct {
+    const uint8_t *ip; // the caller's, after the call
+    int base;          // the caller's, from the bottom of the stack
+} VMFrame;
+
+typedef struct {
+    const TokenStream *tokens;
+    LineIndex *lines;     // for the locations of errors
+    const char *filename;
+    int start;            // the offset to start from; the REPL's lines before it have run
+    Value *stack;         // arr
+    VMFrame *frames;      // arr
+    PropertyCache *caches; // arr; by property site
+    Heap *heap;           // for strings made at runtime; its stack roots are `stack`
+} VM;
+
+static bool vm_error(const VM *restrict vm, const Chunk *restrict chunk, const uint8_t *ip,
+        const char *restrict message)
+{
+    const int token = chunk_token(chunk, (int) (ip - chunk->code) - 1);
+    runtime_error(token_stream_loc(vm->tokens, vm->lines, vm->filename, token), message);
+    return false;
+}
+
+#if VM_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic" // labels as values
+#endif
+
+// A global read or assigned before it was defined, or a missing property
+// (`what`), by the instruction before `ip`
+static bool vm_undefined(const VM *restrict vm, const Chunk *restrict chunk, const uint8_t *ip,
+        const char *restrict what)
+{
+    const str name = token_stream_lexeme(vm->tokens, chunk_token(chunk, (int) (ip - chunk->code) - 1));
+    char message[sizeof("Undefined  ''.") + strlen(what) + name.len];
+    snprintf(message, sizeof(message), "Undefined %s '%.*s'.", what, name.len, name.head);
+    return vm_error(vm, chunk, ip, message);
+}
+
+// A call with the wrong number of arguments, by the instruction before `ip`
+static bool vm_arity(const VM *restrict vm, const Chunk *restrict chunk, const uint8_t *ip,
+        const int expected, const int got)
+{
+    char message[64];
+    snprintf(message, sizeof(message), "Expected %d arguments but got %d.", expected, got);
+    return vm_error(vm, chunk, ip, message);
+}
+
+// Double `vm->stack`, to at least `need` and at most `limit` values, keeping
+// what is on it; returns where it now is
+static Value *vm_grow_stack(VM *vm, const int need, const int limit)
+{
+    const int count = arr_count(vm->stack);
+    (void) arr_add(vm->stack, min(max(2 * count, need), limit) - count);
+    return vm->stack;
+}
+
+// Runs `chunk`, with the program's result (or VALUE_UNDEFINED if it has none)
+// in `result`; returns false (after reporting it) on an error
+bool vm_run(VM *restrict vm, const Chunk *restrict chunk, Value *restrict result)
+{
+    arr_reset(vm->stack);
+    const int top = chunk->max_stack + 1;
+    Value *stack = arr_add(vm->stack, top);
+    const Value *stack_end = stack + top;
+    Value *sp = stack;
+    Value *slots = sp;
+    arr_reset(vm->frames);
+    VMFrame *frames = arr_add(vm->frames, VM_MIN_FRAMES);
+    int num_frames = 0;
+    Value *globals = NULL;
+    // The code before `start` keeps its caches
+    const int sites = arr_count(chunk->names);
+    if (!vm->start) {
+        arr_reset(vm->caches);
+    }
+    while (arr_count(vm->caches) > sites) (void) arr_pop(vm->caches);
+    const int cached = arr_count(vm->caches);
+    memset(arr_add(vm->caches, sites - cached), 0, (sites - cached) * sizeof(*vm->caches));
+    PropertyCache *caches = vm->caches;
+    if (vm->heap) {
+        vm->heap->stack_base = vm->heap->stack_top = sp;
+        vm->heap->caches = caches;
+        vm->heap->num_caches = sites;
+        globals = vm->heap->globals;
+    }
+    *result = VALUE_UNDEFINED;
+    const uint8_t *ip = chunk->code + vm->start;
+    const Value *constants = chunk->constants;
+
+#if VM_COMPUTED_GOTO
+#define OPCODE_LABEL(op, n) &&do_##op,
+    static const void *dispatch[] = { OPCODES(OPCODE_LABEL) };
+#undef OPCODE_LABEL
+#define VM_CASE(op) do_##op:
+#define VM_NEXT goto *dispatch[*ip++]
+    VM_NEXT;
+#else
+#define VM_CASE(op) case op:
+#define VM_NEXT continue
+    for (;;) switch ((OpCode) *ip++) {
+#endif
+
+    VM_CASE(OP_CONSTANT) {
+        *sp++ = constants[*ip++];
+        VM_NEXT;
+    }
+    VM_CASE(OP_CONSTANT_LONG) {
+        *sp++ = constants[ip[0] | ip[1] << 8 | ip[2] << 16];
+        ip += 3;
+        VM_NEXT;
+    }
+    VM_CASE(OP_NIL)   { *sp++ = VALUE_NIL; VM_NEXT; }
+    VM_CASE(OP_TRUE)  { *sp++ = VALUE_TRUE; VM_NEXT; }
+    VM_CASE(OP_FALSE) { *sp++ = VALUE_FALSE; VM_NEXT; }
+    VM_CASE(OP_POP)   { sp--; VM_NEXT; }
+
+    VM_CASE(OP_NEGATE) {
+        if (!value_is_number(sp[-1])) {
+            return vm_error(vm, chunk, ip, "Operand must be a number.");
+        }
+        sp[-1] = value_number(-value_as_number(sp[-1]));
+        VM_NEXT;
+    }
+    VM_CASE(OP_UNARY_PLUS) {
+        if (!value_is_number(sp[-1])) {
+            return vm_error(vm, chunk, ip, "Operand must be a number.");
+        }
+        VM_NEXT;
+    }
+    VM_CASE(OP_NOT) {
+        sp[-1] = value_bool(!value_is_truthy(sp[-1]));
+        VM_NEXT;
+    }
+
+    VM_CASE(OP_ADD) {
+        const Value a = sp[-2];
+        const Value b = sp[-1];
+        if (value_is_number(a) && value_is_number(b)) {
+            sp[-2] = value_number(value_as_number(a) + value_as_number(b));
+        } else if (value_is_string(a) && value_is_string(b)) {
+            vm->heap->stack_top = sp;
+            sp[-2] = gc_concat(vm->heap, a, b);
+        } else {
+            return vm_error(vm, chunk, ip, "Operands must be two numbers or two strings.");
+        }
+        sp--;
+        VM_NEXT;
+    }
+
+#define VM_BINARY(op, make, operator) \
+    VM_CASE(op) { \
+        if (!value_is_number(sp[-2]) || !value_is_number(sp[-1])) { \
+            return vm_error(vm, chunk, ip, "Operands must be numbers."); \
+        } \
+        sp[-2] = make(value_as_number(sp[-2]) operator value_as_number(sp[-1])); \
+        sp--; \
+        VM_NEXT; \
+    }
+    VM_BINARY(OP_SUBTRACT, value_number, -)
+    VM_BINARY(OP_MULTIPLY, value_number, *)
+    VM_BINARY(OP_DIVIDE, value_number, /)
+    VM_BINARY(OP_GREATER, value_bool, >)
+    VM_BINARY(OP_GREATER_EQUAL, value_bool, >=)
+    VM_BINARY(OP_LESS, value_bool, <)
+    VM_BINARY(OP_LESS_EQUAL, value_bool, <=)
+#undef VM_BINARY
+
+    VM_CASE(OP_EQUAL) {
+        sp[-2] = value_bool(value_equal(sp[-2], sp[-1]));
+        sp--;
+        VM_NEXT;
+    }
+    VM_CASE(OP_NOT_EQUAL) {
+        sp[-2] = value_bool(!value_equal(sp[-2], sp[-1]));
+        sp--;
+        VM_NEXT;
+    }
+
+    VM_CASE(OP_GET_LOCAL) { *sp++ = slots[*ip++]; VM_NEXT; }
+    VM_CASE(OP_SET_LOCAL) { slots[*ip++] = sp[-1]; VM_NEXT; }
+    VM_CASE(OP_GET_GLOBAL) {
+        const Value v = globals[ip[0] | ip[1] << 8 | ip[2] << 16];
+        ip += 3;
+        if (v == VALUE_UNDEFINED) {
+            return vm_undefined(vm, chunk, ip - 3, "variable");
+        }
+        *sp++ = v;
+        VM_NEXT;
+    }
+    VM_CASE(OP_SET_GLOBAL) {
+        Value *global = &globals[ip[0] | ip[1] << 8 | ip[2] << 16];
+        ip += 3;
+        if (*global == VALUE_UNDEFINED) {
+            return vm_undefined(vm, chunk, ip - 3, "variable");
+        }
+        *global = sp[-1];
+        VM_NEXT;
+    }
+    VM_CASE(OP_DEFINE_GLOBAL) {
+        globals[ip[0] | ip[1] << 8 | ip[2] << 16] = *--sp;
+        ip += 3;
+        VM_NEXT;
+    }
+    VM_CASE(OP_POPN)   { sp -= *ip++; VM_NEXT; }
+    VM_CASE(OP_PRINT)  { value_println(*--sp); VM_NEXT; }
+    VM_CASE(OP_RESULT) { *result = *--sp; VM_NEXT; }
+
+    VM_CASE(OP_JUMP_IF_FALSE) {
+        const int distance = ip[0] | ip[1] << 8 | ip[2] << 16;
+        ip += 3;
+        if (!value_is_truthy(sp[-1])) ip += distance;
+        VM_NEXT;
+    }
+    VM_CASE(OP_JUMP_IF_TRUE) {
+        const int distance = ip[0] | ip[1] << 8 | ip[2] << 16;
+        ip += 3;
+        if (value_is_truthy(sp[-1])) ip += distance;
+        VM_NEXT;
+    }
+
+    VM_CASE(OP_POP_JUMP_IF_FALSE) {
+        const int distance = ip[0] | ip[1] << 8 | ip[2] << 16;
+        ip += 3;
+        if (!value_is_truthy(*--sp)) ip += distance;
+        VM_NEXT;
+    }
+    VM_CASE(OP_JUMP) {
+        ip += 3 + (ip[0] | ip[1] << 8 | ip[2] << 16);
+        VM_NEXT;
+    }
+    VM_CASE(OP_LOOP) {
+        const int distance = ip[0] | ip[1] << 8 | ip[2] << 16;
+        ip += 3 - distance;
+        VM_NEXT;
+    }
+
+    VM_CASE(OP_CLASS) {
+        const Intern name = value_as_intern(constants[ip[0] | ip[1] << 8 | ip[2] << 16]);
+        ip += 3;
+        vm->heap->stack_top = sp;
+        const Value klass = gc_new_class(vm->heap, name);
+        *sp++ = klass;
+        VM_NEXT;
+    }
+    VM_CASE(OP_CALL)
+    VM_CASE(OP_TAIL_CALL)
+    VM_CASE(OP_INVOKE) {
+        const OpCode op = ip[-1];
+        int count = *ip++;
+        bool method = false; // the receiver is the first argument
+        if (op == OP_INVOKE) {
+            Value *receiver = sp - count - 1;
+            if (*receiver == VALUE_NIL) { // a field's value, called like any other
+                memmove(receiver, receiver + 1, count * sizeof(Value));
+                sp--;
+            } else {
+                count++;
+                method = true;
+            }
+        }
+        Value *callee = sp - count - 1;
+        if (value_is_obj_type(*callee, OBJ_FUNCTION)) {
+            const ObjFunction *fn = (const ObjFunction *) value_as_obj(*callee);
+            if (count != fn->arity) {
+                return vm_arity(vm, chunk, ip - 1, fn->arity - method, count - method);
+            }
+            if (op == OP_TAIL_CALL) {
+                memmove(slots, callee, (count + 1) * sizeof(Value));
+            } else {
+                if (num_frames == arr_count(vm->frames)) {
+                    if (num_frames == VM_MAX_FRAMES) {
+                        return vm_error(vm, chunk, ip - 1, "Stack overflow.");
+                    }
+                    (void) arr_add(vm->frames, min(num_frames, VM_MAX_FRAMES - num_frames));
+                    frames = vm->frames;
+                }
+                frames[num_frames++] = (VMFrame) {ip, (int) (slots - stack)};
+                slots = callee;
+            }
+            if (slots + fn->stack > stack_end) {
+                const int at = (int) (slots - stack);
+                if (at + fn->stack > top + VM_MAX_STACK) {
+                    return vm_error(vm, chunk, ip - 1, "Stack overflow.");
+                }
+                stack = vm_grow_stack(vm, at + fn->stack, top + VM_MAX_STACK);
+                stack_end = stack + arr_count(vm->stack);
+                slots = stack + at;
+                if (vm->heap) {
+                    vm->heap->stack_base = stack;
+                }
+            }
+            sp = slots + 1 + count;
+            ip = chunk->code + fn->entry;
+            VM_NEXT;
+        }
+        if (!value_is_obj_type(*callee, OBJ_CLASS)) {
+            return vm_error(vm, chunk, ip - 1, "Can only call functions and classes.");
+        }
+        if (count != 0) {
+            return vm_arity(vm, chunk, ip - 1, 0, count);
+        }
+        vm->heap->stack_top = sp;
+        *callee = gc_new_instance(vm->heap, (ObjClass *) value_as_obj(*callee));
+        sp = callee + 1;
+        VM_NEXT;
+    }
+    VM_CASE(OP_GET_PROPERTY) {
+        const int site = ip[0] | ip[1] << 8 | ip[2] << 16;
+        ip += 3;
+        if (!value_is_obj_type(sp[-1], OBJ_INSTANCE)) {
+            return vm_error(vm, chunk, ip - 3, "Only instances have properties.");
+        }
+        if (!property_get(&caches[site], (const ObjInstance *) value_as_obj(sp[-1]), chunk->names[site], &sp[-1])) {
+            return vm_undefined(vm, chunk, ip - 3, "property");
+        }
+        VM_NEXT;
+    }
+    VM_CASE(OP_SET_PROPERTY) {
+        const int site = ip[0] | ip[1] << 8 | ip[2] << 16;
+        ip += 3;
+        if (!value_is_obj_type(sp[-2], OBJ_INSTANCE)) {
+            return vm_error(vm, chunk, ip - 3, "Only instances have fields.");
+        }
+        property_set(vm->heap, &caches[site], (ObjInstance *) value_as_obj(sp[-2]), chunk->names[site], sp[-1]);
+        sp[-2] = sp[-1];
+        sp--;
+        VM_NEXT;
+    }
+    VM_CASE(OP_GET_METHOD) {
+        const int site = ip[0] | ip[1] << 8 | ip[2] << 16;
+        ip += 3;
+        if (!value_is_obj_type(sp[-1], OBJ_INSTANCE)) {
+            return vm_error(vm, chunk, ip - 3, "Only instances have properties.");
+        }
+        if (!property_method(&caches[site], sp - 1, chunk->names[site])) {
+            return vm_undefined(vm, chunk, ip - 3, "property");
+        }
+        sp++;
+        VM_NEXT;
+    }
+    VM_CASE(OP_METHOD) {
+        property_add_method((ObjClass *) value_as_obj(sp[-2]), sp[-1]);
+        sp--;
+        VM_NEXT;
+    }
+
+    VM_CASE(OP_FUNCTION) {
+        const ChunkFunction *fn = &chunk->functions[ip[0] | ip[1] << 8 | ip[2] << 16];
+        ip += 3;
+        vm->heap->stack_top = sp;
+        const Value v = gc_new_function(vm->heap, fn->name, fn->arity, fn->entry, fn->max_stack);
+        *sp++ = v;
+        VM_NEXT;
+    }
+    VM_CASE(OP_RETURN) {
+        if (num_frames == 0) {
+            return true;
+        }
+        const VMFrame frame = frames[--num_frames];
+        slots[0] = sp[-1]; // over the function
+        sp = slots + 1;
+        slots = stack + frame.base;
+        ip = frame.ip;
+        VM_NEXT;
+    }
+
+#if !VM_COMPUTED_GOTO
+    }
+#endif
+#undef VM_CASE
+#undef VM_NEXT
+}
+
+#if VM_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif